@@ -110,8 +110,9 @@ uint16_t cap3vector[4] = {208, 208, 208, 208};
 uint8_t cap3idx = 0;
 
 void loop() {
-  // If file transfer finishes, wait for new file transfer
-  if (rxymodem.loop() == 0) {
+  // If file transfer finishes, wait for new file transfer. Give the
+  // transfer about 2 ms per call so the buttons and playback keep up.
+  if (rxymodem.loop(2000) == 0) {
     rxymodem.start_rb(&XMODEM_PORT, &FATFILESYS, true, true);  // Ymodem 1K CRC
   }
 
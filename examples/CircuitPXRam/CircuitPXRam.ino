@@ -0,0 +1,45 @@
+/*
+ * Play a sound received straight into RAM.
+ *
+ * Send a PCM file (8 bit unsigned, 11025 samples per second, see
+ * ../CircuitPXAudio/mkpcm.sh) with YMODEM. It is received into a RAM
+ * buffer by XYramSink, without going through the SPI Flash. Pressing the
+ * left button plays the last file received.
+ *
+ * $ sb -k button1.pcm </dev/ttyACM2 >/dev/ttyACM2
+ */
+
+#include <Adafruit_CircuitPlayground.h>
+#include <xymodem.h>
+
+uint8_t pcmdata[16384];
+XYramSink pcmsink(pcmdata, sizeof(pcmdata));
+XYmodem rxymodem;
+
+bool leftButtonDown = false;
+
+void setup() {
+  XMODEM_PORT.begin(115200);
+  CircuitPlayground.begin();
+
+  rxymodem.set_sink(&pcmsink);
+  // No file system needed.
+  rxymodem.start_rb(&XMODEM_PORT, NULL, true, true);  // Ymodem 1K CRC
+}
+
+void loop() {
+  // If file transfer finishes, wait for new file transfer
+  if (rxymodem.loop() == 0) {
+    rxymodem.start_rb(&XMODEM_PORT, NULL, true, true);
+  }
+
+  if (CircuitPlayground.leftButton() && !leftButtonDown) {
+    leftButtonDown = true;
+    if (pcmsink.length() > 0) {
+      CircuitPlayground.speaker.playSound(pcmdata, pcmsink.length(), 11025);
+    }
+  }
+  else if (!CircuitPlayground.leftButton() && leftButtonDown) {
+    leftButtonDown = false;
+  }
+}
@@ -57,9 +57,41 @@
  * params.json".
  *
  * ## Receive YMODEM batch mode. The sender may send 0 or more files including
- * file names. rb receives and creates the files.
+ * file names. rb receives and creates the files. With sync, files that are
+ * already there unchanged are not written again. With batch, many small
+ * files take less file system time, see XYmodem::set_batch().
  *
- *    rb
+ *    rb [sync] [batch]
+ *
+ * ## Receive YMODEM-G batch mode. Like rb but the sender streams blocks
+ * without waiting for ACKs. Much faster on USB but any error cancels the
+ * transfer. lrzsz: sb -k --ymodem-g or sz --ymodem-g.
+ *
+ *    rg [sync] [batch]
+ *
+ * ## Receive ZMODEM batch mode. The sender streams data and only goes back
+ * to resend from the first bad byte, so errors cost little. lrzsz: sz.
+ * With sync, the sender is told to skip files that are already there
+ * unchanged.
+ *
+ *    rz [sync] [batch]
+ *
+ * ## Show statistics for the last transfer. Time spent in loop() that is
+ * not writing is CPU time. If loop() time is small the link is the limit,
+ * if write time dominates the flash is. Needs XYMODEM_STATS.
+ *
+ *    stats
+ *
+ * ## Dump the trace of recent receiver events, to the console or a file.
+ * Decode it on a PC with extras/host/xytrace. Needs XYMODEM_TRACE.
+ *
+ *    trace [filename]
+ *
+ * ## Record every byte of the next rx, rb, rg or rz, with its time, to a
+ * file. Copy the file to a PC with sb and play the session back with
+ * extras/host/xyreplay. "record off" forgets it.
+ *
+ *    record <filename>, record off
  *
  * ## Receive one file using XMODEM. The XMODEM protocol does not allow the
  * sender to send the filename. Do not use this unless YMODEM is not available.
@@ -67,6 +99,19 @@
  *
  *    rx <filename>
  *
+ * ## Send one file using XMODEM, or with YMODEM a file or every file in a
+ * directory. The receiver on the PC chooses CRC or checksum and, for sb,
+ * YMODEM-G. lrzsz: rx -c <filename> and rb, or rb --ymodem-g.
+ *
+ *    sx <filename>
+ *
+ *    sb <filename|dirname>
+ *
+ * ## Console and transfers on one port. With CLI_LINK set to 1 below, the
+ * console is channel 0 of an XYlink on Serial and transfers run on channel
+ * 1, so commands work during a transfer. Run extras/host/xylinkpty on the
+ * PC and use /tmp/xylink0 for the terminal, /tmp/xylink1 for lrzsz.
+ *
  * ## TODO maybe, not too useful
  *
  *    ren <fromfilename> <tofilename>, mv <fromfilename> <tofilename>
@@ -77,13 +122,31 @@
 
 #include <xymodem.h>
 
+// 1 runs the console on channel 0 of an XYlink over Serial and transfers
+// on channel 1, so commands still work while a file is on its way. The PC
+// needs extras/host/xylinkpty to split the channels out again.
+#define CLI_LINK 0
+
 XYmodem rxymodem;
+#if CLI_LINK
+XYlink xylink;
+#define Console (*xylink.channel(0))
+#define TRANSFER_PORT xylink.channel(1)
+#else
+#define Console Serial
+#define TRANSFER_PORT (&XMODEM_PORT)
+#endif
 
 // CLI globals
 char cwd[128+1];     // Current Working Directory
 bool CaptureMode = false;
 bool XYmodemMode = false;
 File CaptureFile;
+// record: the next receive goes through recorder into RecordPath.
+XYcapture recorder;
+uint8_t record_buf[512];
+char RecordPath[128+1];
+bool RecordNext = false;
 
 void setup() {
   // Initialize serial port and wait for it to open before continuing.
@@ -92,14 +155,17 @@ void setup() {
   while (!Serial && millis() < 2000) {
     delay(100);
   }
-  Serial.println("FatFs Command Line Interpreter");
+#if CLI_LINK
+  xylink.begin(&Serial);
+#endif
+  Console.println("FatFs Command Line Interpreter");
   Serial1.begin(115200);
 
   if (rxymodem.begin()) {
-    Serial.println("Flash filesystem setup failed");
+    Console.println("Flash filesystem setup failed");
   }
   else {
-    Serial.println("Flash filesystem ready for use");
+    Console.println("Flash filesystem ready for use");
   }
 
   setup_cli();
@@ -127,13 +193,13 @@ int make_full_pathname(char *name, char *pathname, size_t pathname_len)
     strcpy(pathname, cwd);
     if (cwd[strlen(cwd)-1] == '/') {
       if (strlen(cwd) + strlen(name) >= pathname_len) {
-        Serial.println("pathname too long");
+        Console.println("pathname too long");
         return -2;
       }
     }
     else {
       if (strlen(cwd) + 1 + strlen(name) >= pathname_len) {
-        Serial.println("pathname too long");
+        Console.println("pathname too long");
         return -2;
       }
       strcat(pathname, "/");
@@ -150,7 +216,7 @@ void remove_file(char *aLine) {
   // Delete a file with the remove command.  For example create a test2.txt file
   // inside /test/foo and then delete it.
   if (!FATFILESYS.remove(pathname)) {
-    Serial.println("Error, couldn't delete file!");
+    Console.println("Error, couldn't delete file!");
     return;
   }
 }
@@ -161,7 +227,7 @@ void change_dir(char *aLine) {
 
   if (make_full_pathname(dirname, pathname, sizeof(pathname)) != 0) return;
   if ((strcmp(pathname, "/") != 0) && !FATFILESYS.exists(pathname)) {
-    Serial.println("Directory does not exist.");
+    Console.println("Directory does not exist.");
     return;
   }
   File d = FATFILESYS.open(pathname);
@@ -169,7 +235,7 @@ void change_dir(char *aLine) {
     strcpy(cwd, pathname);
   }
   else {
-    Serial.println("Not a directory");
+    Console.println("Not a directory");
   }
   d.close();
 }
@@ -185,7 +251,7 @@ void make_dir(char *aLine) {
   if (!FATFILESYS.exists(pathname)) {
     // Use mkdir to create directory (note you should _not_ have a trailing slash).
     if (!FATFILESYS.mkdir(pathname)) {
-      Serial.println("Error, failed to create directory!");
+      Console.println("Error, failed to create directory!");
       return;
     }
   }
@@ -201,12 +267,12 @@ void remove_dir(char *aLine) {
 
   if (make_full_pathname(dirname, pathname, sizeof(pathname)) != 0) return;
   if (!FATFILESYS.rmdir(pathname)) {
-    Serial.println("Error, couldn't delete test directory!");
+    Console.println("Error, couldn't delete test directory!");
     return;
   }
   // Check that test is really deleted.
   if (FATFILESYS.exists(pathname)) {
-    Serial.println("Error, test directory was not deleted!");
+    Console.println("Error, test directory was not deleted!");
     return;
   }
 }
@@ -214,23 +280,23 @@ void remove_dir(char *aLine) {
 void print_dir(char *aLine) {
   File dir = FATFILESYS.open(cwd);
   if (!dir) {
-    Serial.println("Directory open failed");
+    Console.println("Directory open failed");
     return;
   }
   if (!dir.isDirectory()) {
-    Serial.println("Not directory");
+    Console.println("Not directory");
     dir.close();
     return;
   }
   File child = dir.openNextFile();
   while (child) {
     // Print the file name and mention if it's a directory.
-    Serial.print(child.name());
-    Serial.print(" "); Serial.print(child.size(), DEC);
+    Console.print(child.name());
+    Console.print(" "); Console.print(child.size(), DEC);
     if (child.isDirectory()) {
-      Serial.print(" <DIR>");
+      Console.print(" <DIR>");
     }
-    Serial.println();
+    Console.println();
     // Keep calling openNextFile to get a new file.
     // When you're done enumerating files an unopened one will
     // be returned (i.e. testing it for true/false like at the
@@ -246,7 +312,7 @@ void print_file(char *aLine) {
   if (make_full_pathname(filename, pathname, sizeof(pathname)) != 0) return;
   File readFile = FATFILESYS.open(pathname, FILE_READ);
   if (!readFile) {
-    Serial.println("Error, failed to open file for reading!");
+    Console.println("Error, failed to open file for reading!");
     return;
   }
   readFile.setTimeout(0);
@@ -254,7 +320,7 @@ void print_file(char *aLine) {
     char buf[512];
     size_t bytesIn = readFile.readBytes(buf, sizeof(buf));
     if (bytesIn > 0) {
-      Serial.write(buf, bytesIn);
+      Console.write(buf, bytesIn);
     }
     else {
       break;
@@ -272,28 +338,180 @@ void capture_file(char *aLine) {
   if (make_full_pathname(filename, pathname, sizeof(pathname)) != 0) return;
   CaptureFile = FATFILESYS.open(pathname, FILE_WRITE);
   if (!CaptureFile) {
-    Serial.println("Error, failed to open file!");
+    Console.println("Error, failed to open file!");
     return;
   }
   CaptureMode = true;
 }
 
 void print_working_dir(char *aLine) {
-  Serial.println(cwd);
+  Console.println(cwd);
+}
+
+// With CLI_LINK a transfer may still be running when the next is asked for.
+bool transfer_busy(void) {
+  if (XYmodemMode) Console.println("transfer running");
+  return XYmodemMode;
+}
+
+void record_next(char *aLine) {
+  char *filename = strtok(NULL, " \t");
+
+  if (filename != NULL && strcmp(filename, "off") == 0) {
+    RecordNext = false;
+    return;
+  }
+  if (make_full_pathname(filename, RecordPath, sizeof(RecordPath)) != 0) return;
+  RecordNext = true;
+}
+
+// The port to receive on, through the recorder if record asked for it.
+Stream *rx_port(void) {
+  if (!RecordNext) return TRANSFER_PORT;
+  RecordNext = false;
+  FATFILESYS.remove(RecordPath);
+  File f = FATFILESYS.open(RecordPath, FILE_WRITE);
+  if (!f) {
+    Console.println("Error, failed to open file!");
+    return TRANSFER_PORT;
+  }
+  recorder.begin(TRANSFER_PORT, f, record_buf, sizeof(record_buf));
+  return &recorder;
 }
 
 void recv_xmodem(char *aLine) {
+  if (transfer_busy()) return;
   char *filename = strtok(NULL, " \t");
 
-  rxymodem.start_rx(&XMODEM_PORT, filename, true, true);
+  rxymodem.start_rx(rx_port(), filename, true, true);
   XYmodemMode = true;
 }
 
+// "sync" after rb, rg or rz turns on XYmodem::set_sync(), "batch"
+// XYmodem::set_batch().
+void rx_options(void) {
+  char *option;
+  bool sync = false, batch = false;
+
+  while ((option = strtok(NULL, " \t")) != NULL) {
+    if (strcmp(option, "sync") == 0) sync = true;
+    if (strcmp(option, "batch") == 0) batch = true;
+  }
+  rxymodem.set_sync(sync);
+  rxymodem.set_batch(batch);
+}
+
 void recv_ymodem(char *aLine) {
-  rxymodem.start_rb(&XMODEM_PORT, &FATFILESYS, true, true);
+  if (transfer_busy()) return;
+  rx_options();
+  rxymodem.start_rb(rx_port(), &FATFILESYS, true, true);
+  XYmodemMode = true;
+}
+
+void recv_ymodem_g(char *aLine) {
+  if (transfer_busy()) return;
+  rx_options();
+  rxymodem.start_rg(rx_port(), &FATFILESYS);
+  XYmodemMode = true;
+}
+
+void recv_zmodem(char *aLine) {
+  if (transfer_busy()) return;
+  rx_options();
+  rxymodem.start_rz(rx_port(), &FATFILESYS);
+  XYmodemMode = true;
+}
+
+#if XYMODEM_SEND
+void send_xmodem(char *aLine) {
+  if (transfer_busy()) return;
+  char *filename = strtok(NULL, " \t");
+  char pathname[128+1];
+
+  if (make_full_pathname(filename, pathname, sizeof(pathname)) != 0) return;
+  if (rxymodem.start_sx(TRANSFER_PORT, &FATFILESYS, pathname) != 0) {
+    Console.println("Error, failed to open file!");
+    return;
+  }
   XYmodemMode = true;
 }
 
+void send_ymodem(char *aLine) {
+  if (transfer_busy()) return;
+  char *filename = strtok(NULL, " \t");
+  char pathname[128+1];
+
+  if (make_full_pathname(filename, pathname, sizeof(pathname)) != 0) return;
+  if (rxymodem.start_sb(TRANSFER_PORT, &FATFILESYS, pathname) != 0) {
+    Console.println("Error, failed to open file!");
+    return;
+  }
+  XYmodemMode = true;
+}
+#endif
+
+void print_stat(const char *label, uint32_t value) {
+  Console.print(label); Console.println(value);
+}
+
+void print_stats(char *aLine) {
+  const xymodem_stats_t &s = rxymodem.stats();
+  print_stat("bytes received     ", s.bytes_rx);
+  print_stat("bytes written      ", s.bytes_committed);
+  print_stat("bytes sent         ", s.bytes_tx);
+  print_stat("files              ", s.files);
+  print_stat("blocks ok          ", s.blocks_ok);
+  print_stat("blocks nak         ", s.blocks_nak);
+  print_stat("blocks duplicate   ", s.blocks_dup);
+  print_stat("timeouts           ", s.timeouts);
+  print_stat("cancels            ", s.cans);
+  print_stat("CRC-32 mismatches  ", s.bad_digests);
+  print_stat("files unchanged    ", s.files_skipped);
+  print_stat("round trip us      ", s.srtt_us);
+  print_stat("round trip var us  ", s.rttvar_us);
+  print_stat("retry timeout ms   ", s.rto_ms);
+  if (s.blocks_ok > 0) {
+    print_stat("block us min       ", s.block_us_min);
+    print_stat("block us avg       ", s.block_us_total / s.blocks_ok);
+    print_stat("block us max       ", s.block_us_max);
+  }
+  print_stat("loop() us          ", s.loop_us);
+  print_stat("loop() us max      ", s.loop_us_max);
+  print_stat("loop() calls       ", s.loop_calls);
+  print_stat("write us           ", s.write_us);
+  print_stat("write us max       ", s.write_us_max);
+  Console.print("write us histogram ");
+  for (int i = 0; i < XYMODEM_WRITE_BUCKETS; i++) {
+    if (i < XYMODEM_WRITE_BUCKETS - 1) {
+      Console.print('<'); Console.print(250UL << i);
+    }
+    else {
+      Console.print(">="); Console.print(250UL << (i - 1));
+    }
+    Console.print(':'); Console.print(s.write_hist[i]); Console.print(' ');
+  }
+  Console.println();
+}
+
+void dump_trace(char *aLine) {
+  char *filename = strtok(NULL, " \t");
+  char pathname[128+1];
+
+  if (filename == NULL) {
+    rxymodem.trace_dump(&Console);
+    return;
+  }
+  if (make_full_pathname(filename, pathname, sizeof(pathname)) != 0) return;
+  FATFILESYS.remove(pathname);
+  File f = FATFILESYS.open(pathname, FILE_WRITE);
+  if (!f) {
+    Console.println("Error, failed to open file!");
+    return;
+  }
+  rxymodem.trace_dump(&f);
+  f.close();
+}
+
 const command_action_t commands[] = {
   // Name of command user types, function that implements the command.
   {"dir", print_dir},
@@ -309,6 +527,15 @@ const command_action_t commands[] = {
   {"capture", capture_file},
   {"rx", recv_xmodem},
   {"rb", recv_ymodem},
+  {"rg", recv_ymodem_g},
+  {"rz", recv_zmodem},
+#if XYMODEM_SEND
+  {"sx", send_xmodem},
+  {"sb", send_ymodem},
+#endif
+  {"stats", print_stats},
+  {"trace", dump_trace},
+  {"record", record_next},
   {"help", print_commands},
   {"?", print_commands},
 };
@@ -324,11 +551,11 @@ void toLower(char *s) {
 }
 
 void print_commands(char *aLine) {
-  Serial.print(commands[0].command);
+  Console.print(commands[0].command);
   for (size_t i = 1; i < sizeof(commands)/sizeof(commands[0]); i++) {
-    Serial.print(','); Serial.print(commands[i].command);
+    Console.print(','); Console.print(commands[i].command);
   }
-  Serial.println();
+  Console.println();
 }
 
 void execute(char *aLine) {
@@ -342,35 +569,40 @@ void execute(char *aLine) {
       return;
     }
   }
-  Serial.println("command not found");
+  Console.println("command not found");
 }
 
 void setup_cli() {
   Serial.setTimeout(0);
   strcpy(cwd, "/");
-  Serial.print("$ ");
+  Console.print("$ ");
 }
 
 uint8_t bytesIn;
 char aLine[80+1];
 
 void loop_cli() {
+#if CLI_LINK
+  xylink.poll();
+#endif
   if (XYmodemMode){
     if (rxymodem.loop() == 0) {
       XYmodemMode = false;
-      Serial.println();
-      Serial.print("$ ");
+      recorder.end();
+      Console.println();
+      Console.print("$ ");
     }
   }
-  else {
-    if (Serial.available() > 0) {
-      int b = Serial.read();
+  // Over an XYlink the console is its own channel and stays live.
+  if (!XYmodemMode || CLI_LINK) {
+    if (Console.available() > 0) {
+      int b = Console.read();
       if (CaptureMode) {
         if (b == 0x04) {   // ^D end of input
           CaptureMode = false;
           // Close the file when finished reading.
           CaptureFile.close();
-          Serial.print("$ ");
+          Console.print("$ ");
         }
         if (b != -1) {
           CaptureFile.print((char)b);
@@ -382,31 +614,31 @@ void loop_cli() {
             case '\n':
               break;
             case '\r':
-              Serial.println();
+              Console.println();
               aLine[bytesIn] = '\0';
               execute(aLine);
               bytesIn = 0;
-              if (!CaptureMode) Serial.print("$ ");
+              if (!CaptureMode) Console.print("$ ");
               break;
             case '\b':  // backspace
               if (bytesIn > 0) {
                 bytesIn--;
-                Serial.print((char)b); Serial.print(' '); Serial.print((char)b);
+                Console.print((char)b); Console.print(' '); Console.print((char)b);
               }
               break;
             case 0x03:  // ^C
-              Serial.println("^C");
+              Console.println("^C");
               bytesIn = 0;
-              Serial.print("$ ");
+              Console.print("$ ");
               break;
             default:
-              Serial.print((char)b);
+              Console.print((char)b);
               aLine[bytesIn++] = (char)b;
               if (bytesIn >= sizeof(aLine)-1) {
                 aLine[bytesIn] = '\0';
                 execute(aLine);
                 bytesIn = 0;
-                if (!CaptureMode && !XYmodemMode) Serial.print("$ ");
+                if (!CaptureMode && !XYmodemMode) Console.print("$ ");
               }
               break;
           }
@@ -0,0 +1,46 @@
+/*
+ * Receive YMODEM batches on several hardware serial ports at once. Each
+ * port has its own receiver and resume journal. One XYmodemMux runs them
+ * all from loop(). Teensy and boards with HAVE_HWSERIAL3, such as the
+ * Mega, use Serial1 to Serial3. Other boards, such as the Metro M4, only
+ * have Serial1. Add a port of your board to ports[] and a name to
+ * journals[] to receive on it too.
+ */
+#include <xymodem.h>
+
+#if defined(CORE_TEENSY) || defined(HAVE_HWSERIAL3)
+HardwareSerial *ports[] = {&Serial1, &Serial2, &Serial3};
+#else
+HardwareSerial *ports[] = {&Serial1};
+#endif
+const char *journals[] = {"/XYRESUM1.JNL", "/XYRESUM2.JNL", "/XYRESUM3.JNL"};
+const int NPORTS = sizeof(ports)/sizeof(ports[0]);
+
+XYmodem rxymodem[NPORTS];
+XYmodemMux mux;
+
+void setup()
+{
+  for (int i = 0; i < NPORTS; i++) {
+    ports[i]->begin(115200);
+  }
+  if (rxymodem[0].begin()) {
+    return;
+  }
+  for (int i = 0; i < NPORTS; i++) {
+    rxymodem[i].set_journal(journals[i]);
+    rxymodem[i].start_rb(ports[i], &FATFILESYS, true, true);  // Ymodem 1K CRC
+    mux.add(&rxymodem[i]);
+  }
+}
+
+void loop()
+{
+  mux.loop();
+  // Restart any receiver whose batch has finished.
+  for (int i = 0; i < NPORTS; i++) {
+    if (rxymodem[i].idle()) {
+      rxymodem[i].start_rb(ports[i], &FATFILESYS, true, true);
+    }
+  }
+}
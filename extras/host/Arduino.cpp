@@ -0,0 +1,106 @@
+#include <Arduino.h>
+#include <stdio.h>
+
+static uint32_t host_us;
+
+uint32_t millis(void) { return host_us / 1000; }
+uint32_t micros(void) { return host_us; }
+void delay(uint32_t ms) { host_us += ms * 1000; }
+// Something waiting in a loop. Let a little time pass so it can end.
+void yield(void) { host_us += 10; }
+void host_advance_us(uint32_t us) { host_us += us; }
+void host_set_micros(uint32_t us) { host_us = us; }
+
+HostSerial Serial;
+HostSerial Serial1;
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  size_t n = 0;
+  while (size--) {
+    if (write(*buffer++)) n++;
+    else break;
+  }
+  return n;
+}
+
+size_t Print::print(long n, int base)
+{
+  if (n < 0 && base == DEC) {
+    size_t len = print('-');
+    return len + print((unsigned long)-n, base);
+  }
+  return print((unsigned long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+  char buf[8 * sizeof(long) + 1];
+  char *str = &buf[sizeof(buf) - 1];
+
+  if (base < 2) base = 10;
+  *str = '\0';
+  do {
+    char c = n % base;
+    n /= base;
+    *--str = c < 10 ? c + '0' : c + 'A' - 10;
+  } while (n);
+  return write(str);
+}
+
+size_t Print::print(double n, int digits)
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.*f", digits, n);
+  return write(buf);
+}
+
+size_t Stream::readBytes(char *buffer, size_t length)
+{
+  size_t count = 0;
+  while (count < length) {
+    int c = read();
+    if (c < 0) break;
+    *buffer++ = (char)c;
+    count++;
+  }
+  return count;
+}
+
+size_t Stream::readBytesUntil(char terminator, char *buffer, size_t length)
+{
+  size_t index = 0;
+  while (index < length) {
+    int c = read();
+    if (c < 0 || c == terminator) break;
+    *buffer++ = (char)c;
+    index++;
+  }
+  return index;
+}
+
+bool Stream::find(const char *target)
+{
+  size_t index = 0;
+  size_t len = strlen(target);
+  int c;
+  while ((c = read()) >= 0) {
+    if (c == target[index]) {
+      if (++index >= len) return true;
+    }
+    else {
+      index = 0;
+    }
+  }
+  return false;
+}
+
+size_t HostSerial::write(uint8_t c)
+{
+  return fwrite(&c, 1, 1, stdout);
+}
+
+size_t HostSerial::write(const uint8_t *buffer, size_t size)
+{
+  return fwrite(buffer, 1, size, stdout);
+}
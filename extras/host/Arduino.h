@@ -0,0 +1,99 @@
+/*
+ * Minimal Arduino core stand-in so the XYmodem library compiles and runs on
+ * a Linux host. Only what xymodem.cpp and the host benchmarks use is
+ * provided. Time is virtual: millis()/micros() only move when the harness
+ * calls host_advance_us(), so timeouts are deterministic.
+ */
+
+#ifndef _HOST_ARDUINO_H_
+#define _HOST_ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <type_traits>
+
+#define HEX 16
+#define DEC 10
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+template<class T, class U>
+static inline typename std::common_type<T, U>::type min(T a, U b) { return (a < b) ? a : b; }
+template<class T, class U>
+static inline typename std::common_type<T, U>::type max(T a, U b) { return (a > b) ? a : b; }
+
+uint32_t millis(void);
+uint32_t micros(void);
+void delay(uint32_t ms);
+void yield(void);
+
+// Host only: move the virtual clock forward.
+void host_advance_us(uint32_t us);
+void host_set_micros(uint32_t us);
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *str) { return write((const uint8_t *)str, strlen(str)); }
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+    virtual void flush() {}
+
+    size_t print(const char *s) { return write(s); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(double n, int digits = 2);
+    size_t println(void) { return write("\r\n"); }
+    template<class T> size_t println(T v) { size_t n = print(v); return n + println(); }
+    template<class T> size_t println(T v, int base) { size_t n = print(v, base); return n + println(); }
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+    // No blocking on the host: timedRead gives up as soon as the input is
+    // empty, which is what a real port does once its timeout expires.
+    virtual size_t readBytes(char *buffer, size_t length);
+    size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+    size_t readBytesUntil(char terminator, char *buffer, size_t length);
+    bool find(const char *target);
+
+  protected:
+    unsigned long _timeout = 1000;
+};
+
+// Console port. Output goes to stdout, input is always empty.
+class HostSerial : public Stream {
+  public:
+    void begin(unsigned long) {}
+    operator bool() { return true; }
+    int available() { return 0; }
+    int read() { return -1; }
+    int peek() { return -1; }
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+};
+
+extern HostSerial Serial;
+extern HostSerial Serial1;
+
+#endif /* _HOST_ARDUINO_H_ */
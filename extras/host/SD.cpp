@@ -0,0 +1,247 @@
+#include <SD.h>
+
+SDClass SD;
+
+File::File(std::shared_ptr<HostNode> node, const char *name, uint8_t mode)
+  : node(node), path(name), mode(mode)
+{
+  const char *base = strrchr(name, '/');
+  base = (base) ? base + 1 : name;
+  strncpy(_name, base, sizeof(_name)-1);
+  if (mode == FILE_WRITE) pos = node->data.size();
+}
+
+size_t File::write(const uint8_t *buf, size_t size)
+{
+  if (!node || node->dir || mode != FILE_WRITE) return 0;
+  if (pos + size > node->data.size()) {
+    size = SD.extend(node.get(), pos + size) - pos;
+  }
+  SD.write_calls++;
+  dirty = true;
+  host_advance_us(SD.write_call_us + (uint64_t)size * SD.write_byte_ns / 1000);
+  if (SD.rmw_sector) {
+    uint32_t head = pos % SD.rmw_sector;
+    uint32_t tail = (pos + size) % SD.rmw_sector;
+    uint32_t first = pos / SD.rmw_sector;
+    uint32_t last = (pos + size - 1) / SD.rmw_sector;
+    if (head) host_advance_us(SD.rmw_us);
+    if (tail && (last != first || !head)) host_advance_us(SD.rmw_us);
+  }
+  if (pos + size > node->data.size()) node->data.resize(pos + size);
+  memcpy(&node->data[pos], buf, size);
+  pos += size;
+  return size;
+}
+
+int File::read()
+{
+  if (!node || pos >= node->data.size()) return -1;
+  return node->data[pos++];
+}
+
+int File::read(void *buf, uint16_t nbyte)
+{
+  if (!node) return -1;
+  size_t n = min((size_t)nbyte, node->data.size() - min((size_t)pos, node->data.size()));
+  host_advance_us(SD.read_call_us + (uint64_t)n * SD.read_byte_ns / 1000);
+  memcpy(buf, node->data.data() + pos, n);
+  pos += n;
+  return n;
+}
+
+int File::peek()
+{
+  if (!node || pos >= node->data.size()) return -1;
+  return node->data[pos];
+}
+
+int File::available()
+{
+  if (!node || pos >= node->data.size()) return 0;
+  return node->data.size() - pos;
+}
+
+bool File::seek(uint32_t newpos)
+{
+  if (!node) return false;
+  if (newpos > node->data.size()) {
+    if (!SD.seek_extends || mode != FILE_WRITE) return false;
+    newpos = SD.extend(node.get(), newpos);
+    dirty = true;
+  }
+  pos = newpos;
+  return true;
+}
+
+void File::flush()
+{
+  if (!node || mode != FILE_WRITE) return;
+  node->synced = node->data.size();
+  if (dirty) SD.dir_update();
+  dirty = false;
+}
+
+File File::openNextFile(uint8_t mode)
+{
+  if (!isDirectory()) return File();
+  host_advance_us(SD.dir_entry_ns / 1000);
+  std::string prefix = (path == "/" || path.empty()) ? "" : SDClass::normalize(path.c_str()) + "/";
+  size_t index = 0;
+  for (auto &it : SD.nodes) {
+    const std::string &p = it.first;
+    if (p.compare(0, prefix.size(), prefix) != 0 || p.size() == prefix.size()) continue;
+    if (p.find('/', prefix.size()) != std::string::npos) continue;
+    if (index++ == dir_index) {
+      dir_index++;
+      return File(it.second, p.c_str(), mode);
+    }
+  }
+  return File();
+}
+
+uint32_t SDClass::used()
+{
+  uint32_t total = 0;
+  for (auto &it : nodes) total += it.second->allocated;
+  return total;
+}
+
+void SDClass::power_cut()
+{
+  for (auto &n : nodes) {
+    if (!n.second->dir) n.second->data.resize(n.second->synced);
+  }
+}
+
+// Grow node to size bytes, or as far as capacity allows. Returns the new
+// size.
+uint32_t SDClass::extend(HostNode *node, uint32_t size)
+{
+  if (size > node->allocated) {
+    uint32_t want = (size + cluster - 1) / cluster * cluster;
+    if (capacity) {
+      uint32_t avail = capacity - min(capacity, used());
+      want = min(want, node->allocated + avail / cluster * cluster);
+      size = min(size, want);
+    }
+    if (want > node->allocated) {
+      extends++;
+      host_advance_us(extend_us);
+      node->allocated = want;
+    }
+  }
+  if (size > node->data.size()) node->data.resize(size);
+  return size;
+}
+
+void SDClass::lookup(const std::string &path)
+{
+  lookups++;
+  if (dir_entry_ns == 0) return;
+  size_t slash = path.rfind('/');
+  std::string prefix = (slash == std::string::npos) ? "" : path.substr(0, slash + 1);
+  uint64_t entries = 0;
+  for (auto &it : nodes) {
+    const std::string &p = it.first;
+    if (p.compare(0, prefix.size(), prefix) != 0 || p.find('/', prefix.size()) != std::string::npos) continue;
+    entries++;
+    if (p == path) break;
+  }
+  host_advance_us(entries * dir_entry_ns / 1000);
+}
+
+void SDClass::dir_update()
+{
+  dir_updates++;
+  host_advance_us(dir_update_us);
+}
+
+std::string SDClass::normalize(const char *filepath)
+{
+  std::string p(filepath);
+  while (!p.empty() && p[0] == '/') p.erase(0, 1);
+  while (!p.empty() && p[p.size()-1] == '/') p.erase(p.size()-1);
+  return p;
+}
+
+File SDClass::open(const char *filepath, uint8_t mode)
+{
+  std::string p = normalize(filepath);
+  if (p.empty()) {
+    auto root = std::make_shared<HostNode>();
+    root->dir = true;
+    return File(root, "/", mode);
+  }
+  lookup(p);
+  auto it = nodes.find(p);
+  if (it == nodes.end()) {
+    if (mode != FILE_WRITE) return File();
+    size_t slash = p.rfind('/');
+    if (slash != std::string::npos && !exists(p.substr(0, slash).c_str())) return File();
+    it = nodes.emplace(p, std::make_shared<HostNode>()).first;
+    dir_update();
+  }
+  return File(it->second, p.c_str(), mode);
+}
+
+bool SDClass::exists(const char *filepath)
+{
+  std::string p = normalize(filepath);
+  if (p.empty()) return true;
+  lookup(p);
+  return nodes.count(p) != 0;
+}
+
+bool SDClass::mkdir(const char *filepath)
+{
+  std::string p = normalize(filepath);
+  size_t slash = 0;
+  while (true) {
+    slash = p.find('/', slash + 1);
+    std::string sub = p.substr(0, slash);
+    auto &node = nodes[sub];
+    if (!node) {
+      node = std::make_shared<HostNode>();
+      node->dir = true;
+    }
+    if (slash == std::string::npos) break;
+  }
+  return true;
+}
+
+bool SDClass::remove(const char *filepath)
+{
+  std::string p = normalize(filepath);
+  lookup(p);
+  auto it = nodes.find(p);
+  if (it == nodes.end() || it->second->dir) return false;
+  nodes.erase(it);
+  dir_update();
+  return true;
+}
+
+bool SDClass::rename(const char *from, const char *to)
+{
+  std::string p = normalize(from);
+  lookup(p);
+  auto it = nodes.find(p);
+  if (it == nodes.end() || it->second->dir || exists(to)) return false;
+  nodes[normalize(to)] = it->second;
+  nodes.erase(it);
+  dir_update();
+  return true;
+}
+
+bool SDClass::rmdir(const char *filepath)
+{
+  std::string p = normalize(filepath);
+  auto it = nodes.find(p);
+  if (it == nodes.end() || !it->second->dir) return false;
+  std::string prefix = p + "/";
+  for (auto i = nodes.begin(); i != nodes.end(); ) {
+    if (i->first == p || i->first.compare(0, prefix.size(), prefix) == 0) i = nodes.erase(i);
+    else ++i;
+  }
+  return true;
+}
@@ -0,0 +1,118 @@
+/*
+ * In-memory stand-in for the Arduino SD library. Files live in a map keyed
+ * by path so the host benchmarks can check exactly what XYmodem wrote.
+ */
+
+#ifndef _HOST_SD_H_
+#define _HOST_SD_H_
+
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Renames like FatFs, see XYMODEM_FS_RENAME. Build with
+// -DXYMODEM_FS_RENAME=0 to run the copy the Arduino SD library needs.
+#if !defined(XYMODEM_FS_RENAME)
+#define XYMODEM_FS_RENAME 1
+#endif
+
+#define FILE_READ  0x01
+#define FILE_WRITE 0x13
+
+struct HostNode {
+  std::vector<uint8_t> data;
+  uint32_t allocated = 0;   // bytes covered by the cluster chain
+  uint32_t synced = 0;      // size in the directory entry
+  bool dir = false;
+};
+
+class File : public Stream {
+  public:
+    File() {}
+    File(std::shared_ptr<HostNode> node, const char *name, uint8_t mode);
+
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t size);
+    using Print::write;
+    int read();
+    int read(void *buf, uint16_t nbyte);
+    int peek();
+    int available();
+    void flush();
+    bool seek(uint32_t pos);
+    uint32_t position() { return pos; }
+    uint32_t size() { return node ? node->data.size() : 0; }
+    void close() { flush(); node.reset(); }
+    operator bool() { return (bool)node; }
+    char *name() { return _name; }
+
+    bool isDirectory() { return node && node->dir; }
+    File openNextFile(uint8_t mode = FILE_READ);
+    void rewindDirectory() { dir_index = 0; }
+
+  private:
+    std::shared_ptr<HostNode> node;
+    char _name[128+1] = "";
+    std::string path;
+    uint32_t pos = 0;
+    uint8_t mode = 0;
+    size_t dir_index = 0;
+    bool dirty = false;       // written since the last flush
+};
+
+class SDClass {
+  public:
+    bool begin(uint8_t csPin = 0) { (void)csPin; return true; }
+    File open(const char *filepath, uint8_t mode = FILE_READ);
+    File open(const std::string &filepath, uint8_t mode = FILE_READ) { return open(filepath.c_str(), mode); }
+    bool exists(const char *filepath);
+    bool mkdir(const char *filepath);
+    bool remove(const char *filepath);
+    bool rename(const char *from, const char *to);
+    bool rmdir(const char *filepath);
+
+    // Host only.
+    std::map<std::string, std::shared_ptr<HostNode> > nodes;
+    uint32_t write_calls = 0;
+    // Virtual time charged for every File::write(), to model slow flash.
+    uint32_t write_call_us = 0;
+    uint32_t write_byte_ns = 0;
+    // The same for every File::read(buf, n).
+    uint32_t read_call_us = 0;
+    uint32_t read_byte_ns = 0;
+    // Extra virtual time for each sector a write only partly covers, to
+    // model read-modify-write. 0 disables.
+    uint32_t rmw_sector = 0;
+    uint32_t rmw_us = 0;
+    // FatFs behaviour: seek past the end of a file open for writing
+    // extends it, up to capacity bytes in total (0 = unlimited).
+    bool seek_extends = false;
+    uint32_t capacity = 0;
+    // Virtual time for each write or seek that has to extend the cluster
+    // chain, in units of cluster bytes.
+    uint32_t cluster = 512;
+    uint32_t extend_us = 0;
+    uint32_t extends = 0;
+    // Directory cost, as FatFs has it: a lookup reads the entries of the
+    // directory up to the one it wants, all of them if it is not there,
+    // and creating, removing or renaming a file, or flushing one that was
+    // written, writes a directory entry and the FAT.
+    uint32_t dir_entry_ns = 0;
+    uint32_t dir_update_us = 0;
+    uint32_t lookups = 0;
+    uint32_t dir_updates = 0;
+    void lookup(const std::string &path);
+    void dir_update();
+    uint32_t used();
+    // Power loss: every file goes back to its size at the last flush or
+    // close, as FAT only updates the directory entry then.
+    void power_cut();
+    uint32_t extend(HostNode *node, uint32_t size);
+    static std::string normalize(const char *filepath);
+};
+
+extern SDClass SD;
+
+#endif /* _HOST_SD_H_ */
@@ -0,0 +1,117 @@
+/*
+ * Helpers shared by the host benchmark programs.
+ */
+#include <stdio.h>
+#include <chrono>
+#include <xymodem.h>
+#include "hostlink.h"
+#include "simsender.h"
+#include "benchutil.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+uint64_t bench_cycles(void) { return __rdtsc(); }
+#else
+uint64_t bench_cycles(void)
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+std::vector<uint8_t> bench_payload(size_t len, uint32_t seed)
+{
+  std::vector<uint8_t> data(len);
+  for (size_t i = 0; i < len; i++) {
+    seed = seed * 1103515245 + 12345;
+    data[i] = seed >> 16;
+  }
+  return data;
+}
+
+bool bench_check_file(const char *name, const std::vector<uint8_t> &data, bool padded)
+{
+  File f = SD.open(name);
+  if (!f) return false;
+  std::vector<uint8_t> &got = SD.nodes[SDClass::normalize(name)]->data;
+  if (got.size() < data.size() || memcmp(got.data(), data.data(), data.size()) != 0) return false;
+  if (!padded && got.size() != data.size()) return false;
+  for (size_t i = data.size(); i < got.size(); i++) {
+    if (got[i] != 0x1A) return false;
+  }
+  return true;
+}
+
+bool bench_run(XYmodem &rx, HostLink &link, SimPeer &tx, bench_result_t *res,
+    uint32_t budget_us, uint32_t max_bytes)
+{
+  uint64_t cycles = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::duration in_loop(0);
+  uint32_t idle = 0;
+  int state = 1;
+  uint32_t v0 = micros();
+  uint32_t longest = 0;
+
+  while (idle < 100000) {
+    bool sent = tx.poll();
+    if (tx.failed()) break;
+    auto l0 = std::chrono::steady_clock::now();
+    uint64_t c0 = bench_cycles();
+    uint32_t lv = micros();
+    state = rx.loop(budget_us, max_bytes);
+    longest = max(longest, (uint32_t)(micros() - lv));
+    cycles += bench_cycles() - c0;
+    in_loop += std::chrono::steady_clock::now() - l0;
+    if (state == 0 && tx.done()) break;
+    if (!sent && link.available() == 0) {
+      host_advance_us(link.wait_us());
+      idle = (link.idle()) ? idle + 1 : 0;
+    }
+    else {
+      idle = 0;
+    }
+  }
+  res->cycles = cycles;
+  res->seconds = std::chrono::duration<double>(in_loop).count();
+  res->wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  res->virt_us = micros() - v0;
+  res->link_us = link.busy_us;
+  res->loop_us_max = longest;
+  res->frames = tx.frames_sent;
+  res->retries = tx.retries;
+  return state == 0 && tx.done();
+}
+
+// Where the time went, from XYmodem::stats().
+void bench_print_stats(const xymodem_stats_t &s)
+{
+  printf("         ok=%u nak=%u dup=%u timeouts=%u block us=%u/%u/%u loop=%.3fs write=%.3fs hist",
+      (unsigned)s.blocks_ok, (unsigned)s.blocks_nak, (unsigned)s.blocks_dup,
+      (unsigned)s.timeouts, (unsigned)s.block_us_min,
+      (unsigned)(s.blocks_ok ? s.block_us_total / s.blocks_ok : 0),
+      (unsigned)s.block_us_max, s.loop_us / 1e6, s.write_us / 1e6);
+  for (int i = 0; i < XYMODEM_WRITE_BUCKETS; i++) printf(" %u", (unsigned)s.write_hist[i]);
+  printf(" srtt=%uus rto=%ums\n", (unsigned)s.srtt_us, (unsigned)s.rto_ms);
+}
+
+void bench_print_header(void)
+{
+  printf("%-8s %4s %-5s %9s %7s %10s %10s %9s %6s\n",
+      "mode", "blk", "check", "bytes", "frames", "MB/s", "cyc/byte", "link", "busy");
+}
+
+void bench_print(const char *mode, bool use1k, bool useCRC, size_t bytes,
+    const bench_result_t *res, const char *note)
+{
+  double mbs = (res->seconds > 0) ? bytes / res->seconds / 1e6 : 0;
+  double cpb = bytes ? (double)res->cycles / bytes : 0;
+  printf("%-8s %4s %-5s %9zu %7u %10.1f %10.2f",
+      mode, use1k ? "1K" : "128", useCRC ? "CRC" : "sum", bytes,
+      (unsigned)res->frames, mbs, cpb);
+  if (res->link_us) {
+    printf(" %8.3fs %5.1f%%", res->virt_us / 1e6, 100.0 * res->link_us / res->virt_us);
+  }
+  printf(" %s\n", note ? note : "");
+}
+
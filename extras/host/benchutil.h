@@ -0,0 +1,38 @@
+/*
+ * Helpers shared by the host benchmark programs.
+ */
+
+#ifndef _BENCHUTIL_H_
+#define _BENCHUTIL_H_
+
+#include <stdint.h>
+#include <vector>
+#include <SD.h>
+#include <xymodem.h>
+
+class XYmodem;
+class HostLink;
+class SimPeer;
+
+typedef struct {
+  uint64_t cycles;    // CPU cycles spent inside XYmodem::loop()
+  double seconds;     // wall time spent inside XYmodem::loop()
+  double wall;        // wall time for the whole run
+  uint32_t virt_us;   // virtual time for the whole run
+  uint64_t link_us;   // virtual time the link spent carrying bytes
+  uint32_t loop_us_max; // longest loop() call in virtual time
+  uint32_t frames;
+  uint32_t retries;
+} bench_result_t;
+
+uint64_t bench_cycles(void);
+std::vector<uint8_t> bench_payload(size_t len, uint32_t seed);
+bool bench_check_file(const char *name, const std::vector<uint8_t> &data, bool padded);
+bool bench_run(XYmodem &rx, HostLink &link, SimPeer &tx, bench_result_t *res,
+    uint32_t budget_us = 0, uint32_t max_bytes = 0);
+void bench_print_stats(const xymodem_stats_t &s);
+void bench_print_header(void);
+void bench_print(const char *mode, bool use1k, bool useCRC, size_t bytes,
+    const bench_result_t *res, const char *note);
+
+#endif /* _BENCHUTIL_H_ */
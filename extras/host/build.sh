@@ -0,0 +1,68 @@
+#!/bin/bash
+# Build the XYmodem library for the Linux host against the stand-ins in
+# this directory, check the CRC engines, run the benchmarks, decode a sample
+# trace with xytrace and replay a sample capture with xyreplay. xypack, the
+# packer for XYMODEM_UNPACK, and xylinkpty, the PC end of an XYlink, are
+# built alongside.
+#
+#   extras/host/build.sh            build and run all benchmarks
+#   extras/host/build.sh muxbench   build and run one benchmark
+#
+# CXXFLAGS may be overridden, e.g. CXXFLAGS="-O0 -g" extras/host/build.sh
+HOSTDIR="$(cd "$(dirname "$0")" && pwd)"
+LIBDIR="$(cd "${HOSTDIR}/../.." && pwd)"
+OUTDIR="${OUTDIR:-/tmp/xymodem_host_$$}"
+CXX="${CXX:-g++}"
+CXXFLAGS="${CXXFLAGS:--O2 -Wall}"
+mkdir -p "${OUTDIR}"
+
+LIBSRC="${LIBDIR}/*.cpp"
+HOSTSRC="${HOSTDIR}/Arduino.cpp ${HOSTDIR}/SD.cpp ${HOSTDIR}/hostlink.cpp ${HOSTDIR}/simsender.cpp ${HOSTDIR}/simzsender.cpp ${HOSTDIR}/simreceiver.cpp ${HOSTDIR}/benchutil.cpp ${HOSTDIR}/hostflash.cpp ${HOSTDIR}/xylzss.cpp ${HOSTDIR}/replaylink.cpp"
+BENCHES="${@:-xybench muxbench linkbench noisebench replaybench}"
+# The benchmarks, and xyreplay, are built with the options that are off
+# by default, and with the rename that SdFat based libraries have. xybench
+# is also run without it, as the Arduino SD library has none.
+BENCHFLAGS="-DXYMODEM_UNPACK=1 -DXYMODEM_STATS=1 -DXYMODEM_TRACE=64"
+
+# The CRC routines against the bit at a time versions, for every engine.
+for SLICE in 0 1 4
+do
+    ${CXX} ${CXXFLAGS} -std=gnu++11 -DXYMODEM_CRC_SLICE=${SLICE} -I"${HOSTDIR}" -I"${LIBDIR}" \
+        -o "${OUTDIR}/crccheck${SLICE}" "${HOSTDIR}/crccheck.cpp" "${LIBDIR}/xycrc.cpp" || exit 1
+    "${OUTDIR}/crccheck${SLICE}" || exit 1
+done
+
+${CXX} ${CXXFLAGS} -std=gnu++11 -I"${HOSTDIR}" -I"${LIBDIR}" \
+    -o "${OUTDIR}/xytrace" "${HOSTDIR}/xytrace.cpp" || exit 1
+${CXX} ${CXXFLAGS} -std=gnu++11 \
+    -o "${OUTDIR}/xypack" "${HOSTDIR}/xypack.cpp" "${HOSTDIR}/xylzss.cpp" || exit 1
+${CXX} ${CXXFLAGS} -std=gnu++11 -I"${HOSTDIR}" -I"${LIBDIR}" \
+    -o "${OUTDIR}/xylinkpty" "${HOSTDIR}/xylinkpty.cpp" "${LIBDIR}/xylink.cpp" \
+    "${LIBDIR}/xycrc.cpp" "${HOSTDIR}/Arduino.cpp" "${HOSTDIR}/SD.cpp" || exit 1
+${CXX} ${CXXFLAGS} ${BENCHFLAGS} -DXYMODEM_FS_RENAME=1 -std=gnu++11 -I"${HOSTDIR}" -I"${LIBDIR}" \
+    -o "${OUTDIR}/xyreplay" ${LIBSRC} ${HOSTSRC} "${HOSTDIR}/xyreplay.cpp" || exit 1
+
+for BENCH in ${BENCHES}
+do
+    ${CXX} ${CXXFLAGS} ${BENCHFLAGS} -DXYMODEM_FS_RENAME=1 -std=gnu++11 -I"${HOSTDIR}" -I"${LIBDIR}" \
+        -o "${OUTDIR}/${BENCH}" ${LIBSRC} ${HOSTSRC} "${HOSTDIR}/${BENCH}.cpp" || exit 1
+    "${OUTDIR}/${BENCH}" "${OUTDIR}/${BENCH}.trace" || exit 1
+    if [ "${BENCH}" = "xybench" ]
+    then
+        ${CXX} ${CXXFLAGS} ${BENCHFLAGS} -DXYMODEM_FS_RENAME=0 -std=gnu++11 -I"${HOSTDIR}" -I"${LIBDIR}" \
+            -o "${OUTDIR}/xybench_copy" ${LIBSRC} ${HOSTSRC} "${HOSTDIR}/xybench.cpp" || exit 1
+        "${OUTDIR}/xybench_copy" || exit 1
+    fi
+done
+
+# Decode the trace xybench leaves behind.
+if [ -f "${OUTDIR}/xybench.trace" ]
+then
+    "${OUTDIR}/xytrace" "${OUTDIR}/xybench.trace" || exit 1
+fi
+
+# Replay the capture replaybench leaves behind.
+if [ -f "${OUTDIR}/replaybench.trace" ]
+then
+    "${OUTDIR}/xyreplay" -f "${OUTDIR}/replaybench.trace" || exit 1
+fi
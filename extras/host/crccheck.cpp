@@ -0,0 +1,46 @@
+/*
+ * Check xycrc16() and xycrc32() against the bit at a time versions over
+ * random data, lengths and alignments, and in chained calls. build.sh
+ * builds it once for each XYMODEM_CRC_SLICE setting.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <xycrc.h>
+
+#define CHECK_RUNS 20000
+#define CHECK_MAX  1100
+
+int main(void)
+{
+  std::vector<uint8_t> data(CHECK_MAX + 8);
+  uint32_t seed = 1;
+  int failures = 0;
+
+  for (size_t i = 0; i < data.size(); i++) {
+    seed = seed * 1103515245 + 12345;
+    data[i] = seed >> 16;
+  }
+
+  for (int i = 0; i < CHECK_RUNS; i++) {
+    seed = seed * 1103515245 + 12345;
+    size_t at = (seed >> 8) % 8;
+    size_t len = (seed >> 12) % (CHECK_MAX + 1);
+    size_t cut = (len) ? (seed >> 3) % len : 0;
+    const uint8_t *p = data.data() + at;
+    uint16_t init16 = (i & 1) ? seed >> 16 : 0;
+    uint32_t init32 = (i & 2) ? seed : 0;
+
+    uint16_t want16 = xycrc16_bitwise(init16, p, len);
+    uint32_t want32 = xycrc32_bitwise(init32, p, len);
+    if (xycrc16(init16, p, len) != want16 ||
+        xycrc16(xycrc16(init16, p, cut), p + cut, len - cut) != want16 ||
+        xycrc32(init32, p, len) != want32 ||
+        xycrc32(xycrc32(init32, p, cut), p + cut, len - cut) != want32) {
+      if (failures++ < 10) printf("mismatch at offset %zu, %zu bytes\n", at, len);
+    }
+  }
+  printf("XYMODEM_CRC_SLICE=%d: %d runs, %d failures\n", XYMODEM_CRC_SLICE, CHECK_RUNS, failures);
+  return (failures) ? 1 : 0;
+}
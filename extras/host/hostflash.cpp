@@ -0,0 +1,34 @@
+#include "hostflash.h"
+
+void HostFlash::wait(void)
+{
+  if (!busy()) return;
+  uint32_t us = busy_until - micros();
+  wait_us += us;
+  host_advance_us(us);
+}
+
+void HostFlash::erase(uint32_t addr, uint32_t len)
+{
+  wait();
+  if (addr % len != 0 || addr + len > mem.size()) return;
+  memset(&mem[addr], 0xFF, len);
+  erases++;
+  busy_until = micros() + ((len == 65536) ? block_erase_us : sector_erase_us);
+}
+
+void HostFlash::program(uint32_t addr, const uint8_t *buf, uint16_t len)
+{
+  wait();
+  if (addr / 256 != (addr + len - 1) / 256 || addr + len > mem.size()) return;
+  for (uint16_t i = 0; i < len; i++) mem[addr + i] &= buf[i];
+  host_advance_us((uint64_t)(4 + len) * byte_ns / 1000);
+  busy_until = micros() + program_us;
+}
+
+void HostFlash::read(uint32_t addr, uint8_t *buf, uint32_t len)
+{
+  wait();
+  memcpy(buf, &mem[addr], len);
+  host_advance_us((uint64_t)len * byte_ns / 1000);
+}
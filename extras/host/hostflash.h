@@ -0,0 +1,38 @@
+/*
+ * NOR flash chip for XYflashSink on the host. Erase sets bytes to 0xFF
+ * and programming can only clear bits, as on the real chip, so writing a
+ * page that was not erased shows up as a bad image. Erases and page
+ * programs run in the background in virtual time, only the SPI transfer
+ * holds up the caller. Default timings are typical for a W25Q16:
+ * 45 ms per 4K sector, 150 ms per 64K block, 0.7 ms per page program and
+ * an 8 MHz SPI clock.
+ */
+
+#ifndef _HOSTFLASH_H_
+#define _HOSTFLASH_H_
+
+#include <vector>
+#include <xymodem.h>
+
+class HostFlash : public XYflashDevice {
+  public:
+    HostFlash(uint32_t size) : mem(size, 0xFF) {}
+    void erase(uint32_t addr, uint32_t len);
+    bool busy(void) { return (int32_t)(busy_until - micros()) > 0; }
+    void program(uint32_t addr, const uint8_t *buf, uint16_t len);
+    void read(uint32_t addr, uint8_t *buf, uint32_t len);
+
+    std::vector<uint8_t> mem;
+    uint32_t sector_erase_us = 45000;
+    uint32_t block_erase_us = 150000;
+    uint32_t program_us = 700;
+    uint32_t byte_ns = 1000;    // SPI transfer time per byte
+    uint32_t erases = 0;
+    uint32_t wait_us = 0;       // time callers spent waiting for the chip
+
+  private:
+    void wait(void);
+    uint32_t busy_until = 0;
+};
+
+#endif /* _HOSTFLASH_H_ */
@@ -0,0 +1,237 @@
+#include "hostlink.h"
+#include <math.h>
+#include <algorithm>
+
+size_t HostLink::readBytes(char *buffer, size_t length)
+{
+  deliver();
+  size_t n = min(length, rx.size() - rx_head);
+  memcpy(buffer, rx.data() + rx_head, n);
+  rx_head += n;
+  return n;
+}
+
+size_t HostLink::write(const uint8_t *buffer, size_t size)
+{
+  double byte_us = (baud) ? 10e6 / baud : 0;
+  double when = micros() + turnaround_us;
+  std::vector<uint8_t> noisy;
+  std::vector<uint32_t> hold;
+  size_t n = size;
+
+  written += size;
+  if (faulty) {
+    inject(up, up_faults, up_burst, buffer, size, noisy, hold);
+    buffer = noisy.data();
+    n = noisy.size();
+  }
+  for (size_t i = 0; i < n; i++) {
+    tx_wire_us = max(tx_wire_us, when) + byte_us;
+    if (faulty) tx_wire_us += hold[i];
+    tx.push_back(buffer[i]);
+    tx_time.push_back((uint32_t)tx_wire_us);
+  }
+  // A full transmit buffer blocks the writer, as Serial.write() does.
+  double backlog = tx_wire_us - when - rx_capacity * byte_us;
+  if (baud && backlog > 0) host_advance_us((uint32_t)backlog);
+  return size;
+}
+
+void HostLink::set_link(uint32_t baud, size_t rx_capacity)
+{
+  this->baud = baud;
+  this->rx_capacity = rx_capacity;
+}
+
+void HostLink::set_faults(const link_faults_t &down, const link_faults_t &up, uint32_t seed)
+{
+  this->down = down;
+  this->up = up;
+  rng = seed * 0x9E3779B97F4A7C15ULL + 1;
+  faulty = true;
+}
+
+// Uniform in [0, 1), xorshift64*.
+double HostLink::draw()
+{
+  rng ^= rng >> 12;
+  rng ^= rng << 25;
+  rng ^= rng >> 27;
+  return ((rng * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * Copy buffer to out as the line would deliver it. stall_us gets the time
+ * each byte is held back.
+ */
+void HostLink::inject(const link_faults_t &f, link_fault_count_t &n, uint16_t &burst,
+    const uint8_t *buffer, size_t size, std::vector<uint8_t> &out,
+    std::vector<uint32_t> &stall_us)
+{
+  // Chance of at least one of the 8 bits being hit.
+  double byte_error = (f.bit_error > 0) ? 1 - pow(1 - f.bit_error, 8) : 0;
+
+  for (size_t i = 0; i < size; i++) {
+    uint8_t c = buffer[i];
+    uint32_t hold = 0;
+    if (burst > 0) {
+      burst--;
+      c = draw() * 256;
+    }
+    else if (f.burst > 0 && draw() < f.burst) {
+      n.bursts++;
+      burst = (f.burst_len > 0) ? f.burst_len - 1 : 0;
+      c = draw() * 256;
+    }
+    if (f.drop > 0 && draw() < f.drop) {
+      n.dropped++;
+      continue;
+    }
+    if (byte_error > 0 && draw() < byte_error) {
+      n.flipped++;
+      c ^= 1 << (int)(draw() * 8);
+    }
+    if (f.stall > 0 && draw() < f.stall) {
+      n.stalls++;
+      hold = f.stall_us;
+    }
+    out.push_back(c);
+    stall_us.push_back(hold);
+    if (f.dup > 0 && draw() < f.dup) {
+      n.duped++;
+      out.push_back(c);
+      stall_us.push_back(0);
+    }
+  }
+}
+
+bool HostLink::lost(uint64_t offset)
+{
+  for (size_t i = 0; i < drops.size(); i++) {
+    if (offset >= drops[i].first && offset < drops[i].second) return true;
+  }
+  return false;
+}
+
+void HostLink::send(const uint8_t *buffer, size_t size)
+{
+  std::vector<uint8_t> kept;
+  if (!drops.empty()) {
+    for (size_t i = 0; i < size; i++) {
+      if (lost(sent + i)) dropped++;
+      else kept.push_back(buffer[i]);
+    }
+    buffer = kept.data();
+  }
+  sent += size;
+  if (!drops.empty()) size = kept.size();
+  std::vector<uint8_t> noisy;
+  std::vector<uint32_t> hold;
+  if (faulty) {
+    inject(down, down_faults, down_burst, buffer, size, noisy, hold);
+    buffer = noisy.data();
+    size = noisy.size();
+  }
+  if (baud == 0) {
+    // Bytes arrive instantly, so there is nothing to stall.
+    if (rx_head == rx.size()) {
+      rx.clear();
+      rx_head = 0;
+    }
+    rx.insert(rx.end(), buffer, buffer + size);
+    return;
+  }
+  if (wire_head == wire.size()) {
+    wire.clear();
+    wire_head = 0;
+    // Wire was idle, the first byte starts now.
+    wire_us = max(wire_us, (double)micros()) + 10e6 / baud;
+  }
+  for (size_t i = 0; i < hold.size(); i++) {
+    if (hold[i]) stalls.push_back(std::make_pair(wired + (wire.size() - wire_head) + i, hold[i]));
+  }
+  wire.insert(wire.end(), buffer, buffer + size);
+}
+
+void HostLink::deliver()
+{
+  if (baud == 0) return;
+
+  double byte_us = 10e6 / baud;
+  double now = micros();
+  if (rx_head == rx.size()) {
+    rx.clear();
+    rx_head = 0;
+  }
+  if (stall_head == stalls.size()) {
+    stalls.clear();
+    stall_head = 0;
+  }
+  while (wire_head < wire.size() && wire_us <= now) {
+    if (stall_head < stalls.size() && stalls[stall_head].first == wired) {
+      // The line goes quiet before this byte.
+      wire_us += stalls[stall_head++].second;
+      continue;
+    }
+    if (rx.size() - rx_head >= rx_capacity) {
+      // Receive buffer full, the sender is held off until there is room.
+      wire_us = now + byte_us;
+      break;
+    }
+    rx.push_back(wire[wire_head++]);
+    wired++;
+    busy_us += byte_us;
+    wire_us += byte_us;
+  }
+}
+
+uint32_t HostLink::wait_us()
+{
+  double wait = 1000;
+  if (wire_head < wire.size()) wait = min(wait, wire_us - micros());
+  if (tx_head < tx.size()) wait = min(wait, (double)(int32_t)(tx_time[tx_head] - micros()));
+  return (wait < 1) ? 1 : (uint32_t)wait;
+}
+
+int HostLink::reply()
+{
+  if (tx_head >= tx.size()) {
+    tx.clear();
+    tx_time.clear();
+    tx_head = 0;
+    return -1;
+  }
+  if ((int32_t)(tx_time[tx_head] - micros()) > 0) return -1;
+  return tx[tx_head++];
+}
+
+int HostLink::replies()
+{
+  // Arrival times only go up.
+  return std::upper_bound(tx_time.begin() + tx_head, tx_time.end(), micros()) -
+    (tx_time.begin() + tx_head);
+}
+
+void HostLink::reset()
+{
+  rx.clear();
+  rx_head = 0;
+  tx.clear();
+  tx_time.clear();
+  tx_head = 0;
+  tx_wire_us = 0;
+  written = 0;
+  wire.clear();
+  wire_head = 0;
+  wire_us = 0;
+  busy_us = 0;
+  flushes = 0;
+  drops.clear();
+  dropped = 0;
+  faulty = false;
+  down_burst = up_burst = 0;
+  down_faults = up_faults = link_fault_count_t();
+  wired = 0;
+  stalls.clear();
+  stall_head = 0;
+}
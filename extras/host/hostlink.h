@@ -0,0 +1,136 @@
+/*
+ * Serial link between a simulated sender and XYmodem. XYmodem sees a plain
+ * Stream: read() takes bytes queued by the sender, write() collects its
+ * replies for the sender to consume.
+ *
+ * By default bytes arrive instantly. set_link() models a real port: bytes
+ * cross the wire at baud/10 bytes per second of virtual time into a receive
+ * buffer of rx_capacity bytes. When that buffer is full the wire stalls, as
+ * USB CDC does when the device stops reading. What XYmodem writes crosses
+ * the wire at the same rate the other way, and write() blocks while more than
+ * rx_capacity bytes of it are still to go.
+ *
+ * set_faults() turns it into a noisy line: bit errors, lost and doubled
+ * bytes, bursts of noise and stalls, each at its own rate and separately
+ * for each direction. The faults come from a seeded generator, so a run
+ * with the same seed goes wrong in the same places.
+ */
+
+#ifndef _HOSTLINK_H_
+#define _HOSTLINK_H_
+
+#include <Arduino.h>
+#include <utility>
+#include <vector>
+
+// Faults for one direction of a HostLink. Rates are probabilities per
+// byte, except bit_error which is per bit. Zero turns a fault off.
+typedef struct {
+  double bit_error;     // flip one bit
+  double drop;          // lose the byte
+  double dup;           // deliver the byte twice
+  double burst;         // replace burst_len bytes with noise
+  uint16_t burst_len;
+  double stall;         // hold the byte back stall_us, needs set_link()
+  uint32_t stall_us;
+} link_faults_t;
+
+// What set_faults() did to one direction.
+typedef struct {
+  uint32_t flipped;
+  uint32_t dropped;
+  uint32_t duped;
+  uint32_t bursts;
+  uint32_t stalls;
+} link_fault_count_t;
+
+class HostLink : public Stream {
+  public:
+    // Receiver side
+    int available() { deliver(); return rx.size() - rx_head; }
+    int read() { deliver(); return (rx_head < rx.size()) ? rx[rx_head++] : -1; }
+    int peek() { deliver(); return (rx_head < rx.size()) ? rx[rx_head] : -1; }
+    size_t readBytes(char *buffer, size_t length);
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+    void flush() { flushes++; }
+
+    // Sender side
+    void set_link(uint32_t baud, size_t rx_capacity);
+    // Delay before a reply reaches the sender, e.g. USB polling plus host
+    // scheduling. Charged once per ACK/NAK round trip.
+    void set_turnaround(uint32_t us) { turnaround_us = us; }
+    void send(const uint8_t *buffer, size_t size);
+    // Lose n bytes of the sent stream starting at byte offset at, as a
+    // noisy line would.
+    void drop(uint64_t at, size_t n) { drops.push_back(std::make_pair(at, at + n)); }
+    // Faults on the bytes sent (down) and on the replies (up).
+    void set_faults(const link_faults_t &down, const link_faults_t &up, uint32_t seed);
+    int reply();
+    // Replies that have reached the sender.
+    int replies();
+    int peek_reply() { return (replies() > 0) ? tx[tx_head] : -1; }
+    // Bytes sent but not yet read by the receiver.
+    size_t in_flight() { return (wire.size() - wire_head) + (rx.size() - rx_head); }
+    bool idle() { return wire_head >= wire.size() && rx_head >= rx.size() && tx_head >= tx.size(); }
+    // Virtual microseconds until the next byte can arrive.
+    uint32_t wait_us();
+    void reset();
+
+    uint32_t flushes = 0;
+    uint64_t sent = 0;        // bytes handed to send()
+    uint64_t dropped = 0;     // bytes lost by drop()
+    uint64_t busy_us = 0;     // virtual time the wire spent moving bytes
+    uint64_t written = 0;     // bytes XYmodem wrote
+    link_fault_count_t down_faults = {}, up_faults = {};
+
+  private:
+    void deliver();
+    bool lost(uint64_t offset);
+    double draw();
+    void inject(const link_faults_t &f, link_fault_count_t &n, uint16_t &burst,
+        const uint8_t *buffer, size_t size, std::vector<uint8_t> &out,
+        std::vector<uint32_t> &stall_us);
+
+    std::vector<uint8_t> rx;
+    size_t rx_head = 0;
+    std::vector<uint8_t> tx;
+    std::vector<uint32_t> tx_time;
+    size_t tx_head = 0;
+    double tx_wire_us = 0;    // virtual time the last written byte arrives
+    uint32_t turnaround_us = 0;
+
+    uint32_t baud = 0;
+    size_t rx_capacity = 0;
+    std::vector<uint8_t> wire;
+    size_t wire_head = 0;
+    double wire_us = 0;       // virtual time the next byte finishes arriving
+    std::vector<std::pair<uint64_t, uint64_t> > drops;
+
+    bool faulty = false;
+    link_faults_t down = {}, up = {};
+    uint64_t rng = 0;
+    uint16_t down_burst = 0, up_burst = 0;   // noise bytes still to come
+    uint64_t wired = 0;       // bytes moved off the wire so far
+    std::vector<std::pair<uint64_t, uint32_t> > stalls;
+    size_t stall_head = 0;
+};
+
+// The sender's end of a HostLink as a Stream, for a peer that runs
+// library code of its own, such as the PC end of an XYlink.
+class HostLinkEnd : public Stream {
+  public:
+    HostLinkEnd(HostLink *link) : link(link) {}
+    int available() { return link->replies(); }
+    int read() { return link->reply(); }
+    int peek() { return link->peek_reply(); }
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) { link->send(buffer, size); return size; }
+    using Print::write;
+
+  private:
+    HostLink *link;
+};
+
+#endif /* _HOSTLINK_H_ */
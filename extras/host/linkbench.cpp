@@ -0,0 +1,207 @@
+/*
+ * Transfers and a console sharing one port through XYlink. YMODEM waits
+ * for an ACK after every block, so one transfer leaves the line idle for a
+ * round trip per block. With several on their own channels one sends while
+ * the others wait, and the line stays busy. A console on channel 0 is
+ * pinged throughout to show it keeps answering.
+ *
+ * The PC end is a second XYlink on the sender's side of the same HostLink.
+ * Each scripted sender talks to it through a HostLink of its own with no
+ * delay, so only the shared port has a baud rate and a turnaround.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <xymodem.h>
+#include "hostlink.h"
+#include "simsender.h"
+#include "benchutil.h"
+
+#define LINK_BAUD       1000000
+#define LINK_TURNAROUND 1000
+#define LINK_LEN        131072
+#define LINK_DEADLINE   60000000UL
+// Time between console pings
+#define LINK_PING_US    20000
+
+typedef struct {
+  double goodput;         // file bytes per second, all transfers
+  double busy;            // share of the time the line was carrying bytes
+  uint32_t first_us;      // first and last transfer to finish
+  uint32_t last_us;
+  uint32_t pings;
+  uint32_t ping_us_max;
+} link_result_t;
+
+// One transfer straight on the port, for comparison.
+static bool link_direct(link_result_t *r)
+{
+  HostLink link;
+  XYmodem rx;
+  bench_result_t res;
+  std::vector<uint8_t> data = bench_payload(LINK_LEN, 1);
+
+  SD.nodes.clear();
+  link.set_link(LINK_BAUD, 256);
+  link.set_turnaround(LINK_TURNAROUND);
+  SimSender tx(&link, true, true, true);
+  tx.add_file("chan1.bin", data);
+  rx.start_rb(&link, &SD, true, true);
+  bool ok = bench_run(rx, link, tx, &res) && bench_check_file("chan1.bin", data, false);
+  memset(r, 0, sizeof(*r));
+  r->goodput = LINK_LEN / (res.virt_us / 1e6);
+  r->busy = (double)res.link_us / res.virt_us;
+  r->first_us = r->last_us = res.virt_us;
+  return ok;
+}
+
+/*
+ * Move what fits between the senders' links and the PC end's channels.
+ * Channel 0 is the console, transfer i is on channel i + 1.
+ */
+static void link_pump(XYlink &pc, HostLink *side, int transfers)
+{
+  uint8_t buf[256];
+
+  for (int i = 0; i < transfers; i++) {
+    XYchannel *c = pc.channel(i + 1);
+    int n = min(min(side[i].available(), c->availableForWrite()), (int)sizeof(buf));
+    if (n > 0) {
+      side[i].readBytes((char *)buf, n);
+      c->write(buf, n);
+    }
+    while ((n = c->readBytes((char *)buf, sizeof(buf))) > 0) side[i].write(buf, n);
+  }
+}
+
+static bool link_shared(int transfers, link_result_t *r)
+{
+  HostLink port;
+  HostLinkEnd far(&port);
+  HostLink side[XYMODEM_LINK_CHANNELS];
+  XYlink dev, pc;
+  XYmodem rx[XYMODEM_LINK_CHANNELS];
+  SimSender *tx[XYMODEM_LINK_CHANNELS];
+  std::vector<uint8_t> data[XYMODEM_LINK_CHANNELS];
+  char journal[XYMODEM_LINK_CHANNELS][16];
+  uint32_t done_us[XYMODEM_LINK_CHANNELS] = {0};
+  char line[32];
+  size_t line_len = 0;
+  uint32_t ping_at = 0, ping_sent = 0;
+  bool ping_out = false;
+  bool ok = true;
+
+  SD.nodes.clear();
+  memset(r, 0, sizeof(*r));
+  port.set_link(LINK_BAUD, 256);
+  port.set_turnaround(LINK_TURNAROUND);
+  uint32_t v0 = micros();
+  dev.begin(&port);
+  pc.begin(&far);
+  for (int i = 0; i < transfers; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "chan%d.bin", i + 1);
+    snprintf(journal[i], sizeof(journal[i]), "/XYRESUM%d.JNL", i + 1);
+    data[i] = bench_payload(LINK_LEN, i + 1);
+    tx[i] = new SimSender(&side[i], true, true, true);
+    tx[i]->add_file(name, data[i]);
+    rx[i].set_journal(journal[i]);
+    rx[i].start_rb(dev.channel(i + 1), &SD, true, true);
+  }
+  XYchannel *con = dev.channel(0);
+  XYchannel *term = pc.channel(0);
+
+  int running = transfers;
+  while (running > 0 && (uint32_t)(micros() - v0) < LINK_DEADLINE) {
+    bool sent = false;
+    // PC end: replies to the senders, their answers back out.
+    pc.poll();
+    link_pump(pc, side, transfers);
+    for (int i = 0; i < transfers; i++) {
+      if (done_us[i] == 0) sent |= tx[i]->poll();
+      if (tx[i]->failed()) ok = false;
+    }
+    if ((int32_t)(micros() - v0 - ping_at) >= 0 && !ping_out) {
+      snprintf(line, sizeof(line), "ping %u\r", (unsigned)r->pings);
+      term->write((const uint8_t *)line, strlen(line));
+      ping_sent = micros();
+      ping_out = true;
+      line_len = 0;
+    }
+    while (term->available() > 0) {
+      int c = term->read();
+      if (c == '\r' && ping_out) {
+        r->ping_us_max = max(r->ping_us_max, micros() - ping_sent);
+        r->pings++;
+        ping_out = false;
+        ping_at = micros() - v0 + LINK_PING_US;
+      }
+      line_len++;
+    }
+    link_pump(pc, side, transfers);
+    pc.poll();
+
+    // Device end: the console echoes what it gets.
+    dev.poll();
+    while (con->available() > 0) con->write(con->read());
+    for (int i = 0; i < transfers; i++) {
+      if (done_us[i] != 0) continue;
+      if (rx[i].loop() == 0 && tx[i]->done()) {
+        done_us[i] = micros() - v0;
+        running--;
+      }
+    }
+    dev.poll();
+
+    if (!ok) break;
+    if (!sent && port.available() == 0 && port.replies() == 0) {
+      host_advance_us(port.wait_us());
+    }
+  }
+  for (int i = 0; i < transfers; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "chan%d.bin", i + 1);
+    ok = ok && done_us[i] != 0 && bench_check_file(name, data[i], false);
+    r->first_us = (i == 0) ? done_us[i] : min(r->first_us, done_us[i]);
+    r->last_us = max(r->last_us, done_us[i]);
+    delete tx[i];
+  }
+  uint32_t virt_us = micros() - v0;
+  r->goodput = (double)LINK_LEN * transfers / (virt_us / 1e6);
+  r->busy = (double)port.busy_us / virt_us;
+  ok = ok && r->pings > 0 && dev.bad_frames == 0 && pc.bad_frames == 0;
+  return ok;
+}
+
+static void link_print(const char *name, int transfers, bool ok, const link_result_t &r)
+{
+  printf("%-8s %9d %10.0f %5.1f%% %7.3fs %7.3fs", name, transfers, r.goodput,
+      100.0 * r.busy, r.first_us / 1e6, r.last_us / 1e6);
+  if (r.pings > 0) printf(" %6u %8.1f", (unsigned)r.pings, r.ping_us_max / 1000.0);
+  printf("%s\n", ok ? "" : " FAIL");
+}
+
+int main(void)
+{
+  link_result_t r, direct;
+  int failures = 0;
+
+  printf("YMODEM 1K over one %u bit/s port with %u us turnaround, %u bytes per transfer\n",
+      (unsigned)LINK_BAUD, (unsigned)LINK_TURNAROUND, (unsigned)LINK_LEN);
+  printf("%-8s %9s %10s %6s %8s %8s %6s %8s\n", "port", "transfers", "bytes/s", "busy",
+      "first", "last", "pings", "ping ms");
+  bool ok = link_direct(&direct);
+  if (!ok) failures++;
+  link_print("direct", 1, ok, direct);
+  for (int n = 1; n < XYMODEM_LINK_CHANNELS; n++) {
+    ok = link_shared(n, &r);
+    // More transfers must use the line better than one on its own, and
+    // the console must keep answering within a couple of ping periods.
+    if (n > 1 && r.goodput <= direct.goodput) ok = false;
+    if (r.ping_us_max > 2 * LINK_PING_US) ok = false;
+    if (!ok) failures++;
+    link_print("xylink", n, ok, r);
+  }
+  printf("%d failures\n", failures);
+  return (failures) ? 1 : 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Aggregate throughput of several receivers run by one XYmodemMux, one per
+ * simulated UART, all writing to the same simulated SPI flash. Time spent
+ * writing for one port is time the others cannot be serviced, so the
+ * aggregate stops scaling once the file system is the bottleneck.
+ */
+
+#include <stdio.h>
+#include <chrono>
+#include <xymodem.h>
+#include "hostlink.h"
+#include "simsender.h"
+#include "simzsender.h"
+#include "benchutil.h"
+
+static bool bench_mux(int ports, uint32_t baud, bool zmodem, size_t len)
+{
+  HostLink link[XYMODEM_MUX_MAX];
+  XYmodem rx[XYMODEM_MUX_MAX];
+  SimPeer *tx[XYMODEM_MUX_MAX];
+  XYmodemMux mux;
+  char journal[XYMODEM_MUX_MAX][16];
+  std::vector<uint8_t> data[XYMODEM_MUX_MAX];
+  uint64_t cycles = 0;
+  uint32_t idle = 0;
+  bool ok = true;
+
+  SD.nodes.clear();
+  for (int i = 0; i < ports; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "port%d.bin", i);
+    snprintf(journal[i], sizeof(journal[i]), "/XYRESUM%d.JNL", i);
+    data[i] = bench_payload(len, i);
+    link[i].set_link(baud, 256);
+    link[i].set_turnaround(1000);
+    rx[i].set_journal(journal[i]);
+    if (zmodem) {
+      SimZSender *z = new SimZSender(&link[i]);
+      z->add_file(name, data[i]);
+      tx[i] = z;
+      rx[i].start_rz(&link[i], &SD);
+    }
+    else {
+      SimSender *y = new SimSender(&link[i], true, true, true);
+      y->add_file(name, data[i]);
+      tx[i] = y;
+      rx[i].start_rb(&link[i], &SD, true, true);
+    }
+    mux.add(&rx[i]);
+  }
+
+  uint32_t v0 = micros();
+  while (idle < 100000) {
+    bool sent = false, done = true, quiet = true, all_idle = true;
+    for (int i = 0; i < ports; i++) {
+      sent |= tx[i]->poll();
+      if (tx[i]->failed()) ok = false;
+      done &= tx[i]->done();
+    }
+    if (!ok) break;
+    uint64_t c0 = bench_cycles();
+    int busy = mux.loop();
+    cycles += bench_cycles() - c0;
+    if (busy == 0 && done) break;
+    for (int i = 0; i < ports; i++) {
+      // A finished receiver leaves the end of the sender's "OO" unread.
+      quiet &= (link[i].available() == 0 || rx[i].idle());
+      all_idle &= link[i].idle();
+    }
+    if (!sent && quiet) {
+      uint32_t wait = 0xFFFFFFFF;
+      for (int i = 0; i < ports; i++) wait = min(wait, link[i].wait_us());
+      host_advance_us(wait);
+      idle = (all_idle) ? idle + 1 : 0;
+    }
+    else {
+      idle = 0;
+    }
+  }
+  uint32_t virt_us = micros() - v0;
+
+  uint64_t link_us = 0;
+  for (int i = 0; i < ports; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "port%d.bin", i);
+    ok = ok && tx[i]->done() && bench_check_file(name, data[i], false);
+    link_us += link[i].busy_us;
+    delete tx[i];
+  }
+  size_t bytes = len * ports;
+  printf("%5d %-7s %8u %9zu %8.3fs %9.1f %6.1f%% %9.2f %s\n",
+      ports, (zmodem) ? "zmodem" : "ymodem", (unsigned)baud, bytes, virt_us / 1e6,
+      bytes / (virt_us / 1e6) / 1024, 100.0 * link_us / ports / virt_us,
+      (double)cycles / bytes, ok ? "" : "FAIL");
+  return ok;
+}
+
+int main(void)
+{
+  static const uint32_t bauds[] = {115200, 1000000};
+  int failures = 0;
+
+  // SPI flash FatFs model as in xybench.
+  SD.write_call_us = 500;
+  SD.write_byte_ns = 2700;
+  SD.rmw_sector = 4096;
+  SD.rmw_us = 2000;
+  SD.seek_extends = true;
+  SD.extend_us = 1000;
+
+  printf("XYMODEM_MUX_MAX=%d, one 128 KB file per port, simulated SPI flash\n",
+      XYMODEM_MUX_MAX);
+  printf("%5s %-7s %8s %9s %9s %9s %7s %9s\n",
+      "ports", "mode", "baud", "bytes", "time", "KB/s", "busy", "cyc/byte");
+  for (size_t b = 0; b < sizeof(bauds)/sizeof(bauds[0]); b++) {
+    for (int zmodem = 0; zmodem < 2; zmodem++) {
+      for (int ports = 1; ports <= XYMODEM_MUX_MAX; ports++) {
+        if (!bench_mux(ports, bauds[b], zmodem, 131072)) failures++;
+      }
+    }
+  }
+  printf("%d failures\n", failures);
+  return (failures) ? 1 : 0;
+}
@@ -0,0 +1,236 @@
+/*
+ * Goodput and recovery time over a noisy line. Each protocol mode receives
+ * one file through a HostLink that flips bits, loses, doubles and garbles
+ * bytes and stalls, in both directions, at rates swept from clean to bad.
+ *
+ * A run either ends with the whole file received or is given up by one
+ * side. Both are fine on a bad enough line. Not fine is any byte in the
+ * file under its own name that is not the sender's, finished or not, or a
+ * clean line not getting the file across. The YMODEM senders give the
+ * CRC-32 of the file, as XYMODEM_DIGEST checks it. XMODEM with the 8-bit
+ * checksum has nothing else to go on, and two bit errors in one block can
+ * cancel out. A file spoilt that way is the protocol's fault, but is only
+ * let off in the runs listed in expected_missed, so a new one is noticed.
+ * Bad data in the file with a CRC is always a failure.
+ *
+ * Goodput is file bytes per second of virtual time. Recovery is the time
+ * lost against the clean run divided by the faults injected, so roughly
+ * what each fault costs the mode.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <xymodem.h>
+#include "hostlink.h"
+#include "simsender.h"
+#include "simzsender.h"
+#include "benchutil.h"
+
+#define NOISE_BAUD      115200
+#define NOISE_LEN       32768
+// A run still going after this much virtual time counts as stuck.
+#define NOISE_DEADLINE  600000000UL
+
+typedef struct {
+  const char *name;
+  char kind;          // 'x', 'y', 'g' or 'z'
+  bool use1k, useCRC;
+} noise_mode_t;
+
+static const noise_mode_t modes[] = {
+  {"x128s", 'x', false, false},
+  {"x128c", 'x', false, true},
+  {"x1ks",  'x', true,  false},
+  {"x1kc",  'x', true,  true},
+  {"y128s", 'y', false, false},
+  {"y128c", 'y', false, true},
+  {"y1ks",  'y', true,  false},
+  {"y1kc",  'y', true,  true},
+  {"ymg",   'g', true,  true},
+  {"zmodem", 'z', true, true},
+};
+#define NOISE_MODES (sizeof(modes)/sizeof(modes[0]))
+
+typedef struct {
+  const char *name;
+  link_faults_t faults;   // applied to both directions
+} noise_profile_t;
+
+//                                 bit_error drop  dup   burst len  stall us
+static const noise_profile_t profiles[] = {
+  {"clean",          {0,    0,    0,    0,    0,  0,    0}},
+  {"ber 1e-6",       {1e-6, 0,    0,    0,    0,  0,    0}},
+  {"ber 1e-5",       {1e-5, 0,    0,    0,    0,  0,    0}},
+  {"ber 3e-5",       {3e-5, 0,    0,    0,    0,  0,    0}},
+  {"ber 1e-4",       {1e-4, 0,    0,    0,    0,  0,    0}},
+  {"drop 1e-5",      {0,    1e-5, 0,    0,    0,  0,    0}},
+  {"drop 1e-4",      {0,    1e-4, 0,    0,    0,  0,    0}},
+  {"dup 1e-4",       {0,    0,    1e-4, 0,    0,  0,    0}},
+  {"burst 1e-5 x32", {0,    0,    0,    1e-5, 32, 0,    0}},
+  {"stall 1e-4 20ms", {0,   0,    0,    0,    0,  1e-4, 20000}},
+  {"mixed",          {1e-5, 1e-5, 1e-5, 2e-6, 16, 1e-5, 20000}},
+};
+#define NOISE_PROFILES (sizeof(profiles)/sizeof(profiles[0]))
+
+// Runs whose bad data the 8-bit checksum lets through, with these seeds.
+static const struct {
+  const char *profile;
+  const char *mode;
+} expected_missed[] = {
+  {"ber 1e-4", "x1ks"},
+};
+
+enum noise_outcome_t { NOISE_OK, NOISE_GAVE_UP, NOISE_STUCK, NOISE_CORRUPT };
+
+typedef struct {
+  noise_outcome_t outcome;
+  uint32_t virt_us;
+  uint32_t faults;
+} noise_result_t;
+
+/*
+ * True if only the 8-bit checksum guards the data. YMODEM is also covered
+ * by the CRC-32 of the file, if it is checked before the file gets its name.
+ */
+static bool checksum_only(const noise_mode_t &m)
+{
+  return !m.useCRC && (m.kind == 'x' || !XYMODEM_DIGEST || !XYMODEM_ATOMIC);
+}
+
+/*
+ * Bad data in the file is expected of this run.
+ */
+static bool missed_expected(const noise_profile_t &p, const noise_mode_t &m)
+{
+  if (!checksum_only(m)) return false;
+  for (size_t i = 0; i < sizeof(expected_missed)/sizeof(expected_missed[0]); i++) {
+    if (strcmp(expected_missed[i].profile, p.name) == 0 &&
+        strcmp(expected_missed[i].mode, m.name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static uint32_t fault_total(const link_fault_count_t &n)
+{
+  return n.flipped + n.dropped + n.duped + n.bursts + n.stalls;
+}
+
+/*
+ * The file must hold nothing but the start of data, plus SUB padding for
+ * XMODEM. With XYMODEM_ATOMIC a file not finished or not matching its
+ * CRC-32 stays under a temporary name, so only the real one counts.
+ */
+static bool noise_clean_file(const std::vector<uint8_t> &data, bool *complete)
+{
+  *complete = false;
+  auto it = SD.nodes.find(SDClass::normalize("noise.bin"));
+  if (it == SD.nodes.end()) return true;
+  const std::vector<uint8_t> &got = it->second->data;
+  size_t n = min(got.size(), data.size());
+  if (memcmp(got.data(), data.data(), n) != 0) return false;
+  for (size_t i = n; i < got.size(); i++) {
+    if (got[i] != 0x1A) return false;
+  }
+  *complete = (got.size() >= data.size());
+  return true;
+}
+
+static void noise_run(const noise_mode_t &m, const noise_profile_t &p, uint32_t seed,
+    const std::vector<uint8_t> &data, noise_result_t *res)
+{
+  HostLink link;
+  XYmodem rx;
+  SimPeer *tx;
+
+  SD.nodes.clear();
+  link.set_link(NOISE_BAUD, 256);
+  link.set_turnaround(1000);
+  if (m.kind == 'z') {
+    SimZSender *z = new SimZSender(&link);
+    z->add_file("noise.bin", data);
+    tx = z;
+  }
+  else {
+    SimSender *y = new SimSender(&link, m.kind != 'x', m.use1k, m.useCRC);
+    y->add_file("noise.bin", data);
+    y->send_crc = true;
+    tx = y;
+  }
+  link.set_faults(p.faults, p.faults, seed);
+  switch (m.kind) {
+    case 'x': rx.start_rx(&link, "noise.bin", m.use1k, m.useCRC); break;
+    case 'y': rx.start_rb(&link, &SD, m.use1k, m.useCRC); break;
+    case 'g': rx.start_rg(&link, &SD); break;
+    case 'z': rx.start_rz(&link, &SD); break;
+  }
+
+  uint32_t v0 = micros();
+  bool stuck = true;
+  while ((uint32_t)(micros() - v0) < NOISE_DEADLINE) {
+    bool sent = tx->poll();
+    if (rx.loop() == 0) {
+      stuck = false;
+      break;
+    }
+    if (!sent && link.available() == 0) host_advance_us(link.wait_us());
+  }
+  res->virt_us = micros() - v0;
+  res->faults = fault_total(link.down_faults) + fault_total(link.up_faults);
+
+  bool complete;
+  if (!noise_clean_file(data, &complete)) res->outcome = NOISE_CORRUPT;
+  else if (complete) res->outcome = NOISE_OK;
+  else if (stuck) res->outcome = NOISE_STUCK;
+  else res->outcome = NOISE_GAVE_UP;
+  delete tx;
+}
+
+int main(void)
+{
+  static noise_result_t results[NOISE_PROFILES][NOISE_MODES];
+  std::vector<uint8_t> data = bench_payload(NOISE_LEN, 20);
+  int failures = 0;
+
+  for (size_t p = 0; p < NOISE_PROFILES; p++) {
+    for (size_t m = 0; m < NOISE_MODES; m++) {
+      noise_run(modes[m], profiles[p], 1 + p * NOISE_MODES + m, data, &results[p][m]);
+      noise_outcome_t o = results[p][m].outcome;
+      if ((o == NOISE_CORRUPT && !missed_expected(profiles[p], modes[m])) ||
+          o == NOISE_STUCK || (p == 0 && o != NOISE_OK)) {
+        failures++;
+      }
+    }
+  }
+
+  printf("Noisy line, %u baud, one %u byte file, faults in both directions\n",
+      (unsigned)NOISE_BAUD, (unsigned)NOISE_LEN);
+  printf("x/y = XMODEM/YMODEM, 128/1k block, s/c = checksum/CRC, ymg = YMODEM-G\n");
+  printf("'-' gave up, STUCK still going after %lus, CORRUPT bad data in the file,\n"
+      "MISSED bad data the checksum could not catch, as expected\n", NOISE_DEADLINE / 1000000);
+  for (int table = 0; table < 2; table++) {
+    printf("\n%s\n%-16s", (table == 0) ? "Goodput, bytes/s" : "Recovery, ms per fault",
+        "profile");
+    for (size_t m = 0; m < NOISE_MODES; m++) printf(" %7s", modes[m].name);
+    printf("\n");
+    for (size_t p = 0; p < NOISE_PROFILES; p++) {
+      printf("%-16s", profiles[p].name);
+      for (size_t m = 0; m < NOISE_MODES; m++) {
+        const noise_result_t &r = results[p][m];
+        const noise_result_t &clean = results[0][m];
+        if (r.outcome == NOISE_CORRUPT) {
+          printf(" %7s", missed_expected(profiles[p], modes[m]) ? "MISSED" : "CORRUPT");
+        }
+        else if (r.outcome == NOISE_STUCK) printf(" %7s", "STUCK");
+        else if (r.outcome != NOISE_OK) printf(" %7s", "-");
+        else if (table == 0) printf(" %7.0f", NOISE_LEN / (r.virt_us / 1e6));
+        else if (r.faults == 0) printf(" %7s", "");
+        else printf(" %7.1f", ((double)r.virt_us - clean.virt_us) / 1000 / r.faults);
+      }
+      printf("\n");
+    }
+  }
+  printf("\n%d failures\n", failures);
+  return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,196 @@
+/*
+ * Record a session with XYcapture and play it back with ReplayLink. Each
+ * transfer runs over a HostLink with some noise and the SPI flash write
+ * costs, recorded in RAM or to a file on the host file system. The
+ * capture is then replayed twice as fast as possible into an empty file
+ * system with the same costs. Both replays must write the file again and
+ * answer with the bytes the receiver sent at the same times to the
+ * microsecond, also where the capture went to a file and its own writes
+ * held the session up.
+ *
+ * A capture cut short by a full buffer must replay up to where it stops
+ * and then end, and a replay at recorded speed must take as long in wall
+ * time as the session did.
+ *
+ *   replaybench [capture]      also write the first capture to a file
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <xymodem.h>
+#include "hostlink.h"
+#include "simsender.h"
+#include "simzsender.h"
+#include "benchutil.h"
+#include "replaylink.h"
+
+#define REPLAY_BAUD 115200
+#define REPLAY_CAPTURE "/XYCAP.XYC"
+// A session still going after this much virtual time counts as stuck.
+#define REPLAY_DEADLINE 60000000UL
+
+typedef struct {
+  const char *name;
+  char kind;              // 'y' or 'z'
+  size_t len;             // file bytes
+  uint32_t baud;          // 0: bytes arrive as sent, as whole USB packets do
+  size_t buf;             // capture buffer bytes
+  bool to_file;           // buf only stages the capture for a file
+  bool realtime;          // replay at recorded speed
+} replay_case_t;
+
+static const replay_case_t cases[] = {
+  {"y1k",      'y', 65536, REPLAY_BAUD, 262144, false, false},
+  {"y1k usb",  'y', 65536, 0,           262144, false, false},
+  {"zmodem",   'z', 65536, REPLAY_BAUD, 393216, false, false},
+  {"y1k file", 'y', 65536, REPLAY_BAUD, 512,    true,  false},
+  {"y1k cut",  'y', 65536, REPLAY_BAUD, 16384,  false, false},
+  {"y1k real", 'y', 16384, 1000000,     65536,  false, true},
+};
+
+static void replay_costs(void)
+{
+  SD.write_call_us = 500;
+  SD.write_byte_ns = 2700;
+}
+
+/*
+ * bench_run() for a session to replay. loop() is called the way a sketch
+ * calls it and replay_run() does: again at once after a call that did
+ * anything, otherwise after waiting for the next byte or millisecond.
+ */
+static bool replay_record(XYmodem &rx, HostLink &link, XYcapture &cap, SimPeer &tx,
+    bench_result_t *res)
+{
+  uint32_t v0 = micros();
+  int state = 1;
+
+  memset(res, 0, sizeof(*res));
+  while ((uint32_t)(micros() - v0) < REPLAY_DEADLINE) {
+    bool sent = tx.poll();
+    if (tx.failed()) break;
+    uint32_t lv = micros();
+    uint32_t moved = cap.bytes_in + cap.bytes_out;
+    uint32_t committed = rx.stats().bytes_committed;
+    state = rx.loop();
+    if (state == 0 && tx.done()) break;
+    if (!sent && link.available() == 0 && micros() == lv &&
+        cap.bytes_in + cap.bytes_out == moved && rx.stats().bytes_committed == committed) {
+      host_advance_us(replay_idle_us(link.wait_us()));
+    }
+  }
+  res->virt_us = micros() - v0;
+  return state == 0 && tx.done();
+}
+
+static bool replay_case(const replay_case_t &c, const char *save)
+{
+  HostLink link;
+  XYcapture cap;
+  XYmodem rx;
+  SimPeer *tx;
+  bench_result_t res, play[2];
+  std::vector<uint8_t> data = bench_payload(c.len, 7);
+  std::vector<uint8_t> buf(c.buf);
+  std::vector<uint8_t> capture;
+  link_faults_t noise = {1e-5, 1e-5, 0, 0, 0, 0, 0};
+
+  SD.nodes.clear();
+  replay_costs();
+  if (c.baud) link.set_link(c.baud, 256);
+  link.set_turnaround(1000);
+  link.set_faults(noise, noise, 25);
+  if (c.kind == 'z') {
+    SimZSender *z = new SimZSender(&link);
+    z->add_file("replay.bin", data);
+    tx = z;
+  }
+  else {
+    SimSender *y = new SimSender(&link, true, true, true);
+    y->add_file("replay.bin", data);
+    tx = y;
+  }
+  if (c.to_file) {
+    cap.begin(&link, SD.open(REPLAY_CAPTURE, FILE_WRITE), buf.data(), buf.size());
+  }
+  else {
+    cap.begin(&link, buf.data(), buf.size());
+  }
+  if (c.kind == 'z') rx.start_rz(&cap, &SD);
+  else rx.start_rb(&cap, &SD, true, true);
+  bool ok = replay_record(rx, link, cap, *tx, &res) && bench_check_file("replay.bin", data, false);
+  delete tx;
+  cap.end();
+  if (c.to_file) {
+    File f = SD.open(REPLAY_CAPTURE);
+    capture.resize(f.size());
+    for (size_t at = 0; at < capture.size(); ) {
+      int n = f.read(capture.data() + at, min(capture.size() - at, (size_t)32768));
+      if (n <= 0) return false;
+      at += n;
+    }
+  }
+  else {
+    capture.assign(cap.data(), cap.data() + cap.length());
+  }
+  if (save) {
+    FILE *f = fopen(save, "wb");
+    if (f == NULL) return false;
+    fwrite(capture.data(), 1, capture.size(), f);
+    fclose(f);
+  }
+
+  ReplayLink replay;
+  bool crc;
+  if (!replay.load(capture.data(), capture.size()) || replay.mode(&crc) != c.kind || !crc) {
+    ok = false;
+  }
+  bool cut = cap.dropped > 0;
+  for (int i = 0; i < 2; i++) {
+    XYmodem again;
+    SD.nodes.clear();
+    replay_costs();
+    replay.start();
+    if (c.kind == 'z') again.start_rz(&replay, &SD);
+    else again.start_rb(&replay, &SD, true, true);
+    bool done = replay_run(again, replay, c.realtime && i == 0, &play[i]);
+    if (cut) {
+      // Only what was recorded can be checked.
+      ok = ok && (replay.diverged < 0 || (uint64_t)replay.diverged >= replay.out_bytes());
+    }
+    else {
+      ok = ok && done && bench_check_file("replay.bin", data, false) && replay.diverged < 0;
+      // Deterministic to the microsecond unless the wall clock paced it.
+      if (!c.realtime) ok = ok && replay.late_us == 0 && replay.early_us == 0;
+    }
+    if (i == 0) {
+      printf("%-9s %8zu %7zu %6.1f%% %5u %8.3fs %8.3fs %8.3fs %8.3f %8.3f %10.2f%s%s\n",
+          c.name, capture.size(), replay.in_bytes() + replay.out_bytes(),
+          100.0 * capture.size() / (replay.in_bytes() + replay.out_bytes()) - 100.0,
+          (unsigned)cap.dropped, res.virt_us / 1e6, play[0].virt_us / 1e6, play[0].wall,
+          replay.late_us / 1000.0, replay.early_us / 1000.0,
+          (double)play[0].cycles / c.len, cut ? " cut" : "", ok ? "" : " FAIL");
+    }
+  }
+  if (!cut) ok = ok && play[0].virt_us == play[1].virt_us;
+  if (cut) ok = ok && replay.done();
+  if (c.realtime) ok = ok && play[0].wall >= 0.9 * play[0].virt_us / 1e6;
+  SD.write_call_us = 0;
+  SD.write_byte_ns = 0;
+  return ok;
+}
+
+int main(int argc, char *argv[])
+{
+  int failures = 0;
+
+  printf("Capture and replay, noise both ways, SPI flash write costs\n");
+  printf("%-9s %8s %7s %7s %5s %9s %9s %9s %8s %8s %10s\n", "session", "capture",
+      "bytes", "extra", "lost", "recorded", "replayed", "wall", "late ms", "early ms",
+      "cyc/byte");
+  for (size_t i = 0; i < sizeof(cases)/sizeof(cases[0]); i++) {
+    if (!replay_case(cases[i], (i == 0 && argc > 1) ? argv[1] : NULL)) failures++;
+  }
+  printf("%d failures\n", failures);
+  return (failures) ? 1 : 0;
+}
@@ -0,0 +1,200 @@
+/*
+ * Playback of XYcapture captures, see replaylink.h and xycapture.cpp for
+ * the format.
+ */
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+#include <xymodem.h>
+#include "replaylink.h"
+
+// How long to keep a receiver going after a capture that was cut off, for
+// its timeouts to run out.
+#define REPLAY_TAIL_US 10000000
+
+bool ReplayLink::load(const uint8_t *data, size_t len)
+{
+  in.clear();
+  out.clear();
+  in_us.clear();
+  out_us.clear();
+  in_stall.clear();
+  out_stall.clear();
+  end_us = 0;
+  if (len < 4 || memcmp(data, XYCAPTURE_MAGIC, 4) != 0) return false;
+  size_t i = 4;
+  uint32_t clock[2] = {0, 0};     // each way counts on its own
+  uint32_t stall_us = 0;          // before the next record
+  while (i < len) {
+    uint8_t h = data[i++];
+    uint32_t us = 0;
+    for (int shift = 0; i < len; shift += 7) {
+      uint8_t b = data[i++];
+      us |= (uint32_t)(b & 0x7F) << shift;
+      if (!(b & 0x80)) break;
+    }
+    if (h == XYCAPTURE_STALL) {
+      stall_us += us;
+      continue;
+    }
+    uint32_t t = clock[h >> 7] += us;
+    end_us = max(end_us, t);
+    size_t n = min((size_t)(h & 0x7F) + 1, len - i);
+    std::vector<uint8_t> &bytes = (h & 0x80) ? out : in;
+    std::vector<uint32_t> &times = (h & 0x80) ? out_us : in_us;
+    if (stall_us > 0) {
+      stall_t s = {bytes.size(), stall_us};
+      ((h & 0x80) ? out_stall : in_stall).push_back(s);
+      stall_us = 0;
+    }
+    bytes.insert(bytes.end(), data + i, data + i + n);
+    times.insert(times.end(), n, t);
+    i += n;
+  }
+  return true;
+}
+
+bool ReplayLink::load(const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) return false;
+  std::vector<uint8_t> data;
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) data.insert(data.end(), buf, buf + n);
+  fclose(f);
+  return load(data.data(), data.size());
+}
+
+char ReplayLink::mode(bool *crc)
+{
+  *crc = true;
+  if (out.empty()) return 'y';
+  switch (out[0]) {
+    case 'G': return 'g';
+    case '*': return 'z';
+    case NAK: *crc = false; break;
+  }
+  // XMODEM starts at block 1, YMODEM with the file name in block 0.
+  for (size_t i = 0; i + 1 < in.size(); i++) {
+    if (in[i] == SOH || in[i] == STX) return (in[i + 1] == 0) ? 'y' : 'x';
+  }
+  return 'y';
+}
+
+void ReplayLink::start()
+{
+  in_head = in_due = 0;
+  in_stall_next = out_stall_next = 0;
+  written = 0;
+  diverged = -1;
+  late_us = early_us = 0;
+  t0 = micros();
+}
+
+int ReplayLink::available()
+{
+  uint32_t now = micros() - t0;
+  while (in_due < in.size() && in_us[in_due] <= now) in_due++;
+  return in_due - in_head;
+}
+
+int ReplayLink::read()
+{
+  if (available() <= 0) return -1;
+  int c = in[in_head++];
+  stalled(in_stall, in_stall_next, in_head);
+  return c;
+}
+
+size_t ReplayLink::readBytes(char *buffer, size_t length)
+{
+  size_t n = min((size_t)available(), length);
+  memcpy(buffer, in.data() + in_head, n);
+  in_head += n;
+  stalled(in_stall, in_stall_next, in_head);
+  return n;
+}
+
+size_t ReplayLink::write(const uint8_t *buffer, size_t size)
+{
+  int32_t now = micros() - t0;
+  for (size_t i = 0; i < size; i++, written++) {
+    if (written >= out.size()) {
+      if (diverged < 0) diverged = written;
+      continue;
+    }
+    if (diverged < 0 && buffer[i] != out[written]) diverged = written;
+    int32_t lag = now - (int32_t)out_us[written];
+    late_us = max(late_us, lag);
+    early_us = max(early_us, -lag);
+  }
+  stalled(out_stall, out_stall_next, written);
+  return size;
+}
+
+/*
+ * Bytes up to to have moved one way. Take as long as the capture spent
+ * writing itself out while they did.
+ */
+void ReplayLink::stalled(std::vector<stall_t> &stalls, size_t &next, uint64_t to)
+{
+  uint32_t us = 0;
+  while (next < stalls.size() && stalls[next].at < to) us += stalls[next++].us;
+  if (us > 0) host_advance_us(us);
+}
+
+uint32_t ReplayLink::wait_us()
+{
+  if (available() > 0) return 0;
+  if (in_due >= in.size()) return 0xFFFFFFFF;
+  return in_us[in_due] - (micros() - t0);
+}
+
+uint32_t replay_idle_us(uint32_t wait_us)
+{
+  return min(wait_us, (uint32_t)(1000 - micros() % 1000));
+}
+
+bool replay_run(XYmodem &rx, ReplayLink &link, bool realtime, bench_result_t *res)
+{
+  uint64_t cycles = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::duration in_loop(0);
+  int state = 1;
+  uint32_t v0 = micros();
+  uint32_t longest = 0;
+
+  for (;;) {
+    auto l0 = std::chrono::steady_clock::now();
+    uint64_t c0 = bench_cycles();
+    uint32_t lv = micros();
+    uint64_t moved = link.moved();
+    uint32_t committed = rx.stats().bytes_committed;
+    state = rx.loop();
+    longest = max(longest, (uint32_t)(micros() - lv));
+    cycles += bench_cycles() - c0;
+    in_loop += std::chrono::steady_clock::now() - l0;
+    if (state == 0) break;
+    // Called again at once, as from the Arduino loop(), unless it had
+    // nothing to do.
+    if (micros() != lv || link.moved() != moved || rx.stats().bytes_committed != committed ||
+        link.available() > 0) {
+      continue;
+    }
+    if (link.done() && micros() - v0 >= link.duration_us() + REPLAY_TAIL_US) break;
+    host_advance_us(replay_idle_us(link.wait_us()));
+    if (realtime) {
+      std::this_thread::sleep_until(t0 + std::chrono::microseconds(micros() - v0));
+    }
+  }
+  res->cycles = cycles;
+  res->seconds = std::chrono::duration<double>(in_loop).count();
+  res->wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  res->virt_us = micros() - v0;
+  res->link_us = 0;
+  res->loop_us_max = longest;
+  res->frames = 0;
+  res->retries = 0;
+  return state == 0;
+}
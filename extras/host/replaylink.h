@@ -0,0 +1,87 @@
+/*
+ * Plays a capture made by XYcapture back to a receiver. A byte the port
+ * gave the receiver then becomes available at the same time after start()
+ * now, and what the receiver writes is checked against what it wrote then.
+ * With the same code and the same file system costs the receiver answers
+ * with the same bytes at the same times, so a session recorded on a board
+ * can be rerun, profiled and timed on the host. Where the capture took
+ * time to write itself to a file, the call that moves the same byte takes
+ * as much virtual time longer.
+ */
+
+#ifndef _REPLAYLINK_H_
+#define _REPLAYLINK_H_
+
+#include <Arduino.h>
+#include <vector>
+#include "benchutil.h"
+
+class ReplayLink : public Stream {
+  public:
+    // false if it is not a capture. One cut off part way is fine.
+    bool load(const uint8_t *data, size_t len);
+    bool load(const char *path);
+    // Receiver mode the capture starts with: 'x', 'y', 'g' or 'z', and
+    // whether it asked for a CRC. Taken from its first request and the
+    // first block number that came back.
+    char mode(bool *crc);
+    // Start the clock the capture's times count from. Call it just before
+    // starting the receiver, which may write at once.
+    void start();
+
+    int available();
+    int read();
+    int peek() { return (available() > 0) ? in[in_head] : -1; }
+    size_t readBytes(char *buffer, size_t length);
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+
+    // Virtual microseconds until the next byte is due, 0 if one is there
+    // and 0xFFFFFFFF once every byte has been read.
+    uint32_t wait_us();
+    bool done() { return in_head >= in.size(); }
+    // Time of the last byte either way.
+    uint32_t duration_us() { return end_us; }
+    size_t in_bytes() { return in.size(); }
+    size_t out_bytes() { return out.size(); }
+    // Bytes read and written so far.
+    uint64_t moved() { return in_head + written; }
+
+    uint64_t written = 0;
+    int64_t diverged = -1;    // first byte written that differs, -1 if none
+    int32_t late_us = 0;      // most a byte written was behind the capture
+    int32_t early_us = 0;     // and ahead of it
+
+  private:
+    // The capture's own file write took us before byte at went on.
+    typedef struct {
+      size_t at;
+      uint32_t us;
+    } stall_t;
+    void stalled(std::vector<stall_t> &stalls, size_t &next, uint64_t to);
+
+    std::vector<uint8_t> in, out;
+    std::vector<uint32_t> in_us, out_us;
+    std::vector<stall_t> in_stall, out_stall;
+    size_t in_stall_next = 0;
+    size_t out_stall_next = 0;
+    size_t in_head = 0;
+    size_t in_due = 0;        // bytes due by now
+    uint32_t end_us = 0;
+    uint32_t t0 = 0;
+};
+
+// How long a receiver with nothing to do waits for the next byte,
+// wait_us away: no further than the next millisecond, as its timeouts
+// count in milliseconds and one called all the time sees each go by.
+uint32_t replay_idle_us(uint32_t wait_us);
+
+// Run rx, started on link after link.start(), until it stops or the
+// capture runs out. As from a sketch, loop() is called again at once after
+// a call that did anything, and time only moves while it waits. realtime
+// paces virtual time to the wall clock, so the session takes as long as it
+// did; otherwise waiting takes no time.
+bool replay_run(XYmodem &rx, ReplayLink &link, bool realtime, bench_result_t *res);
+
+#endif /* _REPLAYLINK_H_ */
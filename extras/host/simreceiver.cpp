@@ -0,0 +1,140 @@
+#include "simreceiver.h"
+#include <stdlib.h>
+#include <xymodem.h>
+#include <xycrc.h>
+
+SimReceiver::SimReceiver(HostLink *link, bool ymodem, uint8_t start)
+  : link(link), ymodem(ymodem), start(start), state(ymodem ? HEADER : DATA)
+{
+  if (!ymodem) files.push_back(SimFile{"", std::vector<uint8_t>(), 0});
+}
+
+void SimReceiver::reply(uint8_t c)
+{
+  link->send(&c, 1);
+  last_us = micros();
+}
+
+void SimReceiver::request()
+{
+  reply(start);
+}
+
+void SimReceiver::frame(uint8_t block, const uint8_t *data, size_t len)
+{
+  if (state == HEADER) {
+    if (block != 0) {
+      // The sender missed the ACK of its last block.
+      reply(ACK);
+      return;
+    }
+    if (data[0] == 0) {
+      // End of batch.
+      reply(ACK);
+      state = DONE;
+      return;
+    }
+    const char *name = (const char *)data;
+    size = strtoul(name + strlen(name) + 1, NULL, 10);
+    files.push_back(SimFile{name, std::vector<uint8_t>(), 0});
+    if (start != 'G') reply(ACK);
+    request();
+    state = DATA;
+    next_block = 1;
+    eot_seen = false;
+    return;
+  }
+  if (block == next_block) {
+    std::vector<uint8_t> &f = files.back().data;
+    size_t n = len;
+    if (ymodem && size > 0) n = min(len, (size_t)(size - min((size_t)size, f.size())));
+    f.insert(f.end(), data, data + n);
+    next_block++;
+    frames_sent++;
+    if (start != 'G') reply(ACK);
+  }
+  else if (block == (uint8_t)(next_block - 1) && start != 'G') {
+    reply(ACK);
+  }
+  else {
+    reply(CAN);
+    reply(CAN);
+    state = FAILED;
+  }
+}
+
+bool SimReceiver::poll()
+{
+  bool sent = false;
+  int c;
+
+  if (!started) {
+    started = true;
+    request();
+    return true;
+  }
+  while ((c = link->reply()) >= 0) {
+    in.push_back(c);
+    last_us = micros();
+  }
+  while (!in.empty() && (state == HEADER || state == DATA)) {
+    if (in[0] == SOH || in[0] == STX) {
+      size_t len = (in[0] == STX) ? 1024 : 128;
+      size_t total = 3 + len + ((start == NAK) ? 1 : 2);
+      if (in.size() < total) break;
+      const uint8_t *data = &in[3];
+      bool ok = (uint8_t)(in[1] ^ in[2]) == 0xFF;
+      if (start == NAK) ok = ok && xysum8(0, data, len) == data[len];
+      else ok = ok && xycrc16(0, data, len) == (data[len] << 8 | data[len+1]);
+      if (!ok) {
+        // Drop everything, as rb purges the line, and ask again.
+        in.clear();
+        retries++;
+        reply((start == 'G') ? CAN : NAK);
+        if (start == 'G') state = FAILED;
+        sent = true;
+        break;
+      }
+      std::vector<uint8_t> block(data, data + len);
+      uint8_t num = in[1];
+      in.erase(in.begin(), in.begin() + total);
+      frame(num, block.data(), len);
+      sent = true;
+    }
+    else if (in[0] == EOT) {
+      in.erase(in.begin());
+      if (state != DATA) continue;
+      sent = true;
+      if (nak_eot && !eot_seen) {
+        eot_seen = true;
+        reply(NAK);
+        continue;
+      }
+      reply(ACK);
+      if (!ymodem) {
+        state = DONE;
+        break;
+      }
+      state = HEADER;
+      request();
+    }
+    else if (in[0] == CAN) {
+      if (in.size() < 2) break;
+      if (in[1] == CAN) state = FAILED;
+      in.erase(in.begin());
+    }
+    else {
+      // Line noise.
+      in.erase(in.begin());
+    }
+  }
+  // rb asks again after 10 s of silence.
+  if ((state == HEADER || state == DATA) && micros() - last_us >= 10000000) {
+    in.clear();
+    retries++;
+    if (state == HEADER || next_block == 1) request();
+    else reply(NAK);
+    sent = true;
+  }
+  return sent;
+}
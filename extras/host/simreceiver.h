@@ -0,0 +1,48 @@
+/*
+ * Scripted XMODEM/YMODEM receiver for benchmarking the XYmodem sender,
+ * modelled on lrzsz rx/rb. Asks with 'C', NAK or 'G', checks every frame,
+ * ACKs good and repeated blocks, NAKs bad ones and asks again after 10 s
+ * of silence. Gives up with CAN CAN on a block out of sequence.
+ */
+
+#ifndef _SIMRECEIVER_H_
+#define _SIMRECEIVER_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "hostlink.h"
+#include "simsender.h"
+
+class SimReceiver : public SimPeer {
+  public:
+    // start is 'C' for CRC, NAK for checksum or 'G' for YMODEM-G.
+    SimReceiver(HostLink *link, bool ymodem, uint8_t start = 'C');
+    bool poll();
+    bool done() { return state == DONE; }
+    bool failed() { return state == FAILED; }
+
+    // Files received. XMODEM gets one without a name, padding included.
+    std::vector<SimFile> files;
+    // NAK the first EOT of each file, as the YMODEM spec allows.
+    bool nak_eot = false;
+
+  private:
+    enum state_t { HEADER, DATA, DONE, FAILED };
+    void request();
+    void reply(uint8_t c);
+    void frame(uint8_t block, const uint8_t *data, size_t len);
+
+    HostLink *link;
+    bool ymodem;
+    uint8_t start;
+    state_t state;
+    std::vector<uint8_t> in;
+    uint8_t next_block = 1;
+    uint32_t size = 0;        // from block 0, 0 if not given
+    bool eot_seen = false;
+    bool started = false;
+    uint32_t last_us = 0;     // micros() at the last byte or request
+};
+
+#endif /* _SIMRECEIVER_H_ */
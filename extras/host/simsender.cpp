@@ -0,0 +1,169 @@
+#include "simsender.h"
+#include <stdio.h>
+#include <xymodem.h>
+#include <xycrc.h>
+
+SimSender::SimSender(HostLink *link, bool ymodem, bool use1k, bool useCRC)
+  : link(link), ymodem(ymodem), use1k(use1k), useCRC(useCRC)
+{
+}
+
+void SimSender::add_file(const std::string &name, const std::vector<uint8_t> &data,
+    uint32_t mtime)
+{
+  files.push_back(SimFile{name, data, mtime});
+}
+
+void SimSender::send_frame(uint8_t num, const uint8_t *data, size_t len, size_t blocksize, uint8_t pad)
+{
+  last_frame.clear();
+  last_frame.push_back(blocksize == 1024 ? STX : SOH);
+  last_frame.push_back(num);
+  last_frame.push_back(~num);
+  size_t start = last_frame.size();
+  last_frame.insert(last_frame.end(), data, data + len);
+  last_frame.resize(start + blocksize, pad);
+  if (useCRC) {
+    uint16_t crc = xycrc16(0, &last_frame[start], blocksize);
+    last_frame.push_back(crc >> 8);
+    last_frame.push_back(crc & 0xFF);
+  }
+  else {
+    last_frame.push_back(xysum8(0, &last_frame[start], blocksize));
+  }
+  link->send(last_frame.data(), last_frame.size());
+  frames_sent++;
+}
+
+void SimSender::send_header(const SimFile *f)
+{
+  uint8_t hdr[1024] = {0};
+  size_t len = 0;
+  if (f) {
+    len = snprintf((char *)hdr, sizeof(hdr), "%s", f->name.c_str()) + 1;
+    len += snprintf((char *)hdr + len, sizeof(hdr) - len, "%u", (unsigned)f->data.size());
+    if (send_crc) {
+      uint32_t crc = xycrc32(0, f->data.data(), f->data.size());
+      len += snprintf((char *)hdr + len, sizeof(hdr) - len, " %o 0 0 crc32:%08x",
+          (unsigned)f->mtime, (unsigned)((bad_crc) ? crc ^ 1 : crc));
+    }
+    len++;
+  }
+  send_frame(0, hdr, len, (len > 128) ? 1024 : 128, 0);
+}
+
+void SimSender::send_block()
+{
+  const SimFile &f = files[file_index];
+  if (offset >= f.data.size()) {
+    uint8_t eot = EOT;
+    last_frame.assign(1, eot);
+    link->send(&eot, 1);
+    state = EOT_ACK;
+    return;
+  }
+  size_t blocksize = use1k ? 1024 : 128;
+  last_len = min(blocksize, f.data.size() - offset);
+  send_frame(blocknum, &f.data[offset], last_len, blocksize, 0x1A);
+  state = DATA_ACK;
+}
+
+bool SimSender::poll()
+{
+  bool sent = false;
+  int c;
+  while ((c = link->reply()) >= 0) {
+    // Like sx, one CAN may be line noise, two cancel.
+    if (c == CAN) {
+      if (can_seen) {
+        state = FAILED;
+        return sent;
+      }
+      can_seen = true;
+      continue;
+    }
+    can_seen = false;
+    switch (state) {
+      case WAIT_START:
+        if (c != 'C' && c != NAK && c != 'G') break;
+        if (c == 'G') {
+          streaming = useCRC = use1k = true;
+        }
+        if (!ymodem) {
+          offset = 0;
+          blocknum = 1;
+          send_block();
+        }
+        else if (file_index < files.size()) {
+          send_header(&files[file_index]);
+          state = (streaming) ? WAIT_DATA_START : HEADER_ACK;
+        }
+        else {
+          send_header(NULL);
+          state = (streaming) ? DONE : FINAL_ACK;
+        }
+        sent = true;
+        break;
+      case HEADER_ACK:
+        if (c == ACK) {
+          state = WAIT_DATA_START;
+        }
+        else if (c == NAK || c == 'C') {
+          link->send(last_frame.data(), last_frame.size());
+          retries++;
+          sent = true;
+        }
+        break;
+      case WAIT_DATA_START:
+        if (c == 'C' || c == NAK || c == 'G') {
+          offset = 0;
+          blocknum = 1;
+          send_block();
+          while (streaming && state == DATA_ACK) {
+            offset += last_len;
+            blocknum++;
+            send_block();
+          }
+          sent = true;
+        }
+        break;
+      case DATA_ACK:
+        if (c == ACK) {
+          offset += last_len;
+          blocknum++;
+          send_block();
+        }
+        else {
+          link->send(last_frame.data(), last_frame.size());
+          retries++;
+        }
+        sent = true;
+        break;
+      case EOT_ACK:
+        if (c == ACK) {
+          file_index++;
+          state = (ymodem) ? WAIT_START : DONE;
+        }
+        else {
+          link->send(last_frame.data(), last_frame.size());
+          retries++;
+          sent = true;
+        }
+        break;
+      case FINAL_ACK:
+        if (c == ACK) {
+          state = DONE;
+        }
+        else if (c == NAK || c == 'C') {
+          link->send(last_frame.data(), last_frame.size());
+          retries++;
+          sent = true;
+        }
+        break;
+      case DONE:
+      case FAILED:
+        break;
+    }
+  }
+  return sent;
+}
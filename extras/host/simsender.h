@@ -0,0 +1,75 @@
+/*
+ * Scripted XMODEM/YMODEM sender for the host benchmarks. Behaves like
+ * lrzsz sx/sb: waits for 'C' or NAK, resends on NAK, gives up on CAN CAN.
+ * A 'G' start switches to YMODEM-G and every file is streamed without
+ * waiting for ACKs.
+ */
+
+#ifndef _SIMSENDER_H_
+#define _SIMSENDER_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "hostlink.h"
+
+struct SimFile {
+  std::string name;
+  std::vector<uint8_t> data;
+  uint32_t mtime;     // seconds since 1970
+};
+
+// Modification time the senders give a file unless told otherwise.
+#define SIM_MTIME 014000000000
+
+// What the benchmark loop needs from a sender.
+class SimPeer {
+  public:
+    virtual ~SimPeer() {}
+    // Consume receiver replies and queue the next frame. Returns true if
+    // anything was sent.
+    virtual bool poll() = 0;
+    virtual bool done() = 0;
+    virtual bool failed() = 0;
+
+    uint32_t frames_sent = 0;
+    uint32_t retries = 0;
+};
+
+class SimSender : public SimPeer {
+  public:
+    SimSender(HostLink *link, bool ymodem, bool use1k, bool useCRC);
+    void add_file(const std::string &name, const std::vector<uint8_t> &data,
+        uint32_t mtime = SIM_MTIME);
+    bool poll();
+    bool done() { return state == DONE; }
+    bool failed() { return state == FAILED; }
+
+    // Add the modification time and a crc32:<hex> field to block 0,
+    // optionally a wrong one.
+    bool send_crc = false;
+    bool bad_crc = false;
+
+  private:
+    enum state_t {
+      WAIT_START, HEADER_ACK, WAIT_DATA_START, DATA_ACK, EOT_ACK, FINAL_ACK,
+      DONE, FAILED
+    };
+    void send_header(const SimFile *f);
+    void send_block();
+    void send_frame(uint8_t blocknum, const uint8_t *data, size_t len, size_t blocksize, uint8_t pad);
+
+    HostLink *link;
+    bool ymodem, use1k, useCRC;
+    bool streaming = false;
+    bool can_seen = false;
+    state_t state = WAIT_START;
+    std::vector<SimFile> files;
+    size_t file_index = 0;
+    size_t offset = 0;
+    size_t last_len = 0;
+    uint8_t blocknum = 1;
+    std::vector<uint8_t> last_frame;
+};
+
+#endif /* _SIMSENDER_H_ */
@@ -0,0 +1,257 @@
+#include "simzsender.h"
+#include <stdio.h>
+#include <xymodem.h>
+#include <xycrc.h>
+#include <zmodem.h>
+
+SimZSender::SimZSender(HostLink *link, size_t blklen, size_t ahead)
+  : link(link), blklen(blklen), ahead(ahead)
+{
+  // sz announces itself before the receiver's ZRINIT arrives.
+  out.assign((const uint8_t *)"rz\r", (const uint8_t *)"rz\r" + 3);
+  hex_header(ZRQINIT, 0);
+  flush();
+}
+
+void SimZSender::add_file(const std::string &name, const std::vector<uint8_t> &data,
+    uint32_t mtime)
+{
+  files.push_back(SimFile{name, data, mtime});
+}
+
+void SimZSender::flush()
+{
+  if (out.empty()) return;
+  link->send(out.data(), out.size());
+  out.clear();
+}
+
+void SimZSender::escape(std::vector<uint8_t> &dst, const uint8_t *data, size_t len)
+{
+  for (size_t i = 0; i < len; i++) {
+    uint8_t c = data[i];
+    switch (c) {
+      case ZDLE: case 0x10: case XON: case XOFF:
+      case 0x90: case 0x91: case 0x93: case 0x98:
+        dst.push_back(ZDLE);
+        dst.push_back(c ^ 0x40);
+        break;
+      default:
+        dst.push_back(c);
+        break;
+    }
+  }
+}
+
+void SimZSender::hex_header(uint8_t type, uint32_t pos)
+{
+  uint8_t hdr[7] = {type, (uint8_t)pos, (uint8_t)(pos >> 8), (uint8_t)(pos >> 16), (uint8_t)(pos >> 24)};
+  uint16_t crc = xycrc16(0, hdr, 5);
+  hdr[5] = crc >> 8;
+  hdr[6] = crc;
+  char buf[32];
+  int n = snprintf(buf, sizeof(buf), "**\x18" "B%02x%02x%02x%02x%02x%02x%02x\r\x8a\x11",
+      hdr[0], hdr[1], hdr[2], hdr[3], hdr[4], hdr[5], hdr[6]);
+  out.insert(out.end(), buf, buf + n);
+}
+
+void SimZSender::header(uint8_t type, uint32_t pos)
+{
+  uint8_t hdr[9] = {type, (uint8_t)pos, (uint8_t)(pos >> 8), (uint8_t)(pos >> 16), (uint8_t)(pos >> 24)};
+  size_t len = 5;
+  out.push_back(ZPAD);
+  out.push_back(ZDLE);
+  if (crc32) {
+    uint32_t crc = xycrc32(0, hdr, 5);
+    for (int i = 0; i < 4; i++) hdr[len++] = crc >> (8 * i);
+    out.push_back(ZBIN32);
+  }
+  else {
+    uint16_t crc = xycrc16(0, hdr, 5);
+    hdr[len++] = crc >> 8;
+    hdr[len++] = crc;
+    out.push_back(ZBIN);
+  }
+  escape(out, hdr, len);
+  frames_sent++;
+}
+
+void SimZSender::subpacket(const uint8_t *data, size_t len, uint8_t end)
+{
+  uint8_t crc[4];
+  size_t crclen;
+  escape(out, data, len);
+  out.push_back(ZDLE);
+  out.push_back(end);
+  if (crc32) {
+    uint32_t c = xycrc32(xycrc32(0, data, len), &end, 1);
+    for (int i = 0; i < 4; i++) crc[i] = c >> (8 * i);
+    crclen = 4;
+  }
+  else {
+    uint16_t c = xycrc16(xycrc16(0, data, len), &end, 1);
+    crc[0] = c >> 8;
+    crc[1] = c;
+    crclen = 2;
+  }
+  escape(out, crc, crclen);
+}
+
+void SimZSender::send_file_header()
+{
+  const SimFile &f = files[file_index];
+  char info[256];
+  int n = snprintf(info, sizeof(info), "%s", f.name.c_str()) + 1;
+  n += snprintf(info + n, sizeof(info) - n, "%u %o 100644 0 %u %u",
+      (unsigned)f.data.size(), (unsigned)f.mtime, (unsigned)(files.size() - file_index),
+      (unsigned)f.data.size());
+  header(ZFILE, 0);
+  subpacket((const uint8_t *)info, n + 1, ZCRCW);
+  flush();
+  state = WAIT_RPOS;
+  rinits = 0;
+}
+
+void SimZSender::next_file()
+{
+  if (file_index < files.size()) {
+    send_file_header();
+  }
+  else {
+    hex_header(ZFIN, 0);
+    flush();
+    state = WAIT_FIN;
+  }
+}
+
+void SimZSender::got_header(uint8_t type, uint32_t pos)
+{
+  switch (type) {
+    case ZRINIT:
+      rxbuflen = pos & 0xFFFF;
+      crc32 = ((pos >> 24) & CANFC32) != 0;
+      if (state == WAIT_EOF) file_index++;
+      if (state == WAIT_RINIT || state == WAIT_EOF) next_file();
+      else if (state == WAIT_RPOS && ++rinits >= 2) {
+        // Receiver did not see the ZFILE, send it again. A single ZRINIT,
+        // such as the answer to ZRQINIT crossing the first ZFILE, is let
+        // pass as lsz does when another header follows it.
+        send_file_header();
+        retries++;
+      }
+      break;
+    case ZRPOS:
+      if (state == WAIT_RPOS || state == DATA || state == WAIT_ACK || state == WAIT_EOF) {
+        if (state != WAIT_RPOS) retries++;
+        else start_pos = pos;
+        offset = pos;
+        since_sync = 0;
+        header(ZDATA, offset);
+        state = DATA;
+      }
+      break;
+    case ZACK:
+      if (state == WAIT_ACK && pos == offset) {
+        since_sync = 0;
+        header(ZDATA, offset);
+        state = DATA;
+      }
+      break;
+    case ZCRC:
+      // As lsz: CRC-32 of the first pos bytes of the file, 0 for all.
+      if (state == WAIT_RPOS) {
+        const SimFile &f = files[file_index];
+        size_t n = (pos > 0 && pos < f.data.size()) ? pos : f.data.size();
+        uint32_t crc = xycrc32(0, f.data.data(), n);
+        crc_requests++;
+        header(ZCRC, (bad_crc) ? crc ^ 1 : crc);
+        flush();
+      }
+      break;
+    case ZSKIP:
+      if (state == WAIT_RPOS) {
+        skipped++;
+        file_index++;
+        next_file();
+      }
+      break;
+    case ZNAK:
+      if (state == WAIT_RPOS) send_file_header();
+      break;
+    case ZFIN:
+      if (state == WAIT_FIN) {
+        out.push_back('O');
+        out.push_back('O');
+        flush();
+        state = DONE;
+      }
+      break;
+  }
+}
+
+bool SimZSender::poll()
+{
+  bool sent = false;
+  int c;
+
+  while ((c = link->reply()) >= 0) {
+    if (c == CAN) {
+      if (++can_count >= 5) {
+        state = FAILED;
+        return sent;
+      }
+    }
+    else {
+      can_count = 0;
+    }
+    in.push_back(c);
+    // Receiver only sends hex headers: "**" ZDLE 'B' and 14 hex digits.
+    size_t start = 0;
+    while (start + 1 < in.size() && !(in[start] == ZPAD && in[start+1] == ZDLE)) start++;
+    if (start + 18 <= in.size() && in[start+2] == ZHEX) {
+      uint8_t hdr[7];
+      for (int i = 0; i < 7; i++) {
+        unsigned v;
+        char hex[3] = {(char)in[start+3+2*i], (char)in[start+4+2*i], 0};
+        sscanf(hex, "%x", &v);
+        hdr[i] = v;
+      }
+      in.clear();
+      if (xycrc16(0, hdr, 7) == 0) {
+        got_header(hdr[0], (uint32_t)hdr[1] | hdr[2] << 8 | hdr[3] << 16 | (uint32_t)hdr[4] << 24);
+        sent = true;
+      }
+    }
+    else if (in.size() > 64) {
+      in.erase(in.begin(), in.end() - 18);
+    }
+  }
+
+  // Keep the link full while streaming.
+  while (state == DATA && link->in_flight() + out.size() < ahead) {
+    const SimFile &f = files[file_index];
+    size_t len = min(blklen, f.data.size() - offset);
+    uint8_t end = ZCRCG;
+    if (offset + len >= f.data.size()) {
+      end = ZCRCE;
+    }
+    else if (rxbuflen && since_sync + len >= rxbuflen) {
+      end = ZCRCW;
+    }
+    subpacket(len ? &f.data[offset] : NULL, len, end);
+    offset += len;
+    since_sync += len;
+    if (end == ZCRCE) {
+      header(ZEOF, offset);
+      state = WAIT_EOF;
+    }
+    else if (end == ZCRCW) {
+      state = WAIT_ACK;
+    }
+  }
+  if (!out.empty()) {
+    flush();
+    sent = true;
+  }
+  return sent;
+}
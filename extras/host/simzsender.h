@@ -0,0 +1,61 @@
+/*
+ * Scripted ZMODEM sender for the host benchmarks, modelled on lrzsz sz.
+ * Streams ZCRCG subpackets, keeping at most `ahead` bytes in flight as an
+ * OS serial buffer would, and rewinds to the offset in any ZRPOS.
+ */
+
+#ifndef _SIMZSENDER_H_
+#define _SIMZSENDER_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "hostlink.h"
+#include "simsender.h"
+
+class SimZSender : public SimPeer {
+  public:
+    SimZSender(HostLink *link, size_t blklen = 1024, size_t ahead = 4096);
+    void add_file(const std::string &name, const std::vector<uint8_t> &data,
+        uint32_t mtime = SIM_MTIME);
+    bool poll();
+    bool done() { return state == DONE; }
+    bool failed() { return state == FAILED; }
+
+    // File offset of the next data byte to send.
+    uint32_t position() { return offset; }
+    // Offset in the first ZRPOS for the last file, > 0 if it resumed.
+    uint32_t start_pos = 0;
+    // ZCRC requests answered, and whether to answer them wrongly.
+    uint32_t crc_requests = 0;
+    bool bad_crc = false;
+    // Files the receiver skipped with ZSKIP.
+    uint32_t skipped = 0;
+
+  private:
+    enum state_t { WAIT_RINIT, WAIT_RPOS, DATA, WAIT_ACK, WAIT_EOF, WAIT_FIN, DONE, FAILED };
+    void header(uint8_t type, uint32_t pos);
+    void hex_header(uint8_t type, uint32_t pos);
+    void subpacket(const uint8_t *data, size_t len, uint8_t end);
+    void escape(std::vector<uint8_t> &out, const uint8_t *data, size_t len);
+    void send_file_header();
+    void next_file();
+    void got_header(uint8_t type, uint32_t pos);
+    void flush();
+
+    HostLink *link;
+    size_t blklen, ahead;
+    state_t state = WAIT_RINIT;
+    std::vector<SimFile> files;
+    size_t file_index = 0;
+    uint32_t offset = 0;
+    uint32_t rxbuflen = 0;
+    uint32_t since_sync = 0;
+    uint8_t rinits = 0;       // ZRINITs since the last ZFILE
+    bool crc32 = false;
+    std::vector<uint8_t> out;
+    std::vector<uint8_t> in;
+    uint8_t can_count = 0;
+};
+
+#endif /* _SIMZSENDER_H_ */
@@ -0,0 +1,1120 @@
+/*
+ * Host throughput benchmark for XYmodem::loop(). Pushes XMODEM, YMODEM and
+ * ZMODEM transfers of several sizes through a simulated link, checks the received
+ * file byte for byte and reports receive throughput and CPU cost.
+ *
+ * Throughput is payload bytes divided by the CPU time spent inside loop(),
+ * so it measures the receiver, not the simulated link.
+ */
+
+#include <stdio.h>
+#include <xymodem.h>
+#include <xycrc.h>
+#include "hostlink.h"
+#include "simsender.h"
+#include "simzsender.h"
+#include "simreceiver.h"
+#include "benchutil.h"
+#include "hostflash.h"
+#include "xylzss.h"
+
+static bool bench_xmodem(size_t len, bool use1k, bool useCRC)
+{
+  HostLink link;
+  XYmodem rx;
+  bench_result_t res;
+  std::vector<uint8_t> data = bench_payload(len, len);
+
+  SD.nodes.clear();
+  SimSender tx(&link, false, use1k, useCRC);
+  tx.add_file("", data);
+  rx.start_rx(&link, "xmodem.bin", use1k, useCRC);
+  bool ok = bench_run(rx, link, tx, &res) && bench_check_file("xmodem.bin", data, true);
+  bench_print("xmodem", use1k, useCRC, len, &res, ok ? "" : "FAIL");
+  return ok;
+}
+
+static bool bench_ymodem(size_t len, bool use1k, bool useCRC, int nfiles,
+    uint32_t baud = 0, bool streaming = false)
+{
+  HostLink link;
+  XYmodem rx;
+  bench_result_t res;
+  std::vector<std::vector<uint8_t> > data;
+
+  SD.nodes.clear();
+  SD.write_calls = 0;
+  SD.extends = 0;
+  link.set_link(baud, 256);
+  link.set_turnaround((baud) ? 1000 : 0);
+  SimSender tx(&link, true, use1k, useCRC);
+  for (int i = 0; i < nfiles; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "file%d.bin", i);
+    data.push_back(bench_payload(len, len + i));
+    tx.add_file(name, data.back());
+  }
+  if (streaming) {
+    rx.start_rg(&link, &SD);
+  }
+  else {
+    rx.start_rb(&link, &SD, use1k, useCRC);
+  }
+  bool ok = bench_run(rx, link, tx, &res);
+  for (int i = 0; ok && i < nfiles; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "file%d.bin", i);
+    ok = bench_check_file(name, data[i], false);
+  }
+  char note[64];
+  snprintf(note, sizeof(note), "%swrites=%u saved=%u extends=%u", ok ? "" : "FAIL ",
+      (unsigned)SD.write_calls, (unsigned)rx.writes_saved(), (unsigned)SD.extends);
+  bench_print((streaming) ? "ymodem-g" : "ymodem", use1k, useCRC, len * nfiles, &res, note);
+  if (baud) bench_print_stats(rx.stats());
+  return ok;
+}
+
+static bool bench_zmodem(size_t len, int nfiles, uint32_t baud = 0)
+{
+  HostLink link;
+  XYmodem rx;
+  bench_result_t res;
+  std::vector<std::vector<uint8_t> > data;
+
+  SD.nodes.clear();
+  SD.write_calls = 0;
+  SD.extends = 0;
+  link.set_link(baud, 256);
+  link.set_turnaround((baud) ? 1000 : 0);
+  SimZSender tx(&link);
+  for (int i = 0; i < nfiles; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "file%d.bin", i);
+    data.push_back(bench_payload(len, len + i));
+    tx.add_file(name, data.back());
+  }
+  rx.start_rz(&link, &SD);
+  bool ok = bench_run(rx, link, tx, &res);
+  for (int i = 0; ok && i < nfiles; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "file%d.bin", i);
+    ok = bench_check_file(name, data[i], false);
+  }
+  char note[64];
+  snprintf(note, sizeof(note), "%swrites=%u saved=%u extends=%u rpos=%u", ok ? "" : "FAIL ",
+      (unsigned)SD.write_calls, (unsigned)rx.writes_saved(), (unsigned)SD.extends,
+      (unsigned)res.retries);
+  bench_print("zmodem", true, true, len * nfiles, &res, note);
+  if (baud) bench_print_stats(rx.stats());
+  return ok;
+}
+
+#if XYMODEM_RESUME
+// Start rx on link with a sender of data as resume.bin.
+static SimPeer *resume_start(HostLink *link, XYmodem *rx, const std::vector<uint8_t> &data,
+    bool zmodem)
+{
+  if (zmodem) {
+    SimZSender *tx = new SimZSender(link);
+    tx->add_file("resume.bin", data);
+    rx->start_rz(link, &SD);
+    return tx;
+  }
+  SimSender *tx = new SimSender(link, true, true, true);
+  tx->add_file("resume.bin", data);
+  rx->start_rb(link, &SD, true, true);
+  return tx;
+}
+
+// Send data until the sender has sent cut bytes, then cut the power.
+static void resume_cut(const std::vector<uint8_t> &data, size_t cut, bool zmodem)
+{
+  HostLink link;
+  XYmodem *rx = new XYmodem;
+  SimPeer *tx = resume_start(&link, rx, data, zmodem);
+  while (!tx->failed() && link.sent < cut) {
+    tx->poll();
+    rx->loop();
+  }
+  // No close, no destructor, and anything not flushed is lost.
+  SD.power_cut();
+  delete tx;
+}
+
+// Kill a transfer part way, as a power cut would, then send the same file
+// again. A ZMODEM receiver must ask for only the missing part. A YMODEM
+// sender sends all of it, and the receiver must only write the missing
+// part. A YMODEM sender with other data of the same size must be cancelled
+// once the part already there does not match, and the try after that
+// must get the whole file.
+static bool bench_resume(size_t len, size_t cut, bool zmodem)
+{
+  bench_result_t res;
+  std::vector<uint8_t> data = bench_payload(len, 7);
+
+  SD.nodes.clear();
+  resume_cut(data, cut, zmodem);
+  HostLink link;
+  XYmodem rx;
+  SimPeer *tx = resume_start(&link, &rx, data, zmodem);
+  bool ok = bench_run(rx, link, *tx, &res) && bench_check_file("resume.bin", data, false) &&
+    !SD.exists(XYMODEM_JOURNAL);
+  uint32_t resumed = (zmodem) ? ((SimZSender *)tx)->start_pos : len - rx.stats().bytes_committed;
+  delete tx;
+  // At most one journal interval is sent or written again, plus what was
+  // in flight or buffered in the receiver at the cut.
+  if (zmodem || XYMODEM_STATS) {
+    ok = ok && resumed > 0 && resumed + XYMODEM_JOURNAL_INTERVAL + 16384 >= cut;
+  }
+  printf("resume: %s, cut at %u of %u bytes, resumed at %u, sent %u: %s\n",
+      (zmodem) ? "zmodem" : "ymodem", (unsigned)cut, (unsigned)len, (unsigned)resumed,
+      (unsigned)link.sent, ok ? "ok" : "FAIL");
+  if (zmodem) return ok;
+
+  std::vector<uint8_t> other = bench_payload(len, 8);
+  resume_cut(data, cut, false);
+  bool cancelled = true;
+  for (int i = 0; i < 2; i++) {
+    HostLink link;
+    XYmodem rx;
+    SimPeer *tx = resume_start(&link, &rx, other, false);
+    bool done = bench_run(rx, link, *tx, &res);
+    delete tx;
+    if (i == 0) cancelled = !done && !SD.exists(XYMODEM_JOURNAL) && !SD.exists("resume.bi$");
+    else ok = ok && done && bench_check_file("resume.bin", other, false);
+  }
+  ok = ok && cancelled;
+  printf("resume: ymodem, other data of the same size, cancelled then received: %s\n",
+      ok ? "ok" : "FAIL");
+  return ok;
+}
+#endif
+
+#if XYMODEM_ATOMIC && XYMODEM_DIGEST
+// A file being replaced keeps its old contents through a power cut and a
+// CRC-32 mismatch, and is only replaced by a complete, matching file. The
+// old file moved aside for the replace is removed after it.
+static bool bench_atomic(void)
+{
+  bench_result_t res;
+  std::vector<uint8_t> old = bench_payload(3000, 51);
+  std::vector<uint8_t> data = bench_payload(50000, 52);
+
+  SD.nodes.clear();
+  File f = SD.open("keymacro.txt", FILE_WRITE);
+  f.write(old.data(), old.size());
+  f.close();
+  {
+    HostLink link;
+    XYmodem *rx = new XYmodem;
+    SimSender tx(&link, true, true, true);
+    tx.add_file("keymacro.txt", data);
+    rx->start_rb(&link, &SD, true, true);
+    while (!tx.failed() && link.sent < data.size() / 2) {
+      tx.poll();
+      rx->loop();
+    }
+    SD.power_cut();
+  }
+  bool ok = bench_check_file("keymacro.txt", old, false) && SD.exists("keymacro.tx$");
+
+  uint32_t bad = 0;
+  for (int z = 0; z < 2; z++) {
+    for (int good = 0; good < 2; good++) {
+      HostLink link;
+      XYmodem rx;
+      SimPeer *tx;
+      if (z) {
+        SimZSender *zs = new SimZSender(&link);
+        zs->add_file("keymacro.txt", data);
+        zs->bad_crc = !good;
+        tx = zs;
+        rx.start_rz(&link, &SD);
+      }
+      else {
+        SimSender *ys = new SimSender(&link, true, true, true);
+        ys->add_file("keymacro.txt", data);
+        ys->send_crc = true;
+        ys->bad_crc = !good;
+        tx = ys;
+        rx.start_rb(&link, &SD, true, true);
+      }
+      ok = bench_run(rx, link, *tx, &res) && ok;
+      ok = ok && bench_check_file("keymacro.txt", (good) ? data : old, false);
+      ok = ok && SD.exists("keymacro.tx$") == !good && !SD.exists("keymacro.tx!");
+      if (z) ok = ok && ((SimZSender *)tx)->crc_requests > 0;
+      delete tx;
+      bad += rx.stats().bad_digests;
+      if (good) {
+        // Back to the old file for the next round.
+        SD.remove("keymacro.txt");
+        File f = SD.open("keymacro.txt", FILE_WRITE);
+        f.write(old.data(), old.size());
+        f.close();
+      }
+    }
+  }
+  ok = ok && (!XYMODEM_STATS || bad == 2);
+  printf("atomic: power cut, CRC-32 mismatch and match, ymodem and zmodem: %s\n",
+      ok ? "ok" : "FAIL");
+  return ok;
+}
+#endif
+
+#if XYMODEM_ATOMIC
+// What moving a received file into place costs with the write costs the
+// caller set and reads of 200 us + 400 ns/byte: a rename, or the copy the
+// Arduino SD library needs, against writing the file in the first place.
+static bool bench_commit(size_t len)
+{
+  std::vector<uint8_t> data = bench_payload(len, 9);
+  XYfileSink sink(&SD);
+
+  SD.nodes.clear();
+  SD.read_call_us = 200;
+  SD.read_byte_ns = 400;
+  uint32_t t0 = micros();
+  bool ok = sink.open("commit.bin", len);
+  for (size_t i = 0; ok && i < len; i += 512) {
+    sink.write(data.data() + i, min(len - i, (size_t)512));
+  }
+  uint32_t t1 = micros();
+  sink.commit();
+  uint32_t t2 = micros();
+  SD.read_call_us = 0;
+  SD.read_byte_ns = 0;
+  ok = ok && bench_check_file("commit.bin", data, false) && !SD.exists("commit.bi$");
+  printf("atomic: %u bytes written in %.3fs, %s into place in %.3fs: %s\n", (unsigned)len,
+      (t1 - t0) / 1e6, (XYMODEM_FS_RENAME) ? "renamed" : "copied", (t2 - t1) / 1e6,
+      ok ? "ok" : "FAIL");
+  return ok;
+}
+#endif
+
+#if XYMODEM_SYNC
+// One sync run of the files in set at 115200. Returns the seconds it took.
+static double sync_run(const std::vector<SimFile> &set, bool zmodem, bool *ok,
+    uint32_t *received, uint32_t *skipped)
+{
+  HostLink link;
+  XYmodem rx;
+  bench_result_t res;
+  SimPeer *tx;
+
+  link.set_link(115200, 256);
+  link.set_turnaround(1000);
+  rx.set_sync(true);
+  if (zmodem) {
+    SimZSender *z = new SimZSender(&link);
+    for (const SimFile &f : set) z->add_file(f.name, f.data, f.mtime);
+    tx = z;
+    rx.start_rz(&link, &SD);
+  }
+  else {
+    SimSender *y = new SimSender(&link, true, true, true);
+    for (const SimFile &f : set) y->add_file(f.name, f.data, f.mtime);
+    y->send_crc = true;
+    tx = y;
+    rx.start_rb(&link, &SD, true, true);
+  }
+  *ok = bench_run(rx, link, *tx, &res) && *ok;
+  for (const SimFile &f : set) *ok = *ok && bench_check_file(f.name.c_str(), f.data, false);
+  *received = rx.stats().files;
+  *skipped = rx.stats().files_skipped;
+  if (zmodem) *ok = *ok && (!XYMODEM_STATS || ((SimZSender *)tx)->skipped == *skipped);
+  delete tx;
+  return res.virt_us / 1e6;
+}
+
+// A directory of 20 files sent again in sync mode after changing one, after
+// touching one and changing another of the same size, and after losing the
+// index. Only what changed should cross the link, and the index should
+// grow by at most an entry for each file recorded again.
+static bool bench_sync(void)
+{
+  std::vector<SimFile> set;
+  uint32_t received, skipped;
+  bool ok = true;
+
+  SD.nodes.clear();
+  for (int i = 0; i < 20; i++) {
+    char name[16];
+    snprintf(name, sizeof(name), "asset%02d.bin", i);
+    set.push_back(SimFile{name, bench_payload(8192, 60 + i), (uint32_t)(SIM_MTIME + i)});
+  }
+  double full = sync_run(set, true, &ok, &received, &skipped);
+  ok = ok && (!XYMODEM_STATS || (received == 20 && skipped == 0));
+  size_t index_size = SD.exists("XYSYNC.IDX") ? SD.nodes["XYSYNC.IDX"]->data.size() : 0;
+  ok = ok && index_size > 0;
+  printf("sync: zmodem 20 files, new: %u received, %u skipped, %.2fs\n",
+      (unsigned)received, (unsigned)skipped, full);
+
+  set[7].data = bench_payload(9000, 90);
+  set[7].mtime += 100;
+  double one = sync_run(set, true, &ok, &received, &skipped);
+  ok = ok && (!XYMODEM_STATS || (received == 1 && skipped == 19));
+  printf("sync: zmodem 20 files, 1 changed: %u received, %u skipped, %.2fs\n",
+      (unsigned)received, (unsigned)skipped, one);
+
+  // Same data with a new time is found by CRC-32, new data of the same
+  // size is not.
+  set[3].mtime += 100;
+  set[11].data = bench_payload(8192, 91);
+  set[11].mtime += 100;
+  double two = sync_run(set, true, &ok, &received, &skipped);
+  ok = ok && (!XYMODEM_STATS || (received == 1 && skipped == 19));
+  ok = ok && SD.nodes["XYSYNC.IDX"]->data.size() <= index_size + 3 * index_size / 20;
+  printf("sync: zmodem 20 files, 1 touched, 1 changed: %u received, %u skipped, %.2fs\n",
+      (unsigned)received, (unsigned)skipped, two);
+
+  // Without the index every file is compared by its CRC-32.
+  SD.remove("XYSYNC.IDX");
+  double lost = sync_run(set, true, &ok, &received, &skipped);
+  ok = ok && (!XYMODEM_STATS || (received == 0 && skipped == 20));
+  ok = ok && SD.exists("XYSYNC.IDX") && SD.nodes["XYSYNC.IDX"]->data.size() == index_size;
+  printf("sync: zmodem 20 files, index lost: %u received, %u skipped, %.2fs\n",
+      (unsigned)received, (unsigned)skipped, lost);
+
+  // YMODEM cannot skip, but the unchanged files are not written again.
+  uint32_t writes = SD.write_calls;
+  set[5].data = bench_payload(8192, 92);
+  double y = sync_run(set, false, &ok, &received, &skipped);
+  ok = ok && (!XYMODEM_STATS || (received == 1 && skipped == 19));
+  printf("sync: ymodem 20 files, 1 changed: %u received, %u skipped, %.2fs, %u writes\n",
+      (unsigned)received, (unsigned)skipped, y, (unsigned)(SD.write_calls - writes));
+
+  // One file changed on each of many runs. Compaction, renamed or copied
+  // back, keeps the index at most XYMODEM_SYNC_COMPACT entries.
+  size_t most = 0;
+  for (int run = 0; run < 2 * XYMODEM_SYNC_COMPACT; run++) {
+    set[run % 20].data = bench_payload(8192, 100 + run);
+    set[run % 20].mtime += 100;
+    sync_run(set, true, &ok, &received, &skipped);
+    most = max(most, SD.nodes["XYSYNC.IDX"]->data.size());
+  }
+  ok = ok && most <= XYMODEM_SYNC_COMPACT * (index_size / 20);
+  printf("sync: zmodem %d runs of 1 changed, index at most %u entries\n",
+      2 * XYMODEM_SYNC_COMPACT, (unsigned)(most / (index_size / 20)));
+
+  printf("sync: 1 changed file of 20 in %.1f%% of the time: %s\n", 100 * one / full,
+      ok ? "ok" : "FAIL");
+  return ok;
+}
+#endif
+
+// YMODEM at 1 Mbit/s losing a byte in the middle of a block every 64 KB.
+// Each loss costs one retransmit timeout, so the run should take about
+// drops * RTO longer than a clean one, with the RTO learned from the link
+// rather than the fixed 1 s.
+static bool bench_loss(size_t len, size_t every)
+{
+  uint32_t virt[2];
+  uint64_t drops = 0;
+  bool ok = true;
+  std::vector<uint8_t> data = bench_payload(len, 9);
+  xymodem_stats_t s;
+
+  for (int lossy = 0; lossy < 2; lossy++) {
+    HostLink link;
+    XYmodem rx;
+    bench_result_t res;
+    SD.nodes.clear();
+    link.set_link(1000000, 256);
+    link.set_turnaround(1000);
+    if (lossy) {
+      for (size_t at = every + 500; at < len; at += every) link.drop(at, 1);
+    }
+    SimSender tx(&link, true, true, true);
+    tx.add_file("loss.bin", data);
+    rx.start_rb(&link, &SD, true, true);
+    ok = ok && bench_run(rx, link, tx, &res) && bench_check_file("loss.bin", data, false);
+    virt[lossy] = res.virt_us;
+    drops = link.dropped;
+    s = rx.stats();
+  }
+  uint32_t per_drop = (drops) ? (virt[1] - virt[0]) / drops : 0;
+  ok = ok && drops > 0 && per_drop < 2 * XYMODEM_RTO_MIN * 1000;
+  printf("loss: %u bytes lost, %u ms each, srtt=%u us rttvar=%u us rto=%u ms: %s\n",
+      (unsigned)drops, (unsigned)(per_drop / 1000), (unsigned)s.srtt_us,
+      (unsigned)s.rttvar_us, (unsigned)s.rto_ms, ok ? "ok" : "FAIL");
+  return ok;
+}
+
+// Per file CRC-32 and length seen by the callback sink.
+typedef struct {
+  uint32_t crc[4];
+  uint32_t len[4];
+  int files;
+} sink_check_t;
+
+static bool sink_open(const char *name, uint32_t size, void *arg)
+{
+  sink_check_t *c = (sink_check_t *)arg;
+  (void)name;
+  (void)size;
+  if (c->files >= 4) return false;
+  c->crc[c->files] = c->len[c->files] = 0;
+  return true;
+}
+
+static void sink_write(const uint8_t *buf, uint16_t len, void *arg)
+{
+  sink_check_t *c = (sink_check_t *)arg;
+  c->crc[c->files] = xycrc32(c->crc[c->files], buf, len);
+  c->len[c->files] += len;
+}
+
+static void sink_close(bool complete, void *arg)
+{
+  sink_check_t *c = (sink_check_t *)arg;
+  if (complete) c->files++;
+}
+
+// Files received into RAM and through callbacks, with no file system at
+// all, must arrive intact and leave nothing on it.
+static bool bench_sinks(void)
+{
+  bench_result_t res;
+  std::vector<uint8_t> ram(100000);
+  XYramSink ramsink(ram.data(), ram.size());
+  std::vector<uint8_t> data = bench_payload(ram.size(), 11);
+
+  SD.nodes.clear();
+  HostLink link;
+  XYmodem rx;
+  rx.set_sink(&ramsink);
+  SimSender tx(&link, true, true, true);
+  tx.add_file("ram.bin", data);
+  rx.start_rb(&link, NULL, true, true);
+  bool ok = bench_run(rx, link, tx, &res) && ramsink.length() == data.size() &&
+    memcmp(ram.data(), data.data(), data.size()) == 0;
+  bench_print("ram", true, true, data.size(), &res, ok ? "XYramSink" : "FAIL");
+
+  // Too big for the buffer, refused after the header.
+  HostLink biglink;
+  SimSender bigtx(&biglink, true, true, true);
+  bigtx.add_file("big.bin", bench_payload(ram.size() + 1, 12));
+  rx.start_rb(&biglink, NULL, true, true);
+  bench_run(rx, biglink, bigtx, &res);
+  ok = ok && bigtx.failed() && res.frames == 1;
+
+  sink_check_t check = {};
+  XYcallbackSink cbsink(sink_open, sink_write, sink_close, &check);
+  std::vector<std::vector<uint8_t> > files;
+  HostLink zlink;
+  SimZSender ztx(&zlink);
+  for (int i = 0; i < 3; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "cb%d.bin", i);
+    files.push_back(bench_payload(20000 + i * 7777, 20 + i));
+    ztx.add_file(name, files.back());
+  }
+  rx.set_sink(&cbsink);
+  rx.start_rz(&zlink, NULL);
+  bool cbok = bench_run(rx, zlink, ztx, &res) && check.files == 3;
+  for (int i = 0; cbok && i < 3; i++) {
+    cbok = check.len[i] == files[i].size() &&
+      check.crc[i] == xycrc32(0, files[i].data(), files[i].size());
+  }
+  bench_print("callback", true, true, 20000 * 3 + 7777 * 3, &res,
+      cbok ? "XYcallbackSink, zmodem" : "FAIL");
+  ok = ok && cbok && SD.nodes.empty();
+  printf("sinks: %s\n", ok ? "ok" : "FAIL");
+  return ok;
+}
+
+#if XYMODEM_UNPACK
+// Key macro / JSON config style text.
+static std::vector<uint8_t> unpack_text(size_t len)
+{
+  static const char *words[] = {
+    "ctrl", "shift", "alt", "enter", "tab", "delay", "hello", "world",
+    "volume", "mute", "brightness", "layer", "macro", "repeat"
+  };
+  std::vector<uint8_t> out;
+  uint32_t seed = 5;
+  for (int n = 0; out.size() < len; n++) {
+    char line[128];
+    seed = seed * 1103515245 + 12345;
+    snprintf(line, sizeof(line),
+        "{\"key\": \"F%d\", \"mod\": \"%s\", \"delay\": %u, \"text\": \"%s %s\"},\n",
+        n % 24, words[(seed >> 16) % 3], (unsigned)((seed >> 8) % 500),
+        words[(seed >> 20) % 14], words[(seed >> 24) % 14]);
+    out.insert(out.end(), line, line + strlen(line));
+  }
+  out.resize(len);
+  return out;
+}
+
+// 8-bit PCM of notes: a square-ish tone held for a while at each of a few
+// pitches, with the volume stepping down through each note.
+static std::vector<uint8_t> unpack_pcm(size_t len)
+{
+  static const int periods[] = {20, 25, 32, 40, 18};
+  std::vector<uint8_t> out(len);
+  for (size_t i = 0; i < len; i++) {
+    int note = (i / 4000) % 5;
+    int period = periods[note];
+    int amp = 100 - (int)(i % 4000) / 50;
+    int phase = i % period;
+    int v = (phase < period / 4) ? amp : (phase < period / 2) ? amp / 2 :
+      (phase < 3 * period / 4) ? -amp / 2 : -amp;
+    out[i] = 128 + v;
+  }
+  return out;
+}
+
+// Send data raw as data.bin, then packed as data.bi_, at 115200 bit/s.
+// The packed run must leave the same data.bin and should take
+// about as much less time as the data got smaller.
+static bool bench_unpack(const char *kind, const std::vector<uint8_t> &data, bool zmodem)
+{
+  double secs[2];
+  size_t sent[2];
+  bool ok = true;
+
+  for (int packed = 0; packed < 2; packed++) {
+    HostLink link;
+    XYmodem rx;
+    bench_result_t res;
+    char last;
+    std::string name = (packed) ? xypack_name("data.bin", &last) : "data.bin";
+    std::vector<uint8_t> wire = (packed) ? xypack(data, last) : data;
+
+    SD.nodes.clear();
+    link.set_link(115200, 256);
+    link.set_turnaround(1000);
+    SimPeer *tx;
+    if (zmodem) {
+      SimZSender *z = new SimZSender(&link);
+      z->add_file(name, wire);
+      tx = z;
+      rx.start_rz(&link, &SD);
+    }
+    else {
+      SimSender *y = new SimSender(&link, true, true, true);
+      y->add_file(name, wire);
+      tx = y;
+      rx.start_rb(&link, &SD, true, true);
+    }
+    ok = bench_run(rx, link, *tx, &res) && bench_check_file("data.bin", data, false) &&
+      (!packed || SD.nodes.size() == 1) && ok;
+    delete tx;
+    secs[packed] = res.virt_us / 1e6;
+    sent[packed] = wire.size();
+    char note[80];
+    snprintf(note, sizeof(note), "%s%s %s, %zu bytes sent, %.0f bytes/s", ok ? "" : "FAIL ",
+        kind, (packed) ? "packed" : "raw", wire.size(), data.size() / secs[packed]);
+    bench_print((zmodem) ? "zmodem" : "ymodem", true, true, data.size(), &res, note);
+  }
+  printf("unpack: %s %.2fx smaller, %.2fx faster\n", kind,
+      (double)sent[0] / sent[1], secs[0] / secs[1]);
+  return ok;
+}
+
+// Packed by XMODEM, which pads the last block; names that look packed but
+// are not; and a window bigger than XYMODEM_UNPACK_WINDOW, which must be
+// refused.
+static bool bench_unpack_cases(void)
+{
+  bench_result_t res;
+  std::vector<uint8_t> text = unpack_text(5000);
+  bool ok = true;
+
+  SD.nodes.clear();
+  {
+    HostLink link;
+    XYmodem rx;
+    SimSender tx(&link, false, false, true);
+    tx.add_file("", xypack(text, 't'));
+    rx.start_rx(&link, "macro.tx_", false, true);
+    ok = bench_run(rx, link, tx, &res) && bench_check_file("macro.txt", text, false);
+  }
+  {
+    HostLink link;
+    XYmodem rx;
+    SimSender tx(&link, true, true, true);
+    std::vector<uint8_t> odd = bench_payload(3000, 31);
+    std::vector<uint8_t> tiny(text.begin(), text.begin() + 5);
+    tx.add_file("odd.da_", odd);
+    tx.add_file("tiny.t_", tiny);
+    tx.add_file("readme._", xypack(text, '\0'));
+    rx.start_rb(&link, &SD, true, true);
+    ok = bench_run(rx, link, tx, &res) && bench_check_file("odd.da_", odd, false) &&
+      bench_check_file("tiny.t_", tiny, false) && bench_check_file("readme", text, false) && ok;
+  }
+  SD.nodes.clear();
+  {
+    HostLink link;
+    XYmodem rx;
+    SimZSender tx(&link);
+    tx.add_file("wide.tx_", xypack(text, 't', XYMODEM_UNPACK_WINDOW + 1));
+    rx.start_rz(&link, &SD);
+    bench_run(rx, link, tx, &res);
+    ok = ok && tx.failed() && SD.nodes.empty();
+  }
+  printf("unpack: xmodem, not packed, too short, no extension, window too big: %s\n",
+      ok ? "ok" : "FAIL");
+  return ok;
+}
+#endif
+
+// Firmware image straight to raw flash at 1 Mbit/s, with erases running
+// ahead of the data or only when a page needs one. The image must read
+// back intact.
+static bool bench_flash(size_t len, bool zmodem, uint32_t ahead, uint32_t baud)
+{
+  HostLink link;
+  XYmodem rx;
+  bench_result_t res;
+  HostFlash chip(2 * 1024 * 1024);
+  XYflashSink sink(&chip, 1024 * 1024, 1024 * 1024, ahead);
+  std::vector<uint8_t> data = bench_payload(len, 13);
+
+  link.set_link(baud, 256);
+  link.set_turnaround(1000);
+  rx.set_sink(&sink);
+  SimPeer *tx;
+  if (zmodem) {
+    SimZSender *z = new SimZSender(&link);
+    z->add_file("fw.bin", data);
+    tx = z;
+    rx.start_rz(&link, NULL);
+  }
+  else {
+    SimSender *y = new SimSender(&link, true, true, true);
+    y->add_file("fw.bin", data);
+    tx = y;
+    rx.start_rb(&link, NULL, true, true);
+  }
+  bool ok = bench_run(rx, link, *tx, &res) && sink.length() == len &&
+    memcmp(&chip.mem[1024 * 1024], data.data(), len) == 0;
+  delete tx;
+  char note[80];
+  snprintf(note, sizeof(note), "%sraw flash, erase ahead %u, %u erases, %.3fs waiting",
+      ok ? "" : "FAIL ", (unsigned)ahead, (unsigned)chip.erases, chip.wait_us / 1e6);
+  bench_print((zmodem) ? "zmodem" : "ymodem", true, true, len, &res, note);
+  bench_print_stats(rx.stats());
+  return ok;
+}
+
+// XYmodemStatic receives into its own buffers and refuses modes they are
+// too small for.
+static bool bench_static(void)
+{
+  HostLink link;
+  XYmodemStatic<1024> rx1k;
+  XYmodemStatic<128, false> rx128;
+  bench_result_t res;
+  std::vector<uint8_t> data = bench_payload(100000, 3);
+
+  SD.nodes.clear();
+  SimSender tx(&link, true, true, true);
+  tx.add_file("static.bin", data);
+  rx1k.start_rb(&link, &SD);
+  bool ok = bench_run(rx1k, link, tx, &res) && bench_check_file("static.bin", data, false);
+  bench_print("static", true, true, data.size(), &res, ok ? "XYmodemStatic<1024>" : "FAIL");
+
+  HostLink link128;
+  SimSender tx128(&link128, false, false, false);
+  tx128.add_file("", data);
+  ok = ok && rx128.start_rx(&link128, "static128.bin") == 0 &&
+    bench_run(rx128, link128, tx128, &res) && bench_check_file("static128.bin", data, true);
+  ok = ok && rx128.start_rz(&link128, &SD) != 0 && rx128.start_rb(&link128, &SD, true, true) != 0;
+  bench_print("static", false, false, data.size(), &res,
+      ok ? "XYmodemStatic<128, false>" : "FAIL");
+  return ok;
+}
+
+// Print to a stdio file, for trace_dump().
+class FilePrint : public Print {
+  public:
+    FilePrint(FILE *f) : f(f) {}
+    size_t write(uint8_t c) { return fputc(c, f) != EOF; }
+    using Print::write;
+  private:
+    FILE *f;
+};
+
+// Short YMODEM transfer with its trace written to path for xytrace.
+static bool bench_trace(const char *path)
+{
+  HostLink link;
+  XYmodem rx;
+  bench_result_t res;
+  std::vector<uint8_t> data = bench_payload(3000, 5);
+
+  SD.nodes.clear();
+  link.set_link(1000000, 256);
+  link.set_turnaround(1000);
+  SimSender tx(&link, true, true, true);
+  tx.add_file("trace.bin", data);
+  rx.start_rb(&link, &SD, true, true);
+  bool ok = bench_run(rx, link, tx, &res) && bench_check_file("trace.bin", data, false);
+  FILE *f = fopen(path, "w");
+  if (f == NULL) return false;
+  FilePrint out(f);
+  rx.trace_dump(&out);
+  fclose(f);
+  return ok;
+}
+
+#if XYMODEM_PREALLOCATE
+// A file that does not fit must be refused right after its header,
+// before any data is sent.
+static bool bench_full_target(void)
+{
+  HostLink link;
+  XYmodem rx;
+  bench_result_t res;
+
+  SD.nodes.clear();
+  SD.seek_extends = true;
+  SD.capacity = 16384;
+  SimSender tx(&link, true, true, true);
+  tx.add_file("big.bin", bench_payload(65536, 1));
+  rx.start_rb(&link, &SD, true, true);
+  bench_run(rx, link, tx, &res);
+  bool ok = tx.failed() && res.frames == 1 && !SD.exists("big.bin");
+  printf("full target: %s after %u frames\n", ok ? "refused" : "FAIL", (unsigned)res.frames);
+  SD.seek_extends = false;
+  SD.capacity = 0;
+  return ok;
+}
+#endif
+
+#if XYMODEM_BATCH
+// A batch of small files into a directory that already holds 100 others,
+// with or without set_batch(). files/s is files per second of link time.
+static bool bench_batch(int nfiles, size_t len, bool zmodem, bool batch, double *rate)
+{
+  HostLink link;
+  XYmodem rx;
+  bench_result_t res;
+  std::vector<std::vector<uint8_t> > data;
+  char name[32];
+
+  SD.nodes.clear();
+  for (int i = 0; i < 100; i++) {
+    snprintf(name, sizeof(name), "old%d.dat", i);
+    File f = SD.open(name, FILE_WRITE);
+    f.write(bench_payload(200, i).data(), 200);
+    f.close();
+  }
+  link.set_link(1000000, 256);
+  link.set_turnaround(1000);
+  SimPeer *tx;
+  SimSender *y = NULL;
+  SimZSender *z = NULL;
+  if (zmodem) tx = z = new SimZSender(&link);
+  else tx = y = new SimSender(&link, true, true, true);
+  for (int i = 0; i < nfiles; i++) {
+    snprintf(name, sizeof(name), "cfg%d.jsn", i);
+    data.push_back(bench_payload(len, 500 + i));
+    if (zmodem) z->add_file(name, data.back());
+    else y->add_file(name, data.back());
+  }
+  SD.lookups = SD.dir_updates = 0;
+  rx.set_batch(batch);
+  if (zmodem) rx.start_rz(&link, &SD);
+  else rx.start_rb(&link, &SD, true, true);
+  bool ok = bench_run(rx, link, *tx, &res);
+  uint32_t lookups = SD.lookups, updates = SD.dir_updates;
+  delete tx;
+  for (int i = 0; ok && i < nfiles; i++) {
+    snprintf(name, sizeof(name), "cfg%d.jsn", i);
+    ok = bench_check_file(name, data[i], false);
+    snprintf(name, sizeof(name), "cfg%d.js$", i);
+    ok = ok && !SD.exists(name);
+  }
+  ok = ok && !SD.exists(XYMODEM_JOURNAL);
+  *rate = nfiles / (res.virt_us / 1e6);
+  char note[80];
+  snprintf(note, sizeof(note), "%s%s, %.0f files/s, lookups=%u updates=%u", ok ? "" : "FAIL ",
+      (batch) ? "batch" : "single", *rate, (unsigned)lookups, (unsigned)updates);
+  bench_print((zmodem) ? "zmodem" : "ymodem", true, true, nfiles * len, &res, note);
+  return ok;
+}
+#endif
+
+// One file into the SPI flash FatFs model with loop() given a time budget
+// or a byte limit. Checks the file and notes the longest loop() call.
+static bool bench_budget(size_t len, bool zmodem, uint32_t budget_us, uint32_t max_bytes,
+    uint32_t *longest)
+{
+  HostLink link;
+  XYmodem rx;
+  bench_result_t res;
+  std::vector<uint8_t> data = bench_payload(len, 77);
+
+  SD.nodes.clear();
+  link.set_link(1000000, 256);
+  link.set_turnaround(1000);
+  SimPeer *tx;
+  if (zmodem) {
+    SimZSender *z = new SimZSender(&link);
+    z->add_file("budget.bin", data);
+    tx = z;
+  }
+  else {
+    SimSender *y = new SimSender(&link, true, true, true);
+    y->add_file("budget.bin", data);
+    tx = y;
+  }
+  if (zmodem) rx.start_rz(&link, &SD);
+  else rx.start_rb(&link, &SD, true, true);
+  bool ok = bench_run(rx, link, *tx, &res, budget_us, max_bytes);
+  delete tx;
+  ok = ok && bench_check_file("budget.bin", data, false);
+  *longest = res.loop_us_max;
+  char note[80];
+  snprintf(note, sizeof(note), "%sbudget=%uus max=%u longest=%uus %.0f bytes/s",
+      ok ? "" : "FAIL ", (unsigned)budget_us, (unsigned)max_bytes, (unsigned)res.loop_us_max,
+      len / (res.virt_us / 1e6));
+  bench_print((zmodem) ? "zmodem" : "ymodem", true, true, len, &res, note);
+  return ok;
+}
+
+#if XYMODEM_SEND
+// XYmodem sending to the lrzsz rx/rb model, nfiles files from a directory
+// if more than one. MB/s counts the CPU time in loop() including the
+// reads, link is the time on the wire back to the receiver.
+static bool bench_send(size_t len, bool ymodem, uint8_t start, uint32_t baud,
+    int nfiles = 1, bool nak_eot = false)
+{
+  HostLink link;
+  XYmodem tx;
+  bench_result_t res;
+  std::vector<std::vector<uint8_t> > data;
+  const char *path = (nfiles > 1) ? "outbox" : "outbox/file0.bin";
+
+  SD.nodes.clear();
+  SD.mkdir("outbox");
+  for (int i = 0; i < nfiles; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "outbox/file%d.bin", i);
+    data.push_back(bench_payload(len, len + i));
+    File f = SD.open(name, FILE_WRITE);
+    f.write(data.back().data(), len);
+    f.close();
+  }
+  link.set_link(baud, 256);
+  link.set_turnaround((baud) ? 1000 : 0);
+  SimReceiver rx(&link, ymodem, start);
+  rx.nak_eot = nak_eot;
+  bool ok = ((ymodem) ? tx.start_sb(&link, &SD, path) : tx.start_sx(&link, &SD, path)) == 0 &&
+    bench_run(tx, link, rx, &res) && rx.files.size() == (size_t)nfiles;
+  for (int i = 0; ok && i < nfiles; i++) {
+    const std::vector<uint8_t> &got = rx.files[i].data;
+    char name[32];
+    snprintf(name, sizeof(name), "file%d.bin", i);
+    // The directory may list the files in any order.
+    int j = 0;
+    while (j < nfiles && rx.files[j].name != name) j++;
+    if (ymodem) ok = (j < nfiles && rx.files[j].data == data[i]);
+    else ok = (got.size() >= len && memcmp(got.data(), data[i].data(), len) == 0);
+  }
+  if (baud) res.link_us = link.written * 10e6 / baud;
+  char note[64];
+  snprintf(note, sizeof(note), "%s%ssent=%u", ok ? "" : "FAIL ", nak_eot ? "NAK EOT " : "",
+      (unsigned)tx.stats().bytes_tx);
+  bench_print((start == 'G') ? "sb -g" : (ymodem) ? "sb" : "sx", start != NAK,
+      start != NAK, len * nfiles, &res, note);
+  return ok;
+}
+
+// A receiver giving up sends CAN CAN, here right behind a NAK. The sender
+// must stop at once, not drop the CANs with the replies it no longer needs.
+static bool bench_send_cancel(void)
+{
+  static const uint8_t cancel[] = {NAK, CAN, CAN};
+  HostLink link;
+  XYmodem tx;
+  std::vector<uint8_t> data = bench_payload(65536, 77);
+
+  SD.nodes.clear();
+  File f = SD.open("cancel.bin", FILE_WRITE);
+  f.write(data.data(), data.size());
+  f.close();
+  SimReceiver rx(&link, true, 'C');
+  bool ok = tx.start_sb(&link, &SD, "cancel.bin") == 0;
+  while (ok && link.written < 8192 && !rx.failed()) {
+    rx.poll();
+    tx.loop();
+  }
+  link.send(cancel, sizeof(cancel));
+  int state = 1;
+  for (int i = 0; i < 10 && state != 0; i++) state = tx.loop();
+  ok = ok && state == 0 && !rx.done() && (!XYMODEM_STATS || tx.stats().cans == 1);
+  printf("send: NAK then CAN CAN from the receiver: %s\n", ok ? "ok" : "FAIL");
+  return ok;
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+  static const size_t sizes[] = {1000, 32768, 100000, 1048576};
+  int failures = 0;
+
+  bench_print_header();
+  for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++) {
+    for (int use1k = 0; use1k < 2; use1k++) {
+      for (int useCRC = 0; useCRC < 2; useCRC++) {
+        if (!bench_xmodem(sizes[s], use1k, useCRC)) failures++;
+        if (!bench_ymodem(sizes[s], use1k, useCRC, 1)) failures++;
+      }
+    }
+  }
+  if (!bench_ymodem(4096, true, true, 20)) failures++;
+  if (!bench_ymodem(1048576, true, true, 1, 0, true)) failures++;
+  if (!bench_ymodem(4096, true, true, 20, 0, true)) failures++;
+  for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++) {
+    if (!bench_zmodem(sizes[s], 1)) failures++;
+  }
+  if (!bench_zmodem(4096, 20)) failures++;
+  if (!bench_static()) failures++;
+#if XYMODEM_PREALLOCATE
+  if (!bench_full_target()) failures++;
+#endif
+  if (!bench_loss(1048576, 65536)) failures++;
+  if (!bench_sinks()) failures++;
+#if XYMODEM_ATOMIC && XYMODEM_DIGEST
+  if (!bench_atomic()) failures++;
+#endif
+#if XYMODEM_SYNC
+  if (!bench_sync()) failures++;
+#endif
+#if XYMODEM_UNPACK
+  if (!bench_unpack_cases()) failures++;
+#endif
+#if XYMODEM_RESUME
+  if (!bench_resume(1048576, 600000, true)) failures++;
+  if (!bench_resume(1048576, 600000, false)) failures++;
+#endif
+
+  // Link utilisation at 1 Mbit/s with a 256 byte receive buffer, writing
+  // to SPI flash FatFs that takes about 3 ms per 1K block, 2 ms for every
+  // partially written 4K erase sector and 1 ms per cluster chain update.
+  // Replies take 1 ms to reach the sender, as over USB.
+  printf("\nXYMODEM_RX_BUFFERS=%d XYMODEM_WRITE_COALESCE=%d XYMODEM_PREALLOCATE=%d\n"
+      "1 Mbit/s link, simulated SPI flash\n",
+      XYMODEM_RX_BUFFERS, XYMODEM_WRITE_COALESCE, XYMODEM_PREALLOCATE);
+  bench_print_header();
+  SD.write_call_us = 500;
+  SD.write_byte_ns = 2700;
+  SD.rmw_sector = 4096;
+  SD.rmw_us = 2000;
+  SD.seek_extends = true;
+  SD.extend_us = 1000;
+  if (!bench_ymodem(262144, true, true, 1, 1000000)) failures++;
+  if (!bench_ymodem(262144, false, true, 1, 1000000)) failures++;
+  if (!bench_ymodem(262144, true, true, 1, 1000000, true)) failures++;
+  if (!bench_zmodem(262144, 1, 1000000)) failures++;
+#if XYMODEM_RESUME
+  if (!bench_resume(262144, 200000, true)) failures++;
+  if (!bench_resume(262144, 200000, false)) failures++;
+#endif
+#if XYMODEM_ATOMIC
+  if (!bench_commit(262144)) failures++;
+#endif
+  SD.write_call_us = 0;
+  SD.write_byte_ns = 0;
+  SD.rmw_sector = 0;
+  SD.seek_extends = false;
+  SD.extend_us = 0;
+
+  // Raw flash at 115200 and 1 Mbit/s. The chip model erases and programs
+  // in the background, so time the chip is busy only costs link time when
+  // the receive buffers fill up.
+  static const uint32_t bauds[] = {115200, 1000000};
+  for (int i = 0; i < 2; i++) {
+    printf("\n%u bit/s link, raw SPI flash\n", (unsigned)bauds[i]);
+    bench_print_header();
+    for (int z = 0; z < 2; z++) {
+      if (!bench_flash(262144, z, 65536, bauds[i])) failures++;
+      if (!bench_flash(262144, z, 0, bauds[i])) failures++;
+    }
+  }
+
+#if XYMODEM_UNPACK
+  // Compressible data at 115200 sent raw and packed. bytes/s is file
+  // bytes stored per second of link time.
+  printf("\n115200 bit/s link, packed with xypack\n");
+  bench_print_header();
+  for (int z = 0; z < 2; z++) {
+    if (!bench_unpack("text", unpack_text(65536), z)) failures++;
+    if (!bench_unpack("pcm", unpack_pcm(65536), z)) failures++;
+    if (!bench_unpack("random", bench_payload(65536, 41), z)) failures++;
+  }
+#endif
+
+#if XYMODEM_BATCH
+  // 200 small files at 1 Mbit/s into FatFs on SPI flash, where reading a
+  // directory entry takes 5 us and updating one, with the FAT, 4 ms. Batch
+  // mode gains about 2x on ZMODEM, less on YMODEM, which never journals
+  // small files.
+  printf("\n1 Mbit/s link, 200 files of 300 bytes, directory reads and updates cost\n");
+  bench_print_header();
+  SD.dir_entry_ns = 5000;
+  SD.dir_update_us = 4000;
+  for (int z = 0; z < 2; z++) {
+    double single, batch;
+    if (!bench_batch(200, 300, z, false, &single)) failures++;
+    if (!bench_batch(200, 300, z, true, &batch)) failures++;
+    printf("batch: %s %.2fx files/s\n", (z) ? "zmodem" : "ymodem", batch / single);
+  }
+  SD.dir_entry_ns = 0;
+  SD.dir_update_us = 0;
+#endif
+
+  // loop() sharing the CPU. Unlimited, each call may write several blocks
+  // to flash; with a budget the write stops at the first chunk past it
+  // and the rest waits for the next call.
+  printf("\n1 Mbit/s link, simulated SPI flash, loop() with a budget\n");
+  bench_print_header();
+  SD.write_call_us = 500;
+  SD.write_byte_ns = 2700;
+  for (int z = 0; z < 2; z++) {
+    uint32_t unlimited, timed, counted;
+    if (!bench_budget(262144, z, 0, 0, &unlimited)) failures++;
+    if (!bench_budget(262144, z, 2000, 0, &timed)) failures++;
+    if (!bench_budget(262144, z, 0, 256, &counted)) failures++;
+#if XYMODEM_FS_RENAME
+    // One chunk write is the most a call should go over its budget. A copy
+    // into place takes the one call it is made in.
+    if (timed > 2000 + 500 + XYMODEM_COMMIT_CHUNK * 2700 / 1000 + 1000) failures++;
+#endif
+  }
+  SD.write_call_us = 0;
+  SD.write_byte_ns = 0;
+
+#if XYMODEM_SEND
+  // Sending, from SD that takes 200 us per read and 400 ns per byte. With
+  // more than one receive buffer the next block is read while the last
+  // one waits for its ACK.
+  printf("\nSending, XYMODEM_RX_BUFFERS=%d, SD read 200 us + 400 ns/byte\n",
+      XYMODEM_RX_BUFFERS);
+  bench_print_header();
+  SD.read_call_us = 200;
+  SD.read_byte_ns = 400;
+  static const uint32_t send_bauds[] = {115200, 1000000, 12000000};
+  for (int i = 0; i < 3; i++) {
+    if (!bench_send(262144, false, 'C', send_bauds[i])) failures++;
+    if (!bench_send(262144, true, 'C', send_bauds[i])) failures++;
+    if (!bench_send(262144, true, 'G', send_bauds[i])) failures++;
+  }
+  if (!bench_send(32768, false, NAK, 115200)) failures++;
+  if (!bench_send(32768, true, NAK, 115200)) failures++;
+  if (!bench_send(4096, true, 'C', 1000000, 20, true)) failures++;
+  if (!bench_send(4096, true, 'G', 1000000, 20)) failures++;
+  if (!bench_send_cancel()) failures++;
+  if (!bench_send(1000, true, 'C', 0)) failures++;
+  SD.read_call_us = 0;
+  SD.read_byte_ns = 0;
+#endif
+
+  if (argc > 1 && !bench_trace(argv[1])) failures++;
+
+  printf("%d failures\n", failures);
+  return (failures) ? 1 : 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * PC end of an XYlink. Opens the board's serial port and gives each
+ * channel a pseudo terminal, so a terminal program can use the console on
+ * one while lrzsz sends or receives on another.
+ *
+ *   xylinkpty /dev/ttyACM0 [prefix]
+ *
+ * Channel n appears as prefix<n>, /tmp/xylink0, /tmp/xylink1, ... by
+ * default, a symlink to the pseudo terminal. For fatfscli built with
+ * CLI_LINK:
+ *
+ *   minicom -p /tmp/xylink0
+ *   sb file.bin < /tmp/xylink1 > /tmp/xylink1
+ *
+ * Uses the library's XYlink with the host stand-ins, with their clock kept
+ * in step with the real one.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <xymodem.h>
+
+// The serial port as a Stream.
+class FdStream : public Stream {
+  public:
+    FdStream(int fd) : fd(fd) {}
+    int available() {
+      int n = 0;
+      return (ioctl(fd, FIONREAD, &n) == 0) ? n : 0;
+    }
+    int read() {
+      uint8_t c;
+      return (::read(fd, &c, 1) == 1) ? c : -1;
+    }
+    int peek() { return -1; }
+    size_t readBytes(char *buffer, size_t length) {
+      ssize_t n = ::read(fd, buffer, length);
+      return (n > 0) ? n : 0;
+    }
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) {
+      size_t done = 0;
+      while (done < size) {
+        ssize_t n = ::write(fd, buffer + done, size - done);
+        if (n < 0 && errno != EAGAIN && errno != EINTR) break;
+        if (n > 0) done += n;
+      }
+      return done;
+    }
+    using Print::write;
+
+  private:
+    int fd;
+};
+
+static void sync_clock(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  host_set_micros((uint32_t)(ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000));
+}
+
+static int open_port(const char *path)
+{
+  int fd = open(path, O_RDWR | O_NOCTTY);
+  if (fd < 0) return -1;
+  struct termios t;
+  if (tcgetattr(fd, &t) == 0) {
+    cfmakeraw(&t);
+    t.c_cc[VMIN] = 0;
+    t.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &t);
+  }
+  return fd;
+}
+
+static int open_pty(const char *link)
+{
+  int fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) return -1;
+  struct termios t;
+  if (tcgetattr(fd, &t) == 0) {
+    cfmakeraw(&t);
+    tcsetattr(fd, TCSANOW, &t);
+  }
+  // Hold the other side open so the pty does not hang up between users.
+  if (open(ptsname(fd), O_RDWR | O_NOCTTY) < 0) return -1;
+  unlink(link);
+  if (symlink(ptsname(fd), link) != 0) return -1;
+  printf("%s -> %s\n", link, ptsname(fd));
+  return fd;
+}
+
+int main(int argc, char *argv[])
+{
+  static XYlink link;
+  int pty[XYMODEM_LINK_CHANNELS];
+  char name[XYMODEM_LINK_CHANNELS][64];
+  uint8_t buf[256];
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: xylinkpty <serial port> [prefix]\n");
+    return 2;
+  }
+  const char *prefix = (argc > 2) ? argv[2] : "/tmp/xylink";
+  int fd = open_port(argv[1]);
+  if (fd < 0) {
+    perror(argv[1]);
+    return 1;
+  }
+  for (int i = 0; i < XYMODEM_LINK_CHANNELS; i++) {
+    snprintf(name[i], sizeof(name[i]), "%s%d", prefix, i);
+    if ((pty[i] = open_pty(name[i])) < 0) {
+      perror(name[i]);
+      return 1;
+    }
+  }
+  FdStream port(fd);
+  sync_clock();
+  link.begin(&port);
+
+  for (;;) {
+    struct pollfd pfd[XYMODEM_LINK_CHANNELS + 1];
+    // Only read a channel's pty when there is room to take what it says.
+    for (int i = 0; i < XYMODEM_LINK_CHANNELS; i++) {
+      pfd[i].fd = pty[i];
+      pfd[i].events = (link.channel(i)->availableForWrite() > 0) ? POLLIN : 0;
+    }
+    pfd[XYMODEM_LINK_CHANNELS].fd = fd;
+    pfd[XYMODEM_LINK_CHANNELS].events = POLLIN;
+    // Wake up now and then for credit refreshes.
+    poll(pfd, XYMODEM_LINK_CHANNELS + 1, 50);
+    sync_clock();
+    for (int i = 0; i < XYMODEM_LINK_CHANNELS; i++) {
+      XYchannel *c = link.channel(i);
+      if (pfd[i].revents & POLLIN) {
+        ssize_t n = read(pty[i], buf, min((int)sizeof(buf), c->availableForWrite()));
+        if (n > 0) c->write(buf, n);
+      }
+    }
+    link.poll();
+    for (int i = 0; i < XYMODEM_LINK_CHANNELS; i++) {
+      XYchannel *c = link.channel(i);
+      size_t n;
+      while ((n = c->readBytes((char *)buf, sizeof(buf))) > 0) {
+        // Nobody is reading the pty. Drop it rather than stall the link.
+        if (write(pty[i], buf, n) < 0 && errno == EAGAIN) break;
+      }
+    }
+    link.poll();
+  }
+  return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * LZSS packer, the other half of xyunpack.cpp. Greedy longest match found
+ * through hash chains on the next two bytes. A match is used when it
+ * takes fewer bits than the literals it replaces.
+ */
+
+#include "xylzss.h"
+
+std::string xypack_name(const std::string &name, char *last)
+{
+  size_t dot = name.rfind('.');
+  size_t slash = name.rfind('/');
+  if (dot != std::string::npos && (slash == std::string::npos || dot > slash) &&
+      dot + 1 < name.size() && name.size() - dot <= 4) {
+    *last = name[name.size() - 1];
+    return name.substr(0, name.size() - 1) + "_";
+  }
+  *last = '\0';
+  return name + "._";
+}
+
+class BitWriter {
+  public:
+    BitWriter(std::vector<uint8_t> *out) : out(out) {}
+    void put(uint32_t v, unsigned n) {
+      while (n-- > 0) {
+        acc = (acc << 1) | ((v >> n) & 1);
+        if (++bits == 8) {
+          out->push_back(acc);
+          acc = 0;
+          bits = 0;
+        }
+      }
+    }
+    void flush(void) { if (bits > 0) put(0, 8 - bits); }
+  private:
+    std::vector<uint8_t> *out;
+    uint8_t acc = 0;
+    unsigned bits = 0;
+};
+
+std::vector<uint8_t> xypack(const std::vector<uint8_t> &data, char last,
+    unsigned wbits, unsigned lbits)
+{
+  const size_t window = (size_t)1 << wbits;
+  const size_t max_len = (size_t)1 << lbits;
+  const unsigned ref_bits = 1 + wbits + lbits;
+  const size_t min_len = ref_bits / 9 + 1;
+  std::vector<uint8_t> out;
+  uint32_t size = data.size();
+
+  out.push_back('X');
+  out.push_back('Y');
+  out.push_back('Z');
+  out.push_back(wbits << 4 | lbits);
+  out.push_back(last);
+  for (int i = 0; i < 4; i++) out.push_back(size >> (8 * i));
+
+  std::vector<int32_t> head(65536, -1);
+  std::vector<int32_t> prev(data.size(), -1);
+  BitWriter bw(&out);
+  size_t i = 0;
+  while (i < data.size()) {
+    size_t best_len = 0, best_dist = 0;
+    if (i + 1 < data.size()) {
+      int steps = 256;
+      for (int32_t j = head[data[i] << 8 | data[i + 1]];
+          j >= 0 && i - j <= window && steps-- > 0; j = prev[j]) {
+        size_t n = 0;
+        while (n < max_len && i + n < data.size() && data[j + n] == data[i + n]) n++;
+        if (n > best_len) {
+          best_len = n;
+          best_dist = i - j;
+          if (n == max_len) break;
+        }
+      }
+    }
+    size_t step = 1;
+    if (best_len >= min_len) {
+      bw.put(0, 1);
+      bw.put(best_dist - 1, wbits);
+      bw.put(best_len - 1, lbits);
+      step = best_len;
+    }
+    else {
+      bw.put(1, 1);
+      bw.put(data[i], 8);
+    }
+    for (; step > 0; step--, i++) {
+      if (i + 1 < data.size()) {
+        uint16_t key = data[i] << 8 | data[i + 1];
+        prev[i] = head[key];
+        head[key] = i;
+      }
+    }
+  }
+  bw.flush();
+  return out;
+}
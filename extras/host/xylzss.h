@@ -0,0 +1,24 @@
+/*
+ * LZSS packer for files the receiver expands as they arrive, see
+ * xyunpack.cpp for the format. Used by the xypack tool and the benchmarks.
+ */
+
+#ifndef _XYLZSS_H_
+#define _XYLZSS_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Name a packed file is sent under: the last character becomes '_', or
+// "._" is added if the name has no extension. *last gets the character
+// replaced, '\0' if "._" was added.
+std::string xypack_name(const std::string &name, char *last);
+
+// Pack data with a window of 1 << wbits bytes and matches of up to
+// 1 << lbits bytes. wbits must not exceed the receiver's
+// XYMODEM_UNPACK_WINDOW.
+std::vector<uint8_t> xypack(const std::vector<uint8_t> &data, char last,
+    unsigned wbits = 10, unsigned lbits = 4);
+
+#endif /* _XYLZSS_H_ */
@@ -0,0 +1,69 @@
+/*
+ * Pack files for XYMODEM_UNPACK receivers.
+ *
+ *   xypack [-w bits] [-l bits] file...
+ *
+ * Writes each file next to itself under its packed name, e.g. KEYMACRO.TXT
+ * to KEYMACRO.TX_, and prints how much smaller it got. Send the packed
+ * file with any X/Y/ZMODEM sender, it is stored as KEYMACRO.TXT. -w sets
+ * the window bits (default 10, at most the receiver's
+ * XYMODEM_UNPACK_WINDOW), -l the match length bits (default 4).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "xylzss.h"
+
+int main(int argc, char *argv[])
+{
+  unsigned wbits = 10, lbits = 4;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "w:l:")) != -1) {
+    switch (opt) {
+      case 'w': wbits = atoi(optarg); break;
+      case 'l': lbits = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: xypack [-w bits] [-l bits] file...\n");
+        return 2;
+    }
+  }
+  if (wbits < 4 || wbits > 14 || lbits < 1 || lbits > 8 || lbits >= wbits) {
+    fprintf(stderr, "xypack: need 4 <= -w <= 14 and 1 <= -l <= 8, -l < -w\n");
+    return 2;
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "usage: xypack [-w bits] [-l bits] file...\n");
+    return 2;
+  }
+  for (int i = optind; i < argc; i++) {
+    FILE *f = fopen(argv[i], "rb");
+    if (f == NULL) {
+      perror(argv[i]);
+      return 1;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) data.insert(data.end(), buf, buf + n);
+    fclose(f);
+
+    char last;
+    std::string name = xypack_name(argv[i], &last);
+    std::vector<uint8_t> packed = xypack(data, last, wbits, lbits);
+    f = fopen(name.c_str(), "wb");
+    if (f == NULL || fwrite(packed.data(), 1, packed.size(), f) != packed.size() ||
+        fclose(f) != 0) {
+      perror(name.c_str());
+      return 1;
+    }
+    printf("%s -> %s %zu -> %zu bytes (%.2fx)\n", argv[i], name.c_str(),
+        data.size(), packed.size(), packed.size() ? (double)data.size() / packed.size() : 0.0);
+    if (packed.size() >= data.size()) {
+      printf("%s does not pack, send it as it is\n", argv[i]);
+    }
+  }
+  return 0;
+}
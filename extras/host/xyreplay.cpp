@@ -0,0 +1,92 @@
+/*
+ * Play a capture made with XYcapture, e.g. by fatfscli's record command,
+ * back through the receiver built for the host.
+ *
+ *   xyreplay [-r] [-f] capture
+ *
+ *   -r   take as long as the session did, rather than skip the waiting
+ *   -f   charge file writes what xybench's SPI flash model does
+ *
+ * The receiver mode comes from the capture. Prints how long the session
+ * took then and now, whether the receiver answered with the same bytes
+ * and how far its answers moved in time, where loop() spent its time, and
+ * the files written. With the same library and file system costs a replay
+ * is the session again, so one that is slow on a board can be profiled,
+ * e.g. under perf, and kept as a benchmark. Exits with 1 if the answers
+ * differ from the capture's.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <xymodem.h>
+#include <xycrc.h>
+#include "benchutil.h"
+#include "replaylink.h"
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: xyreplay [-r] [-f] capture\n");
+  exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+  static XYmodem rx;
+  ReplayLink link;
+  bench_result_t res;
+  bool realtime = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "rf")) != -1) {
+    switch (opt) {
+      case 'r': realtime = true; break;
+      case 'f':
+        SD.write_call_us = 500;
+        SD.write_byte_ns = 2700;
+        break;
+      default: usage();
+    }
+  }
+  if (optind >= argc) usage();
+  if (!link.load(argv[optind])) {
+    fprintf(stderr, "%s: not a capture\n", argv[optind]);
+    return 2;
+  }
+  bool crc;
+  char mode = link.mode(&crc);
+  static const char *names[] = {"XMODEM", "YMODEM", "YMODEM-G", "ZMODEM"};
+  const char *name = names[(mode == 'x') ? 0 : (mode == 'y') ? 1 : (mode == 'g') ? 2 : 3];
+  printf("%s: %s%s, %zu bytes in, %zu out, %.3fs\n", argv[optind], name,
+      (mode == 'x' || mode == 'y') ? (crc ? " CRC" : " checksum") : "",
+      link.in_bytes(), link.out_bytes(), link.duration_us() / 1e6);
+
+  link.start();
+  switch (mode) {
+    case 'x': rx.start_rx(&link, "xmodem.bin", true, crc); break;
+    case 'y': rx.start_rb(&link, &SD, true, crc); break;
+    case 'g': rx.start_rg(&link, &SD); break;
+    case 'z': rx.start_rz(&link, &SD); break;
+  }
+  bool done = replay_run(rx, link, realtime, &res);
+
+  printf("replayed in %.3fs%s, %.3fs wall\n", res.virt_us / 1e6,
+      done ? "" : " (capture ran out)", res.wall);
+  if (link.diverged < 0) {
+    printf("answers match, up to %.3f ms late, %.3f ms early\n",
+        link.late_us / 1000.0, link.early_us / 1000.0);
+  }
+  else {
+    printf("answers differ from byte %lld of %zu\n", (long long)link.diverged, link.out_bytes());
+  }
+  printf("loop() %.3fs cpu, %.0f cycles per byte in, longest %u us\n", res.seconds,
+      link.in_bytes() ? (double)res.cycles / link.in_bytes() : 0.0, (unsigned)res.loop_us_max);
+  bench_print_stats(rx.stats());
+  for (auto &n : SD.nodes) {
+    if (n.second->dir || n.first == SDClass::normalize(XYMODEM_JOURNAL)) continue;
+    printf("%-24s %9zu crc32 %08x\n", n.first.c_str(), n.second->data.size(),
+        (unsigned)xycrc32(0, n.second->data.data(), n.second->data.size()));
+  }
+  // Answers past the end of a capture that was cut off are expected.
+  return (link.diverged >= 0 && (size_t)link.diverged < link.out_bytes()) ? 1 : 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * Decode a trace written by XYmodem::trace_dump() into a timeline.
+ *
+ *   xytrace [dumpfile]      reads stdin without a file name
+ *
+ * Capture the dump from fatfscli's trace command with any terminal logger.
+ * Lines before the XYTRACE header are ignored.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <xymodem.h>
+#include <zmodem.h>
+
+static const char *state_name(uint8_t s)
+{
+  static const char *names[] = {
+    "IDLE", "BLOCKSTART", "BLOCKNUM", "BLOCKCHECK", "DATABLOCK",
+    "DATACHECK", "DATACHECKCRC", "DATAPURGE", "ZMODEM", "SEND"
+  };
+  return (s < sizeof(names)/sizeof(names[0])) ? names[s] : "?";
+}
+
+static const char *zframe_name(uint8_t t)
+{
+  static const char *names[] = {
+    "ZRQINIT", "ZRINIT", "ZSINIT", "ZACK", "ZFILE", "ZSKIP", "ZNAK",
+    "ZABORT", "ZFIN", "ZRPOS", "ZDATA", "ZEOF", "ZFERR", "ZCRC",
+    "ZCHALLENGE", "ZCOMPL", "ZCAN", "ZFREECNT", "ZCOMMAND", "ZSTDERR"
+  };
+  return (t < sizeof(names)/sizeof(names[0])) ? names[t] : "?";
+}
+
+static const char *zend_name(uint8_t e)
+{
+  switch (e) {
+    case ZCRCE: return "ZCRCE";
+    case ZCRCG: return "ZCRCG";
+    case ZCRCQ: return "ZCRCQ";
+    case ZCRCW: return "ZCRCW";
+  }
+  return "?";
+}
+
+static const char *reply_name(uint8_t r)
+{
+  static char buf[8];
+  switch (r) {
+    case NAK: return "NAK";
+    case CAN: return "CAN";
+    case 0: return "-";
+  }
+  snprintf(buf, sizeof(buf), "'%c'", r);
+  return buf;
+}
+
+static void decode(uint8_t ev, uint8_t a, uint16_t b)
+{
+  static const char *modes[] = {
+    "XMODEM", "YMODEM", "YMODEM-G", "ZMODEM", "XMODEM send", "YMODEM send"
+  };
+  switch (ev) {
+    case XYT_START:   printf("START %s, %u byte blocks", (a < 6) ? modes[a] : "?", b); break;
+    case XYT_STATE:   printf("state %s -> %s", state_name(b), state_name(a)); break;
+    case XYT_BLOCK:   printf("block %u ok, %u bytes", a, b); break;
+    case XYT_BADCHK:  printf("block %u bad %s", a, (b) ? "block number" : "check"); break;
+    case XYT_DUP:     printf("block %u duplicate", a); break;
+    case XYT_SEQ:     printf("block %u out of sequence, expected %u", a, b); break;
+    case XYT_TIMEOUT: printf("TIMEOUT, sent %s", reply_name(a)); break;
+    case XYT_CAN:     printf("CANCEL %s", (a) ? "by sender" : "sent"); break;
+    case XYT_EOT:     printf("EOT"); break;
+    case XYT_OPEN:    printf("%s file, %u KB%s", (a == 3) ? "skip unchanged" : "open", b,
+                          (a == 2) ? ", unpacking" : (a == 1) ? ", resumed" : ""); break;
+    case XYT_CLOSE:   printf("close file%s", (a == 2) ? ", CRC-32 mismatch" : (a) ? "" : ", incomplete"); break;
+    case XYT_WRITE:   printf("write %u bytes, %s%u us", b, (a == 255) ? ">=" : "~", a * 64); break;
+    case XYT_ZHDR:    printf("header %s pos ...%04x", zframe_name(a), b); break;
+    case XYT_ZDATA:   printf("subpacket %s, %u bytes", zend_name(a), b); break;
+    case XYT_ZRPOS:   printf("send ZRPOS %u", (unsigned)a << 16 | b); break;
+    case XYT_RTO:     printf("timeout now %u ms%s", b, (a) ? ", backed off" : ""); break;
+    case XYT_NAK:     printf("block %u NAKed, sent again", a); break;
+    default:          printf("event %u %02x %04x", ev, a, b); break;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  FILE *in = stdin;
+  char line[128];
+  bool started = false;
+  uint32_t first = 0, last = 0;
+  int entries = 0;
+
+  if (argc > 1 && (in = fopen(argv[1], "r")) == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+  while (fgets(line, sizeof(line), in) != NULL) {
+    unsigned us, ev, a, b;
+    if (!started) {
+      started = (strncmp(line, "XYTRACE", 7) == 0);
+      continue;
+    }
+    if (sscanf(line, "%8x %2x %2x %4x", &us, &ev, &a, &b) != 4) break;
+    if (entries++ == 0) first = last = us;
+    printf("%12.6f %+9d  ", (uint32_t)(us - first) / 1e6, (int)(us - last));
+    decode(ev, a, b);
+    printf("\n");
+    last = us;
+  }
+  if (!started) {
+    fprintf(stderr, "no XYTRACE header\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,238 @@
+/*
+MIT License
+
+Copyright (c) 2018 gdsports625@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+/*
+ * Port capture, see XYcapture in xycapture.h.
+ *
+ * After XYCAPTURE_MAGIC come records. A record is a head byte, a time in
+ * microseconds, and 1 to 127 bytes. The head byte's top bit is set for
+ * bytes written to the port, clear for bytes read from it, and the low 7
+ * bits are the byte count less one. The time is 7 bits per byte, low bits
+ * first, the top bit set on all but the last, so most take one or two
+ * bytes. It counts from the last record going the same way, or from
+ * begin() for the first. Each way's times only go forward, but a byte read
+ * may have been seen before the last byte written.
+ *
+ * Bytes going the same way with the same time are added to the last
+ * record, so a 1K block that arrived in one go costs 9 head bytes.
+ *
+ * A head byte of XYCAPTURE_STALL, with no bytes after its time, says the
+ * capture spent that long writing itself to the file in the call that
+ * moved the first byte of the next record. It does not move either clock.
+ * A replay stalls as long at the same byte, so the file writes do not
+ * shift its timing.
+ */
+
+#include <Arduino.h>
+#include <xymodem.h>
+
+// Head byte, the longest time and one byte
+#define XYCAPTURE_RECORD_MIN 7
+// Head byte and the longest time
+#define XYCAPTURE_STALL_LEN 6
+
+void XYcapture::start(Stream *port, uint8_t *buf, size_t size)
+{
+  this->port = port;
+  this->buf = buf;
+  this->size = size;
+  memcpy(buf, XYCAPTURE_MAGIC, 4);
+  len = 4;
+  head = -1;
+  bytes_in = bytes_out = dropped = 0;
+  reads = 0;
+  seen_n = 0;
+  last_us[0] = last_us[1] = micros();
+  on = size >= XYCAPTURE_STALL_LEN + XYCAPTURE_RECORD_MIN;
+}
+
+void XYcapture::begin(Stream *port, uint8_t *buf, size_t size)
+{
+  to_file = false;
+  start(port, buf, size);
+}
+
+void XYcapture::begin(Stream *port, File file, uint8_t *buf, size_t size)
+{
+  this->file = file;
+  to_file = true;
+  start(port, buf, size);
+}
+
+void XYcapture::end(void)
+{
+  if (to_file) {
+    if (on) spill();
+    file.close();
+    to_file = false;
+  }
+  on = false;
+}
+
+int XYcapture::available(void)
+{
+  int n = port->available();
+  seen(n);
+  return n;
+}
+
+int XYcapture::peek(void)
+{
+  int c = port->peek();
+  if (c >= 0) seen(1);
+  return c;
+}
+
+int XYcapture::read(void)
+{
+  int c = port->read();
+  if (c >= 0) {
+    uint8_t b = c;
+    record_in(&b, 1);
+  }
+  return c;
+}
+
+size_t XYcapture::readBytes(char *buffer, size_t length)
+{
+  size_t n = port->readBytes(buffer, length);
+  record_in((const uint8_t *)buffer, n);
+  return n;
+}
+
+size_t XYcapture::write(const uint8_t *buffer, size_t size)
+{
+  size_t n = port->write(buffer, size);
+  if (on) {
+    bytes_out += n;
+    record(0x80, micros(), buffer, n);
+  }
+  return n;
+}
+
+/*
+ * The port has n bytes waiting. Note the time for any not noted before.
+ */
+void XYcapture::seen(int n)
+{
+  if (!on || n <= 0) return;
+  uint32_t to = reads + n;
+  uint32_t known = (seen_n > 0) ? seen_to[seen_n - 1] : reads;
+  if ((int32_t)(to - known) <= 0) return;
+  if (seen_n == XYCAPTURE_SEEN) seen_n--;
+  seen_us[seen_n] = micros();
+  seen_to[seen_n] = to;
+  seen_n++;
+}
+
+/*
+ * n bytes read, timed from when they were seen, or now if they were not.
+ */
+void XYcapture::record_in(const uint8_t *p, size_t n)
+{
+  if (!on) return;
+  bytes_in += n;
+  while (n > 0 && on) {
+    size_t k = n;
+    uint32_t us = micros();
+    if (seen_n > 0) {
+      k = min(n, (size_t)(seen_to[0] - reads));
+      us = seen_us[0];
+    }
+    record(0, us, p, k);
+    reads += k;
+    p += k;
+    n -= k;
+    if (seen_n > 0 && reads == seen_to[0]) {
+      seen_n--;
+      memmove(seen_us, seen_us + 1, seen_n * sizeof(seen_us[0]));
+      memmove(seen_to, seen_to + 1, seen_n * sizeof(seen_to[0]));
+    }
+  }
+}
+
+void XYcapture::record(uint8_t out, uint32_t us, const uint8_t *p, size_t n)
+{
+  uint32_t &last = last_us[out >> 7];
+
+  while (n > 0) {
+    size_t k = 0;
+    if (head >= 0 && us == last && (buf[head] & 0x80) == out) {
+      k = min(min(n, (size_t)(0x7E - (buf[head] & 0x7F))), size - len);
+      buf[head] += k;
+    }
+    if (k == 0) {
+      if (size - len < XYCAPTURE_RECORD_MIN) {
+        uint32_t spill_us = micros();
+        if (!spill()) {
+          // Full. Keep what there is rather than leave a gap in it.
+          if (out) bytes_out -= n; else bytes_in -= n;
+          dropped += n;
+          on = false;
+          return;
+        }
+        spill_us = micros() - spill_us;
+        if (spill_us > 0) {
+          buf[len++] = XYCAPTURE_STALL;
+          put_time(spill_us);
+        }
+      }
+      head = len;
+      buf[len++] = out;
+      put_time(us - last);
+      last = us;
+      k = min(min(n, (size_t)0x7F), size - len);
+      buf[head] |= k - 1;
+    }
+    memcpy(buf + len, p, k);
+    len += k;
+    p += k;
+    n -= k;
+  }
+}
+
+/*
+ * Add a record's time, 7 bits at a time.
+ */
+void XYcapture::put_time(uint32_t t)
+{
+  while (t >= 0x80) {
+    buf[len++] = t | 0x80;
+    t >>= 7;
+  }
+  buf[len++] = t;
+}
+
+/*
+ * Write buf to the file and start again at its beginning.
+ */
+bool XYcapture::spill(void)
+{
+  if (!to_file) return false;
+  if (file.write(buf, len) != len) return false;
+  len = 0;
+  head = -1;
+  return true;
+}
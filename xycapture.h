@@ -0,0 +1,111 @@
+/*
+MIT License
+
+Copyright (c) 2018 gdsports625@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#ifndef _XYCAPTURE_H_
+#define _XYCAPTURE_H_
+
+// Included from xymodem.h.
+
+// A capture starts with these 4 bytes, "XYC1".
+#define XYCAPTURE_MAGIC "XYC1"
+
+// Head byte of a record saying how long the capture took to write itself
+// out, see xycapture.cpp.
+#define XYCAPTURE_STALL 0x7F
+
+// Times kept for bytes seen at the port but not read yet. More arrivals
+// than this before a read are timed from the latest.
+#define XYCAPTURE_SEEN 4
+
+// Records what passes through a port, for extras/host/xyreplay to play
+// back on a PC. Give it to start_rx(), start_rb() and so on in place of
+// the port:
+//
+//   capture.begin(&Serial, file, buf, sizeof(buf));
+//   rxymodem.start_rb(&capture, &FATFILESYS, true, true);
+//   ...
+//   capture.end();             // once loop() returns 0
+//
+// Each byte written is stored with the micros() time of the write. A byte
+// from the port is stored when it is read, with the time the receiver
+// first saw it there through available() or peek(), as that is when it
+// could have acted on it.
+//
+// With a file, buf collects records and is written to the file each time
+// it fills, one sector at a time with a 512 byte buf. The time that write
+// took is recorded too, and a replay stalls as long at the same point, so
+// the session replays to the microsecond all the same. Without a file
+// recording stops when buf is full, and dropped counts what was missed.
+class XYcapture : public Stream {
+  public:
+    // Record into buf only.
+    void begin(Stream *port, uint8_t *buf, size_t size);
+    // Record into file, through buf.
+    void begin(Stream *port, File file, uint8_t *buf, size_t size);
+    // Stop recording. With a file, write out the rest and close it.
+    void end(void);
+    bool recording(void) { return on; }
+    // The capture so far, all of it if there is no file.
+    const uint8_t *data(void) { return buf; }
+    size_t length(void) { return len; }
+
+    int available(void);
+    int read(void);
+    int peek(void);
+    size_t readBytes(char *buffer, size_t length);
+    size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+    void flush(void) { port->flush(); }
+
+    uint32_t bytes_in = 0;      // recorded each way
+    uint32_t bytes_out = 0;
+    uint32_t dropped = 0;       // not recorded, buf full
+
+  private:
+    void start(Stream *port, uint8_t *buf, size_t size);
+    void seen(int n);
+    void record_in(const uint8_t *p, size_t n);
+    void record(uint8_t out, uint32_t us, const uint8_t *p, size_t n);
+    void put_time(uint32_t t);
+    bool spill(void);
+
+    Stream *port = NULL;
+    File file;
+    bool to_file = false;
+    bool on = false;
+    uint8_t *buf = NULL;
+    size_t size = 0;
+    size_t len = 0;
+    int32_t head = -1;          // where the last record starts in buf
+    uint32_t last_us[2];        // time of the last record read and written
+    uint32_t reads = 0;         // bytes read, mod 2^32
+    uint32_t seen_us[XYCAPTURE_SEEN];
+    uint32_t seen_to[XYCAPTURE_SEEN];   // reads once those bytes are read
+    uint8_t seen_n = 0;
+};
+
+#endif /* _XYCAPTURE_H_ */
@@ -0,0 +1,65 @@
+/*
+MIT License
+
+Copyright (c) 2018 gdsports625@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _XYCRC_H_
+#define _XYCRC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// CRC-16/XMODEM engine selection.
+//   0 = bit at a time (reference, no tables)
+//   1 = 256 entry table, one byte per step (512 bytes flash)
+//   4 = slice-by-4, four bytes per step (2 KB flash)
+// Boards with flash to spare get slice-by-4, everything else the byte table.
+#if !defined(XYMODEM_CRC_SLICE)
+#if defined(ADAFRUIT_METRO_M4_EXPRESS) || defined(__MK66FX1M0__)
+#define XYMODEM_CRC_SLICE 4
+#else
+#define XYMODEM_CRC_SLICE 1
+#endif
+#endif
+
+#if XYMODEM_CRC_SLICE != 0 && XYMODEM_CRC_SLICE != 1 && XYMODEM_CRC_SLICE != 4
+#error "XYMODEM_CRC_SLICE must be 0, 1 or 4"
+#endif
+
+// Update crc with len bytes from buf. Start a new block with crc = 0.
+uint16_t xycrc16(uint16_t crc, const uint8_t *buf, size_t len);
+
+// Bit loop reference implementation. Always available, gives the same
+// results as xycrc16 regardless of XYMODEM_CRC_SLICE.
+uint16_t xycrc16_bitwise(uint16_t crc, const uint8_t *buf, size_t len);
+
+// CRC-32 (IEEE 802.3, as used by ZMODEM and zlib). Pre and post inversion
+// are done inside so calls can be chained: start with crc = 0 and pass the
+// previous result to continue. Uses a 256 entry table (1 KB flash) unless
+// XYMODEM_CRC_SLICE is 0.
+uint32_t xycrc32(uint32_t crc, const uint8_t *buf, size_t len);
+uint32_t xycrc32_bitwise(uint32_t crc, const uint8_t *buf, size_t len);
+
+// 8-bit arithmetic checksum used by original XMODEM.
+uint8_t xysum8(uint8_t sum, const uint8_t *buf, size_t len);
+
+#endif /* _XYCRC_H_ */
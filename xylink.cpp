@@ -0,0 +1,317 @@
+/*
+MIT License
+
+Copyright (c) 2018 gdsports625@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Logical channels over one port, see XYlink in xylink.h.
+ *
+ * A frame is XYLINK_SYNC, then type << 4 | channel, payload length, a 16-bit
+ * offset, the payload and a CRC-16 of everything after the sync byte, high
+ * byte first like XMODEM's. Offsets and windows are little endian.
+ *
+ * A data frame's offset is the channel's count of bytes sent before its
+ * first payload byte, so a receiver that sees a gap knows how much a bad
+ * frame lost. A credit frame's offset is how many bytes the sender of the
+ * credit has read or lost on that channel, and its 2 byte payload the size
+ * of its receive buffer. The other end may have sent up to that count
+ * plus the buffer size. Both are counts mod 65536, so a lost credit frame
+ * is made good by the next.
+ */
+
+#include <Arduino.h>
+#include <xymodem.h>
+#include <xycrc.h>
+
+// Sync, type and channel, length, offset, CRC-16
+#define XYLINK_OVERHEAD 7
+
+void XYchannel::reset(void)
+{
+  rx_head = rx_count = 0;
+  rx_expect = rx_read = rx_granted = 0;
+  grant_ms = millis();
+  tx_head = tx_count = 0;
+  tx_sent = peer_read = peer_window = 0;
+}
+
+int XYchannel::read(void)
+{
+  if (rx_count == 0) return -1;
+  uint8_t c = rx_ring[rx_head];
+  rx_head = (rx_head + 1) % XYMODEM_LINK_RX;
+  rx_count--;
+  rx_read++;
+  return c;
+}
+
+/*
+ * Unlike Stream::readBytes() this does not wait for more to arrive.
+ */
+size_t XYchannel::readBytes(char *buffer, size_t length)
+{
+  size_t n = 0;
+  while (n < length && rx_count > 0) {
+    uint16_t len = min((size_t)min(rx_count, (uint16_t)(XYMODEM_LINK_RX - rx_head)), length - n);
+    memcpy(buffer + n, rx_ring + rx_head, len);
+    rx_head = (rx_head + len) % XYMODEM_LINK_RX;
+    rx_count -= len;
+    rx_read += len;
+    n += len;
+  }
+  return n;
+}
+
+size_t XYchannel::write(const uint8_t *buffer, size_t size)
+{
+  size_t n = 0;
+  uint32_t start = millis();
+
+  while (n < size) {
+    if (tx_count == XYMODEM_LINK_TX) {
+      // Full. Send what the other end has room for and wait for more.
+      if (link) link->poll();
+      if (tx_count == XYMODEM_LINK_TX) {
+        if (millis() - start >= _timeout) break;
+        yield();
+        continue;
+      }
+    }
+    uint16_t tail = (tx_head + tx_count) % XYMODEM_LINK_TX;
+    uint16_t len = min((size_t)min((uint16_t)(XYMODEM_LINK_TX - tx_count),
+          (uint16_t)(XYMODEM_LINK_TX - tail)), size - n);
+    memcpy(tx_ring + tail, buffer + n, len);
+    tx_count += len;
+    n += len;
+  }
+  return n;
+}
+
+void XYchannel::flush(void)
+{
+  if (link) link->flush();
+}
+
+uint16_t XYchannel::credit(void)
+{
+  uint16_t in_flight = tx_sent - peer_read;
+  return (in_flight >= peer_window) ? 0 : peer_window - in_flight;
+}
+
+void XYlink::begin(Stream *port)
+{
+  this->port = port;
+  lk_state = LK_HUNT;
+  next = 0;
+  for (uint8_t i = 0; i < XYMODEM_LINK_CHANNELS; i++) {
+    ch[i].reset();
+    ch[i].link = this;
+  }
+  // Tell the other end how much each channel may send.
+  for (uint8_t i = 0; i < XYMODEM_LINK_CHANNELS; i++) send_credit(ch[i]);
+}
+
+void XYlink::poll(void)
+{
+  if (port == NULL) return;
+  receive();
+
+  // Credit first: it is small and keeps the other end sending. A quarter
+  // of the buffer read is worth telling, and a channel whose other end
+  // has run out of credit always has that much.
+  for (uint8_t i = 0; i < XYMODEM_LINK_CHANNELS; i++) {
+    XYchannel &c = ch[i];
+    if ((uint16_t)(c.rx_read - c.rx_granted) >= XYMODEM_LINK_RX / 4 ||
+        millis() - c.grant_ms >= XYLINK_REFRESH_MS) {
+      send_credit(c);
+    }
+  }
+
+  // Then one frame from each channel in turn until none can send. The
+  // channel that goes first moves round each call.
+  bool more = true;
+  while (more) {
+    more = false;
+    for (uint8_t i = 0; i < XYMODEM_LINK_CHANNELS; i++) {
+      XYchannel &c = ch[(next + i) % XYMODEM_LINK_CHANNELS];
+      uint16_t len = min(min(c.tx_count, c.credit()), (uint16_t)XYMODEM_LINK_FRAME);
+      if (len > 0) {
+        send_data(c, len);
+        more = true;
+      }
+    }
+  }
+  next = (next + 1) % XYMODEM_LINK_CHANNELS;
+}
+
+void XYlink::flush(void)
+{
+  poll();
+  if (port) port->flush();
+}
+
+/*
+ * Read what the port has. Data goes straight into the channel's receive
+ * buffer past what is there and only counts once the CRC is good.
+ */
+void XYlink::receive(void)
+{
+  int avail;
+
+  while ((avail = port->available()) > 0) {
+    switch (lk_state) {
+      case LK_HUNT:
+        if (port->read() == XYLINK_SYNC) {
+          lk_state = LK_HEAD;
+          got = 0;
+        }
+        break;
+      case LK_HEAD: {
+        head[got++] = port->read();
+        if (got < sizeof(head)) break;
+        uint8_t type = head[0] >> 4;
+        uint8_t n = head[0] & 0x0F;
+        uint8_t len = head[1];
+        bool ok = n < XYMODEM_LINK_CHANNELS &&
+          ((type == XYLINK_DATA && len > 0 && len <= XYMODEM_LINK_RX - ch[n].rx_count) ||
+           (type == XYLINK_CREDIT && len == sizeof(window)));
+        if (!ok) {
+          // Corrupt, or more than the credit given. Look for the next.
+          bad_frames++;
+          lk_state = LK_HUNT;
+          break;
+        }
+        lk_crc = xycrc16(0, head, sizeof(head));
+        got = 0;
+        lk_state = LK_DATA;
+        break;
+      }
+      case LK_DATA: {
+        XYchannel &c = ch[head[0] & 0x0F];
+        uint8_t *p;
+        int len;
+        if ((head[0] >> 4) == XYLINK_CREDIT) {
+          p = window + got;
+          len = 1;
+        }
+        else {
+          uint16_t at = (c.rx_head + c.rx_count + got) % XYMODEM_LINK_RX;
+          p = c.rx_ring + at;
+          len = min(min(avail, head[1] - got), XYMODEM_LINK_RX - at);
+        }
+        len = port->readBytes((char *)p, len);
+        lk_crc = xycrc16(lk_crc, p, len);
+        got += len;
+        if (got == head[1]) {
+          got = 0;
+          lk_state = LK_CHECK;
+        }
+        break;
+      }
+      case LK_CHECK:
+        tail[got++] = port->read();
+        if (got < sizeof(tail)) break;
+        lk_state = LK_HUNT;
+        if ((tail[0] << 8 | tail[1]) == lk_crc) {
+          accept();
+        }
+        else {
+          bad_frames++;
+        }
+        break;
+    }
+  }
+}
+
+/*
+ * The frame in head passed its CRC.
+ */
+void XYlink::accept(void)
+{
+  XYchannel &c = ch[head[0] & 0x0F];
+  uint16_t offset = head[2] | head[3] << 8;
+
+  frames_in++;
+  if ((head[0] >> 4) == XYLINK_CREDIT) {
+    uint16_t size = window[0] | window[1] << 8;
+    // More in flight than the window allows only if the other end
+    // started again. Start counting from where it is.
+    if ((uint16_t)(c.tx_sent - offset) > size) c.tx_sent = offset;
+    c.peer_read = offset;
+    c.peer_window = size;
+    return;
+  }
+  uint16_t gap = offset - c.rx_expect;
+  if (gap != 0 && gap < 0x8000) {
+    // Frames lost in between. Their bytes will never be read, so count
+    // them as read to give the credit back.
+    lost_bytes += gap;
+    c.rx_read += gap;
+  }
+  // A gap the other way means the other end started again.
+  c.rx_count += head[1];
+  c.rx_expect = offset + head[1];
+}
+
+void XYlink::send_credit(XYchannel &c)
+{
+  uint8_t frame[XYLINK_OVERHEAD + 2];
+  frame[0] = XYLINK_SYNC;
+  frame[1] = XYLINK_CREDIT << 4 | (&c - ch);
+  frame[2] = 2;
+  frame[3] = c.rx_read & 0xFF;
+  frame[4] = c.rx_read >> 8;
+  frame[5] = XYMODEM_LINK_RX & 0xFF;
+  frame[6] = XYMODEM_LINK_RX >> 8;
+  c.rx_granted = c.rx_read;
+  c.grant_ms = millis();
+  send_frame(frame, 7);
+}
+
+void XYlink::send_data(XYchannel &c, uint16_t len)
+{
+  uint8_t frame[XYMODEM_LINK_FRAME + XYLINK_OVERHEAD];
+  frame[0] = XYLINK_SYNC;
+  frame[1] = XYLINK_DATA << 4 | (&c - ch);
+  frame[2] = len;
+  frame[3] = c.tx_sent & 0xFF;
+  frame[4] = c.tx_sent >> 8;
+  for (uint16_t i = 0; i < len; i++) {
+    frame[5 + i] = c.tx_ring[(c.tx_head + i) % XYMODEM_LINK_TX];
+  }
+  c.tx_head = (c.tx_head + len) % XYMODEM_LINK_TX;
+  c.tx_count -= len;
+  c.tx_sent += len;
+  send_frame(frame, 5 + len);
+}
+
+/*
+ * frame holds len bytes from the sync byte on, with room for the CRC.
+ */
+void XYlink::send_frame(uint8_t *frame, uint16_t len)
+{
+  uint16_t crc = xycrc16(0, frame + 1, len - 1);
+  frame[len++] = crc >> 8;
+  frame[len++] = crc & 0xFF;
+  port->write(frame, len);
+  frames_out++;
+}
@@ -0,0 +1,124 @@
+/*
+MIT License
+
+Copyright (c) 2018 gdsports625@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _XYLINK_H_
+#define _XYLINK_H_
+
+// Included from xymodem.h once the XYMODEM_LINK_* settings are known.
+
+// Frame types, the high nibble of the byte after XYLINK_SYNC.
+#define XYLINK_SYNC   0xA5
+#define XYLINK_DATA   0
+#define XYLINK_CREDIT 1
+
+// Time between unasked credit frames, which get a channel going again if
+// the other end started late or a credit frame was lost.
+#define XYLINK_REFRESH_MS 500
+
+class XYlink;
+
+// One logical channel of an XYlink. A Stream like a serial port, so it can
+// be given to XYmodem or used for a console. write() waits for buffer
+// space, as Serial.write() does, but gives up after the Stream timeout.
+class XYchannel : public Stream {
+  public:
+    int available(void) { return rx_count; }
+    int read(void);
+    int peek(void) { return (rx_count) ? rx_ring[rx_head] : -1; }
+    size_t readBytes(char *buffer, size_t length);
+    size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+    int availableForWrite(void) { return XYMODEM_LINK_TX - tx_count; }
+    // Send what the other end has room for now.
+    void flush(void);
+
+  private:
+    friend class XYlink;
+    void reset(void);
+    // Bytes the other end has room for.
+    uint16_t credit(void);
+
+    XYlink *link = NULL;
+    uint8_t rx_ring[XYMODEM_LINK_RX];
+    uint16_t rx_head;
+    uint16_t rx_count;
+    uint16_t rx_expect;         // offset of the next data byte, mod 65536
+    uint16_t rx_read;           // bytes read or lost, mod 65536
+    uint16_t rx_granted;        // rx_read in the last credit frame sent
+    uint32_t grant_ms;          // when that was
+    uint8_t tx_ring[XYMODEM_LINK_TX];
+    uint16_t tx_head;
+    uint16_t tx_count;
+    uint16_t tx_sent;           // bytes sent, mod 65536
+    uint16_t peer_read;         // the other end's rx_read
+    uint16_t peer_window;       // its buffer size, 0 until it says
+};
+
+// Carries XYMODEM_LINK_CHANNELS channels over one port, e.g. a console and
+// several transfers over one USB CDC link. The other end runs the same
+// framing, see extras/host/xylinkpty.
+//
+// Each channel sends only what the other end's receive buffer has room
+// for, learned from credit frames, so one stalled channel never blocks
+// the others. Channels with data take turns one frame at a time. Frames
+// carry a CRC-16 and one that fails is dropped along with its data, which
+// a transfer on that channel recovers from like a noisy line.
+class XYlink {
+  public:
+    void begin(Stream *port);
+    XYchannel *channel(uint8_t n) { return (n < XYMODEM_LINK_CHANNELS) ? &ch[n] : NULL; }
+    // Move bytes between the port and the channels. Call it from the
+    // Arduino loop(); channel write() also calls it while it waits.
+    void poll(void);
+    // poll(), then flush the port.
+    void flush(void);
+
+    uint32_t frames_in = 0;
+    uint32_t frames_out = 0;
+    uint32_t bad_frames = 0;    // failed the CRC or made no sense
+    uint32_t lost_bytes = 0;    // data bytes in frames never received
+
+  private:
+    void receive(void);
+    void accept(void);
+    void send_credit(XYchannel &c);
+    void send_data(XYchannel &c, uint16_t len);
+    void send_frame(uint8_t *frame, uint16_t len);
+
+    Stream *port = NULL;
+    XYchannel ch[XYMODEM_LINK_CHANNELS];
+    uint8_t next = 0;           // channel that goes first next time
+
+    // Frame being received
+    enum { LK_HUNT, LK_HEAD, LK_DATA, LK_CHECK } lk_state = LK_HUNT;
+    uint8_t head[4];            // type and channel, length, offset
+    uint8_t window[2];          // credit frame payload
+    uint8_t tail[2];
+    uint8_t got;                // bytes of head, data or tail so far
+    uint16_t lk_crc;
+};
+
+#endif /* _XYLINK_H_ */
@@ -24,6 +24,8 @@ SOFTWARE.
 
 #include <Arduino.h>
 #include <xymodem.h>
+#include <xycrc.h>
+#include <stddef.h>
 
 #define DEBUG_ON 0
 
@@ -49,7 +51,9 @@ SOFTWARE.
 int XYmodem::start_rx(Stream *port, const char *rx_filename, bool rx_buf_1k, bool useCRC)
 {
   YMODEM = false;
-  return start(port, NULL, rx_filename, rx_buf_1k, useCRC);
+  streaming = false;
+  zmodem = false;
+  return start(port, &FATFILESYS, rx_filename, rx_buf_1k, useCRC);
 }
 
 /*
@@ -58,41 +62,100 @@ int XYmodem::start_rx(Stream *port, const char *rx_filename, bool rx_buf_1k, boo
 int XYmodem::start_rb(Stream *port, void *filesys, bool rx_buf_1k, bool useCRC)
 {
   YMODEM = true;
+  streaming = false;
+  zmodem = false;
   return start(port, filesys, NULL, rx_buf_1k, useCRC);
 }
 
+/*
+ * Start YMODEM-G receive. The sender streams blocks without waiting for
+ * ACKs so the link never idles, but there is no error recovery: any bad
+ * block cancels the transfer. Only use it on error free links such as USB
+ * CDC. Always 1K blocks and CRC.
+ */
+int XYmodem::start_rg(Stream *port, void *filesys)
+{
+  YMODEM = true;
+  streaming = true;
+  zmodem = false;
+  return start(port, filesys, NULL, true, true);
+}
+
 int XYmodem::start(Stream *port, void *filesys, const char *rx_filename, bool rx_buf_1k, bool useCRC)
 {
+  // A transfer abandoned part way still has its file open.
+  close_file(false);
+#if XYMODEM_SEND
+  tx_end();
+#endif
+#if XYMODEM_UNPACK
+  uz_state = UZ_OFF;
+#endif
+#if XYMODEM_DIGEST
+  rx_digest_set = false;
+#endif
+#if XYMODEM_RESUME
+  rx_recheck = 0;
+#endif
+#if XYMODEM_SYNC
+  sync_file = sync_wait = rx_skip = false;
+#endif
   rx_buf_size = 128;
   if (rx_buf_1k) {
     rx_buf_size = 1024;
   }
   dbprint("rx_buf_size=");
   dbprintln(rx_buf_size);
-  if (rx_buf == NULL) {
-    rx_buf = (uint8_t*)malloc(rx_buf_size);
-    if (rx_buf == NULL) {
-      rxmodem.close();
+  if (!alloc_pool()) return 1;
+#if XYMODEM_WRITE_COALESCE > 0
+  if (wr_buf == NULL) {
+    wr_buf = (uint8_t*)malloc(XYMODEM_WRITE_COALESCE);
+    if (wr_buf == NULL) {
       dbprintln("XYmodem malloc failed");
       return 1;
     }
   }
+#endif
+  wr_len = 0;
+  wr_calls_in = wr_calls_out = 0;
+  memset(&rx_stats, 0, sizeof(rx_stats));
+  rx_stats.block_us_min = 0xFFFFFFFF;
+  rtt_reset();
+  rx_buf = rx_pool;
+  rx_fill = rx_commit = rx_pending = 0;
+  rx_commit_offset = 0;
   CRC_on = useCRC;
+  XYTRACE(XYT_START, (zmodem) ? 3 : (streaming) ? 2 : (YMODEM) ? 1 : 0, rx_buf_size);
   rxmodem_state = BLOCKSTART;
   next_block = 1;
-  reply = (CRC_on)? 'C' : NAK;
+  reply = request_char();
   this->port = port;
   this->filesys = (FATFILESYS_CLASS *)filesys;
+  file_sink.filesys = this->filesys;
+#if XYMODEM_BATCH
+  // The directory is read again for every transfer.
+  file_sink.batch_end();
+  if (batch_on && YMODEM) file_sink.batch_begin();
+#endif
+  if (zmodem) {
+    zstart();
+    return 0;
+  }
   port->write(reply);
   port->flush();
-  next_millis = millis()+ TIMEOUT_LONG;
+  arm_timer(rto_ms);
+  // XMODEM does not send the file size so write every block in full.
+  rx_file_remaining = 0xFFFFFFFF;
   if (rx_filename != NULL && *rx_filename != '\0') {
     dbprint("XYmodem starting <"); dbprint(rx_filename); dbprintln('>');
-    this->filesys->remove((char *)rx_filename);
-    strncpy(this->rx_filename, (char *)rx_buf, sizeof(this->rx_filename)-1);
+    strncpy(this->rx_filename, rx_filename, sizeof(this->rx_filename)-1);
     this->rx_filename[sizeof(this->rx_filename)-1] = '\0';
-    rxmodem = this->filesys->open(this->rx_filename, FILE_WRITE);
-    if (rxmodem) {
+#if XYMODEM_UNPACK
+    rx_open = unpack_begin() || sink->open(this->rx_filename, rx_file_remaining);
+#else
+    rx_open = sink->open(this->rx_filename, rx_file_remaining);
+#endif
+    if (rx_open) {
       return 0;
     }
     else {
@@ -103,70 +166,172 @@ int XYmodem::start(Stream *port, void *filesys, const char *rx_filename, bool rx
   return 0;
 }
 
-int XYmodem::loop(void)
+/*
+ * Make sure rx_pool has XYMODEM_RX_BUFFERS buffers of rx_buf_size bytes.
+ */
+bool XYmodem::alloc_pool(void)
+{
+  if (rx_pool != NULL && rx_buf_size > rx_pool_block) {
+    if (fixed_buffers) {
+      dbprintln("XYmodem buffers too small");
+      return false;
+    }
+    free(rx_pool);
+    rx_pool = NULL;
+  }
+  if (rx_pool == NULL) {
+    rx_pool_block = rx_buf_size;
+    rx_pool = (uint8_t*)malloc(rx_buf_size * XYMODEM_RX_BUFFERS);
+    if (rx_pool == NULL) {
+      dbprintln("XYmodem malloc failed");
+      return false;
+    }
+  }
+  return true;
+}
+
+int XYmodem::loop(uint32_t budget_us, uint32_t max_bytes)
+{
+  if (rxmodem_state == IDLE) return 0;
+  lp_budget_us = budget_us;
+  lp_max_bytes = max_bytes;
+  lp_bytes = 0;
+#if XYMODEM_STATS
+  lp_start = micros();
+  int state = rx_loop();
+  uint32_t us = micros() - lp_start;
+  rx_stats.loop_us += us;
+  rx_stats.loop_calls++;
+  if (us > rx_stats.loop_us_max) rx_stats.loop_us_max = us;
+  return state;
+#else
+  if (budget_us) lp_start = micros();
+  return rx_loop();
+#endif
+}
+
+int XYmodem::rx_loop(void)
 {
-  static uint16_t blocksize;
-  static uint16_t blocksizenext;
-  static uint8_t block;
   int inchar = 0;
-  static uint8_t *p;
-  static uint8_t datachecksum = 0;
-  static uint16_t CRC = 0;
-  static uint16_t CRCRx;
 
   if (rxmodem_state == IDLE) return 0;
+#if XYMODEM_SEND
+  if (rxmodem_state == SEND) return tx_loop();
+#endif
+
+  // A limited call may have stopped with every buffer full. Make room
+  // before reading more. Bytes written count against max_bytes too.
+  while (rx_pending == XYMODEM_RX_BUFFERS) {
+    commit_blocks(XYMODEM_COMMIT_CHUNK);
+    lp_bytes += XYMODEM_COMMIT_CHUNK;
+    if (rxmodem_state == IDLE) return 0;
+    if (rx_pending == XYMODEM_RX_BUFFERS && !lp_more()) return rxmodem_state;
+  }
+
+  if (port->available() == 0) {
+    if (rx_pending > 0) {
+      // Nothing to receive right now so write a slice of the oldest block.
+      if (sink->ready()) commit_blocks(XYMODEM_COMMIT_CHUNK);
+      // The data may have been refused, see unpack_open().
+      if (rxmodem_state == IDLE) return 0;
+    }
+    else if (rx_open && !unpack_pending()) {
+      sink->idle();
+    }
+  }
+
+  if (rxmodem_state == ZMODEM) return zloop();
 
-  if (millis() > next_millis) {
+  if (timer_expired() && port->available() == 0) {
     port->write(reply);
     port->flush();
-    if (reply == NAK || reply == 'C') {
-      next_millis = millis() + TIMEOUT_LONG;
+    XYSTAT(rx_stats.timeouts++);
+    XYTRACE(XYT_TIMEOUT, reply, 0);
+    if (reply == NAK || reply == 'C' || reply == 'G') {
+      rto_timeout();
+      arm_timer(rto_ms);
       rxmodem_state = BLOCKSTART;
-      dbprintln("timeout, send NAK or C");
+      dbprintln("timeout, send NAK, C or G");
     }
     else if (reply == CAN) {
+      XYSTAT(rx_stats.cans++);
+      XYTRACE(XYT_CAN, 0, 0);
+      close_file(false);
       rxmodem_state = IDLE;
       reply = NAK;
       dbprintln("timeout, send CAN");
     }
     return rxmodem_state;
   }
-  while (port->available() > 0) {
+  while (port->available() > 0 && rx_pending < XYMODEM_RX_BUFFERS && lp_more()) {
+#if XYMODEM_TRACE > 0
+    rxmodem_t prev_state = rxmodem_state;
+#endif
     inchar = port->read();
-    next_millis = millis() + TIMEOUT_SHORT;
-    dbprint("inchar=0x"); dbprintln(inchar, HEX);
+    lp_bytes++;
+    // Inside a block only a short gap is expected.
+    arm_timer((srtt_us) ? rto_ms : TIMEOUT_SHORT);
     switch (rxmodem_state) {
       case IDLE:
+      case ZMODEM:
+      case SEND:
         break;
       case BLOCKSTART:
-        dbprint("BLOCKSTART 0x"); dbprintln(inchar, HEX);
         switch (inchar) {
           case SOH:
-            blocksize = blocksizenext = 128;
+            rtt_sample();
+            XYSTAT(rx_block_start = micros());
+            rx_left = rx_blocklen = 128;
             rxmodem_state = BLOCKNUM;
+            read_frame();
             break;
           case STX:
-            blocksize = blocksizenext = 1024;
-            if (blocksize > rx_buf_size) {
+            rtt_sample();
+            XYSTAT(rx_block_start = micros());
+            rx_left = rx_blocklen = 1024;
+            if (rx_left > rx_buf_size) {
+              XYSTAT(rx_stats.blocks_nak++);
               reply = NAK;
               rxmodem_state = DATAPURGE;
             }
             else {
               rxmodem_state = BLOCKNUM;
+              read_frame();
             }
             break;
           case EOT:
-            port->write(ACK);
-            port->flush();
+            rtt_sample();
+            XYTRACE(XYT_EOT, 0, 0);
+            // Out before the close, which can take a while.
+            ctl(ACK);
+            ctl_flush();
             next_block = 1;
-            if (rxmodem) {
+            if (rx_open) {
               dbprint("YMODEM="); dbprintln(YMODEM, DEC);
               dbprint("filename="); dbprintln(rx_filename);
-              if (YMODEM && (strcmp(rx_filename, "") == 0))
+              if (!YMODEM || (strcmp(rx_filename, "") == 0))
                 rxmodem_state = IDLE;
               else
                 rxmodem_state = BLOCKSTART;
-              rxmodem.close();
+              bool early = false;
+#if XYMODEM_BATCH
+              // In a batch the next header is on its way while this file
+              // is closed.
+              early = batch_on;
+#endif
+              if (!early) close_file(true);
+              if (rxmodem_state == BLOCKSTART) {
+                // Ask for the next YMODEM header now rather than after a
+                // timeout.
+                reply = request_char();
+                ctl(reply);
+                rtt_send();
+                arm_timer(rto_ms);
+              }
+              if (early) {
+                ctl_flush();
+                close_file(true);
+              }
             }
             else {
               rxmodem_state = IDLE;
@@ -175,220 +340,792 @@ int XYmodem::loop(void)
         }
         break;
       case BLOCKNUM:
-        dbprint("BLOCKNUM block=");
-        block = inchar;
-        dbprintln(block);
+        rx_block = inchar;
         rxmodem_state = BLOCKCHECK;
         break;
       case BLOCKCHECK:
-        dbprint("BLOCKCHECK blockchk=0x");
-        dbprintln((uint8_t)(inchar ^ block), HEX);
-        if ((uint8_t)(inchar ^ block) == 0xFF) {
-          if (((block == next_block) || (block == (next_block-1)))) {
-            p = rx_buf;
-            datachecksum = 0;
-            CRC = 0;
-            rxmodem_state = DATABLOCK;
-          }
-          else {
-            reply = CAN;
-            rxmodem_state = DATAPURGE;
-          }
-        }
-        else {
-          reply = NAK;
-          rxmodem_state = DATAPURGE;
-        }
+        check_blocknum(inchar);
         break;
       case DATABLOCK:
-        dbprintln("DATABLOCK");
-        *p++ = inchar;
-        if (CRC_on) {
-          CRC = updcrc(inchar, CRC);
-        }
-        else {
-          datachecksum += inchar;
-        }
-        blocksize--;
-        if (blocksize == 0) {
-          rxmodem_state = DATACHECK;
-        }
-        else {
-          int bytesAvail, bytesIn;
-          bytesAvail = port->available();
-          dbprint("bytesAvail=");
-          dbprintln(bytesAvail);
-          if (bytesAvail > 0) {
-            bytesIn = port->readBytes((char *)p, min(bytesAvail, blocksize));
-            dbprint("blocksize=");
-            dbprint(blocksize);
-            dbprint(" bytesIn=");
-            dbprintln(bytesIn);
-            while (bytesIn--) {
-              if (CRC_on) {
-                CRC = updcrc(*p++, CRC);
-              }
-              else {
-                datachecksum += *p++;
-              }
-              blocksize--;
+        {
+          // Store this byte then pull whatever else is already buffered
+          // and run the check over the whole chunk at once.
+          uint8_t *chunk = rx_p;
+          *rx_p++ = inchar;
+          rx_left--;
+          if (rx_left > 0) {
+            int bytesAvail, bytesIn;
+            bytesAvail = lp_room(port->available());
+            if (bytesAvail > 0) {
+              bytesIn = port->readBytes((char *)rx_p, min(bytesAvail, rx_left));
+              rx_p += bytesIn;
+              rx_left -= bytesIn;
+              lp_bytes += bytesIn;
             }
-            if (blocksize == 0) rxmodem_state = DATACHECK;
           }
+          if (CRC_on) {
+            rx_crc = xycrc16(rx_crc, chunk, rx_p - chunk);
+          }
+          else {
+            rx_sum = xysum8(rx_sum, chunk, rx_p - chunk);
+          }
+          if (rx_left == 0) rxmodem_state = DATACHECK;
         }
         break;
       case DATACHECK:
         if (CRC_on) {
-          dbprint("DATACHECK CRC=0x");
-          dbprintln(CRC, HEX);
-          CRCRx = inchar << 8;
+          rx_crc_in = inchar << 8;
           rxmodem_state = DATACHECKCRC;
         }
         else {
-          dbprint("DATACHECK datachecksum=0x");
-          dbprintln(datachecksum, HEX);
-          if (datachecksum == inchar) {
-            dbprintln("Checksum OK");
-            port->write(ACK);
-            port->flush();
-            if (block == next_block) {
-              dbprintln("Good block");
-              next_block++;
-              int bytesOut = min(blocksizenext, rx_file_remaining);
-              rxmodem.write(rx_buf, bytesOut);
-              rx_file_remaining -= bytesOut;
-              dbprint("rx_file_remaining="); dbprint(rx_file_remaining);
-              dbprint(" bytesOut="); dbprintln(bytesOut);
-              next_millis = millis() + TIMEOUT_LONG;
-              rxmodem_state = BLOCKSTART;
-            }
-            else if (block == 0) {
-              // ymodem block 0 file name, file size, etc.
-              dbprint("rx file name="); dbprintln((char *)rx_buf);
-              if (rx_buf[0] != '\0') {
-                filesys->remove((char *)rx_buf);
-                strncpy(rx_filename, (char *)rx_buf, sizeof(rx_filename)-1);
-                rx_filename[sizeof(rx_filename)-1] = '\0';
-                rxmodem = filesys->open(rx_filename, FILE_WRITE);
-                if (rxmodem) {
-                  rxmodem_state = BLOCKSTART;
-                  next_block = 1;
-                  reply = (CRC_on)? 'C' : NAK;
-                  port->write(reply);
-                  port->flush();
-                  next_millis = millis()+ TIMEOUT_LONG;
-                  dbprintln("rxmodem starting");
-                  dbprintln((char *)rx_buf + strlen((const char *)rx_buf)+1);
-                  rx_file_remaining = strtoul(
-                      (char *)&rx_buf[strlen((const char *)rx_buf)+1], NULL, 10);
-                  dbprint("rx_file_remaining=");
-                  dbprintln(rx_file_remaining);
-                }
-                else {
-                  dbprintln("rx file open failed");
-                }
-              }
-              else {
-                rxmodem_state = IDLE;
-              }
-            }
-          }
-          else {
-            dbprintln("Checksum bad");
-            port->write(NAK);
-            port->flush();
-            rxmodem_state = BLOCKSTART;
-          }
+          check_data(inchar);
         }
         break;
       case DATACHECKCRC:
-        CRCRx |= inchar;
-        dbprint("DATACHECK CRCRx=0x");
-        dbprintln(CRCRx, HEX);
-        if (CRCRx == CRC) {
-          dbprintln("CRC OK");
-          port->write(ACK);
-          port->flush();
-          if (block == next_block) {
-            dbprintln("Good block");
-            next_block++;
-            int bytesOut = min(blocksizenext, rx_file_remaining);
-            rxmodem.write(rx_buf, bytesOut);
-            rx_file_remaining -= bytesOut;
-            dbprint("rx_file_remaining="); dbprint(rx_file_remaining);
-            dbprint(" bytesOut="); dbprintln(bytesOut);
-            next_millis = millis() + TIMEOUT_LONG;
-            rxmodem_state = BLOCKSTART;
-          }
-          else if (block == 0) {
-            // ymodem block 0 file name, file size, etc.
-            dbprint("rx file name="); dbprintln((char *)rx_buf);
-            if (rx_buf[0] != '\0') {
-              filesys->remove((char *)rx_buf);
-              strncpy(rx_filename, (char *)rx_buf, sizeof(rx_filename)-1);
-              rx_filename[sizeof(rx_filename)-1] = '\0';
-              rxmodem = filesys->open(rx_filename, FILE_WRITE);
-              if (rxmodem) {
-                rxmodem_state = BLOCKSTART;
-                next_block = 1;
-                reply = (CRC_on)? 'C' : NAK;
-                port->write(reply);
-                port->flush();
-                next_millis = millis()+ TIMEOUT_LONG;
-                dbprintln("rxmodem starting");
-                dbprintln((char *)rx_buf + strlen((const char *)rx_buf)+1);
-                rx_file_remaining = strtoul(
-                    (char *)&rx_buf[strlen((const char *)rx_buf)+1], NULL, 10);
-                dbprint("rx_file_remaining=");
-                dbprintln(rx_file_remaining);
-              }
-              else {
-                dbprintln("rx file open failed");
-              }
-            }
-            else {
-              rxmodem_state = IDLE;
-            }
-          }
-        }
-        else {
-          dbprintln("Checksum bad");
-          port->write(NAK);
-          port->flush();
-          rxmodem_state = BLOCKSTART;
-        }
+        check_data(rx_crc_in | inchar);
         break;
       case DATAPURGE:
-        dbprintln("DATAPURGE");
-        int bytesAvail = port->available();
-        dbprint("bytesAvail=");
-        dbprintln(bytesAvail);
+        int bytesAvail = lp_room(port->available());
         if (bytesAvail > 0) {
-          port->readBytes((char *)p, bytesAvail);
+          lp_bytes += port->readBytes((char *)rx_buf, min(bytesAvail, rx_buf_size));
         }
         break;
     }
+#if XYMODEM_TRACE > 0
+    // Steps through a block, and back to BLOCKSTART after its check, are
+    // implied by the XYT_BLOCK or XYT_BADCHK that ends it.
+    if (rxmodem_state != prev_state &&
+        (rxmodem_state < BLOCKNUM || rxmodem_state > DATACHECKCRC) &&
+        !(rxmodem_state == BLOCKSTART && prev_state >= DATACHECK && prev_state <= DATACHECKCRC)) {
+      trace(XYT_STATE, rxmodem_state, prev_state);
+    }
+#endif
   } // while available()
+  ctl_flush();
   return rxmodem_state;
 }
 
-inline uint16_t XYmodem::updcrc(uint8_t c, uint16_t crc)
+/*
+ * Called after SOH/STX. If the whole rest of the frame is already
+ * buffered, read it with one readBytes() per part and check it in one
+ * pass instead of going around the state machine per byte. Otherwise
+ * leave it to the state machine.
+ */
+void XYmodem::read_frame(void)
+{
+  uint8_t head[2];
+  uint8_t tail[2];
+  int checklen = (CRC_on) ? 2 : 1;
+
+  if (lp_room(port->available()) < 2 + rx_blocklen + checklen) return;
+  lp_bytes += 2 + rx_blocklen + checklen;
+  port->readBytes((char *)head, 2);
+  rx_block = head[0];
+  check_blocknum(head[1]);
+  if (rxmodem_state != DATABLOCK) return;
+  int n = port->readBytes((char *)rx_buf, rx_blocklen);
+  rx_p = rx_buf + n;
+  rx_left = rx_blocklen - n;
+  if (CRC_on) {
+    rx_crc = xycrc16(0, rx_buf, n);
+  }
+  else {
+    rx_sum = xysum8(0, rx_buf, n);
+  }
+  if (rx_left > 0 || port->readBytes((char *)tail, checklen) != (size_t)checklen) {
+    // Short read, carry on byte by byte.
+    if (rx_left == 0) rxmodem_state = DATACHECK;
+    return;
+  }
+  check_data((CRC_on) ? (tail[0] << 8 | tail[1]) : tail[0]);
+}
+
+/*
+ * rx_block holds the block number, cmp should be its complement. Start
+ * receiving the data if it is the block expected, the previous one again,
+ * or a YMODEM header. Otherwise purge the rest of the frame and NAK, or
+ * cancel if the sender cannot retransmit.
+ */
+void XYmodem::check_blocknum(uint8_t cmp)
+{
+  if ((uint8_t)(cmp ^ rx_block) == 0xFF) {
+    if ((rx_block == next_block) ||
+        (!streaming && (rx_block == (next_block-1))) ||
+        (YMODEM && rx_block == 0 && !rx_open)) {
+      rx_p = rx_buf;
+      rx_sum = 0;
+      rx_crc = 0;
+      rxmodem_state = DATABLOCK;
+    }
+    else if (streaming) {
+      XYTRACE(XYT_SEQ, rx_block, next_block);
+      cancel();
+    }
+    else {
+      XYTRACE(XYT_SEQ, rx_block, next_block);
+      reply = CAN;
+      rxmodem_state = DATAPURGE;
+    }
+  }
+  else if (streaming) {
+    XYTRACE(XYT_BADCHK, rx_block, 1);
+    cancel();
+  }
+  else {
+    XYSTAT(rx_stats.blocks_nak++);
+    XYTRACE(XYT_BADCHK, rx_block, 1);
+    reply = NAK;
+    rxmodem_state = DATAPURGE;
+  }
+}
+
+/*
+ * Compare the received checksum or CRC with the one computed over the
+ * data. Accept the block, NAK it, or cancel YMODEM-G.
+ */
+void XYmodem::check_data(uint16_t check)
+{
+  if ((CRC_on) ? (check == rx_crc) : (check == rx_sum)) {
+    accept_block(rx_block, rx_blocklen);
+  }
+  else if (streaming) {
+    dbprintln("CRC bad, cancel");
+    XYTRACE(XYT_BADCHK, rx_block, 0);
+    cancel();
+  }
+  else {
+    dbprintln("Checksum bad");
+    XYSTAT(rx_stats.blocks_nak++);
+    XYTRACE(XYT_BADCHK, rx_block, 0);
+    ctl(NAK);
+    rtt_send();
+    rxmodem_state = BLOCKSTART;
+  }
+}
+
+/*
+ * The block passed its checksum or CRC. ACK it then either open the file
+ * named in a YMODEM header or queue the payload for writing. Duplicates of
+ * the previous block are ACKed and dropped. YMODEM-G does not ACK blocks.
+ */
+void XYmodem::accept_block(uint8_t block, uint16_t blocksize)
+{
+  if (!streaming) {
+    ctl(ACK);
+    rtt_send();
+  }
+  rxmodem_state = BLOCKSTART;
+  if (YMODEM && block == 0 && !rx_open) {
+    XYSTAT(block_time());
+    XYTRACE(XYT_BLOCK, block, 0);
+    header_block();
+  }
+  else if (block == next_block) {
+    dbprintln("Good block");
+    next_block++;
+    uint16_t bytesOut = min(blocksize, rx_file_remaining);
+    XYSTAT(block_time(); rx_stats.bytes_rx += bytesOut);
+    XYTRACE(XYT_BLOCK, block, bytesOut);
+    // The ACK goes before a write that may take a while.
+    ctl_flush();
+    queue_block(bytesOut);
+    rx_file_remaining -= bytesOut;
+    dbprint("rx_file_remaining="); dbprint(rx_file_remaining);
+    dbprint(" bytesOut="); dbprintln(bytesOut);
+    arm_timer(rto_ms);
+    // A YMODEM-G sender never retransmits, so a stall mid file is fatal.
+    if (streaming) reply = CAN;
+  }
+  else {
+    XYSTAT(rx_stats.blocks_dup++);
+    XYTRACE(XYT_DUP, block, 0);
+  }
+}
+
+#if XYMODEM_STATS
+/*
+ * Count a good block and how long it took to arrive.
+ */
+void XYmodem::block_time(void)
+{
+  uint32_t us = micros() - rx_block_start;
+  rx_stats.blocks_ok++;
+  rx_stats.block_us_total += us;
+  if (us < rx_stats.block_us_min) rx_stats.block_us_min = us;
+  if (us > rx_stats.block_us_max) rx_stats.block_us_max = us;
+}
+#endif
+
+/*
+ * YMODEM block 0: file name, NUL, then the decimal file size and optional
+ * fields separated by spaces. An empty name ends the batch.
+ */
+void XYmodem::header_block(void)
+{
+  if (rx_buf[0] == '\0') {
+    rxmodem_state = IDLE;
+    return;
+  }
+  if (!open_file()) {
+    cancel();
+    return;
+  }
+  next_block = 1;
+  reply = request_char();
+  ctl(reply);
+  rtt_send();
+  arm_timer(rto_ms);
+  dbprintln("rxmodem starting");
+}
+
+/*
+ * Take the YMODEM/ZMODEM file information in rx_buf: name, NUL, decimal
+ * size, octal modification time and other fields separated by spaces.
+ * Create the file unless set_sync() finds it unchanged. Returns false if
+ * it cannot be created or does not fit, or for a ZMODEM file to skip.
+ */
+bool XYmodem::open_file(void)
+{
+  const char *name = (const char *)rx_buf;
+  const char *info = name + strlen(name) + 1;
+
+  dbprint("rx file name="); dbprintln(name);
+  // Without a size field write every block in full like XMODEM.
+  rx_file_remaining = (*info != '\0') ? strtoul(info, NULL, 10) : 0xFFFFFFFF;
+  dbprint("rx_file_remaining="); dbprintln(rx_file_remaining);
+  rx_resume = 0;
+#if XYMODEM_RESUME
+  rx_recheck = 0;
+#endif
+  strncpy(rx_filename, name, sizeof(rx_filename)-1);
+  rx_filename[sizeof(rx_filename)-1] = '\0';
+#if XYMODEM_DIGEST
+  // Not a field lrzsz sends. zmodem.cpp asks for the CRC with ZCRC instead.
+  const char *digest = strstr(info, " crc32:");
+  rx_digest_set = (digest != NULL);
+  if (rx_digest_set) rx_digest = strtoul(digest + 7, NULL, 16);
+  rx_crc32 = 0;
+#endif
+#if XYMODEM_SYNC
+  const char *mtime = strchr(info, ' ');
+  rx_file_size = rx_file_remaining;
+  rx_mtime = (mtime != NULL) ? strtoul(mtime, NULL, 8) : 0;
+  syncverdict_t verdict = sync_check();
+  if (verdict == SYNC_SKIP) return sync_skip();
+  // A sender that sends ZFILE again rather than answer ZCRC gets the file
+  // received.
+  if (verdict == SYNC_ASK && !sync_wait) {
+    sync_wait = true;
+    return true;
+  }
+  sync_wait = false;
+#endif
+  return create_file();
+}
+
+/*
+ * Create the file named in rx_filename. A file that the journal says was
+ * partly received is kept and rx_resume is set to where it should
+ * continue. A YMODEM sender sends that part again, to be checked.
+ */
+bool XYmodem::create_file(void)
+{
+#if XYMODEM_UNPACK
+  // Packed files are opened when their header arrives, and never resumed.
+  if (unpack_begin()) {
+    rx_open = true;
+    return true;
+  }
+#endif
+#if XYMODEM_RESUME
+  bool journal = (sink == &file_sink);
+  // Resuming a file that fits in one journal interval would save less
+  // than the journal costs. YMODEM only saves the writes, so always.
+  bool short_file = (rx_file_remaining <= XYMODEM_JOURNAL_INTERVAL);
+  if (!zmodem && short_file) journal = false;
+#if XYMODEM_BATCH
+  if (batch_on && short_file) journal = false;
+#endif
+  if (journal) rx_resume = journal_resume(rx_filename, rx_file_remaining);
+#endif
+  if (rx_resume > 0) {
+    if (file_sink.reopen(rx_filename, rx_resume)) {
+      dbprint("rx resume at "); dbprintln(rx_resume);
+      rx_open = true;
+      XYTRACE(XYT_OPEN, 1, min(rx_file_remaining >> 10, (uint32_t)0xFFFF));
+#if XYMODEM_RESUME
+      journal_begin(jr.flags);
+#if XYMODEM_DIGEST
+      rx_crc32 = jr.crc;
+#endif
+      if (!zmodem) {
+        rx_recheck = rx_resume;
+        rx_recheck_crc = 0;
+      }
+#endif
+      return true;
+    }
+    rx_resume = 0;
+  }
+  if (!sink->open(rx_filename, rx_file_remaining)) {
+    dbprintln("rx file open failed or does not fit");
+    return false;
+  }
+  rx_open = true;
+  XYTRACE(XYT_OPEN, 0, min(rx_file_remaining >> 10, (uint32_t)0xFFFF));
+#if XYMODEM_RESUME
+  if (journal) {
+    bool full = (rx_file_remaining != 0xFFFFFFFF && file_sink.file.size() == rx_file_remaining);
+    journal_begin((full) ? JOURNAL_PREALLOCATED : 0);
+  }
+#endif
+  return true;
+}
+
+/*
+ * Forget the round trip estimate, e.g. for a new session on another port.
+ */
+void XYmodem::rtt_reset(void)
+{
+  srtt_us = rttvar_us = 0;
+  rtt_pending = false;
+  rto_backoff = 0;
+  rto_ms = TIMEOUT_LONG;
+  rto_update();
+}
+
+/*
+ * An ACK, NAK or request just went out. The sender's answer starts the
+ * next block. YMODEM-G has no answers to time.
+ */
+void XYmodem::rtt_send(void)
+{
+  if (streaming) return;
+  rtt_sent = micros();
+  rtt_pending = true;
+}
+
+/*
+ * The first byte of an answer arrived. Fold the round trip into the
+ * smoothed estimate the RFC 6298 way.
+ */
+void XYmodem::rtt_sample(void)
+{
+  if (!rtt_pending) return;
+  rtt_pending = false;
+  uint32_t r = micros() - rtt_sent;
+  if (srtt_us == 0) {
+    srtt_us = max(r, (uint32_t)1);
+    rttvar_us = r / 2;
+  }
+  else {
+    uint32_t err = (r > srtt_us) ? r - srtt_us : srtt_us - r;
+    rttvar_us = rttvar_us - rttvar_us / 4 + err / 4;
+    srtt_us = max(srtt_us - srtt_us / 8 + r / 8, (uint32_t)1);
+  }
+  rto_backoff = 0;
+  XYSTAT(rx_stats.rtt_samples++);
+  rto_update();
+}
+
+/*
+ * Nothing came back in time. Double the timeout, and do not time the
+ * answer to the repeat since it may be the late answer to the original
+ * (Karn's algorithm).
+ */
+void XYmodem::rto_timeout(void)
+{
+  rtt_pending = false;
+  if (srtt_us != 0 && rto_backoff < 8) rto_backoff++;
+  rto_update();
+}
+
+/*
+ * RTO = SRTT + 4 * RTTVAR, at least 1 ms of variation, within
+ * XYMODEM_RTO_MIN..XYMODEM_RTO_MAX, doubled per timeout in a row.
+ */
+void XYmodem::rto_update(void)
+{
+  uint32_t rto = TIMEOUT_LONG;
+  if (srtt_us != 0) {
+    rto = (srtt_us + max(4 * rttvar_us, (uint32_t)1000) + 999) / 1000;
+    rto = max(rto, (uint32_t)XYMODEM_RTO_MIN) << rto_backoff;
+    rto = min(rto, (uint32_t)XYMODEM_RTO_MAX);
+  }
+  if (rto != rto_ms) {
+    XYTRACE(XYT_RTO, rto_backoff, min(rto, (uint32_t)0xFFFF));
+  }
+  rto_ms = rto;
+  XYSTAT(rx_stats.srtt_us = srtt_us; rx_stats.rttvar_us = rttvar_us; rx_stats.rto_ms = rto_ms);
+}
+
+/*
+ * Character that asks the sender to start: G for YMODEM-G, C for CRC,
+ * NAK for checksum.
+ */
+uint8_t XYmodem::request_char(void)
 {
-  int count;
+  if (streaming) return 'G';
+  return (CRC_on)? 'C' : NAK;
+}
 
-  crc = crc ^ (uint16_t) c << 8;
-  count = 8;
-  do {
-    if (crc & 0x8000) {
-      crc = crc << 1 ^ 0x1021;
+/*
+ * Tell the sender to give up.
+ */
+void XYmodem::cancel(void)
+{
+  XYSTAT(rx_stats.cans++);
+  XYTRACE(XYT_CAN, 0, 0);
+  ctl(CAN);
+  ctl(CAN);
+  ctl_flush();
+  rxmodem_state = IDLE;
+}
+
+/*
+ * Hand the block in rx_buf to the commit ring and move rx_buf to the next
+ * free buffer. If every buffer is still waiting for the file, write out
+ * the oldest one now.
+ */
+void XYmodem::queue_block(uint16_t len)
+{
+  if (len == 0) return;
+  rx_pending_len[rx_fill] = len;
+  rx_pending++;
+  rx_fill = (rx_fill + 1) % XYMODEM_RX_BUFFERS;
+  // A limited loop() leaves the write to the next call, which does it
+  // before reading anything into rx_buf.
+  while (rx_pending == XYMODEM_RX_BUFFERS && !lp_limited()) {
+    commit_blocks(rx_buf_size);
+  }
+  rx_buf = rx_pool + rx_fill * rx_buf_size;
+}
+
+/*
+ * Write up to max_bytes of queued blocks to the file, oldest first.
+ */
+void XYmodem::commit_blocks(uint32_t max_bytes)
+{
+  while (rx_pending > 0 && max_bytes > 0) {
+    uint8_t *buf = rx_pool + rx_commit * rx_buf_size;
+    uint16_t len = min((uint32_t)(rx_pending_len[rx_commit] - rx_commit_offset), max_bytes);
+    write_data(buf + rx_commit_offset, len);
+    max_bytes -= len;
+    rx_commit_offset += len;
+    if (rx_commit_offset >= rx_pending_len[rx_commit]) {
+      rx_commit_offset = 0;
+      rx_commit = (rx_commit + 1) % XYMODEM_RX_BUFFERS;
+      rx_pending--;
+    }
+  }
+}
+
+/*
+ * Verified data on its way to the file, expanded first if it is packed.
+ * Dropped if set_sync() found the file unchanged, or if a YMODEM sender is
+ * sending again what a resumed file already holds.
+ */
+void XYmodem::write_data(const uint8_t *buf, uint16_t len)
+{
+  // Refused or cancelled part way.
+  if (!rx_open) return;
+#if XYMODEM_RESUME
+  if (rx_recheck > 0) {
+    uint16_t n = min((uint32_t)len, rx_recheck);
+    if (!journal_recheck(buf, n) || n == len) return;
+    buf += n;
+    len -= n;
+  }
+#endif
+#if XYMODEM_SYNC
+  if (rx_skip) return;
+  // The index wants the CRC-32 even when the sender gives none.
+  if (rx_digest_set || sync_file) rx_crc32 = xycrc32(rx_crc32, buf, len);
+#elif XYMODEM_DIGEST
+  if (rx_digest_set) rx_crc32 = xycrc32(rx_crc32, buf, len);
+#endif
+#if XYMODEM_UNPACK
+  if (uz_state != UZ_OFF) {
+    unpack(buf, len);
+    return;
+  }
+#endif
+  write_file(buf, len);
+}
+
+/*
+ * Write to the file in XYMODEM_WRITE_COALESCE sized chunks. The file
+ * always starts empty so chunks stay aligned to the sector size. Whole
+ * chunks are written straight from buf when nothing is buffered. Other
+ * sinks get every block straight from the receive buffers.
+ */
+void XYmodem::write_file(const uint8_t *buf, uint16_t len)
+{
+  wr_calls_in++;
+#if XYMODEM_WRITE_COALESCE > 0
+  if (sink != &file_sink) {
+    write_out(buf, len);
+    return;
+  }
+  while (len > 0) {
+    uint16_t n;
+    if (wr_len == 0 && len >= XYMODEM_WRITE_COALESCE) {
+      n = len - (len % XYMODEM_WRITE_COALESCE);
+      write_out(buf, n);
     }
     else {
-      crc = crc << 1;
+      n = min(len, (uint16_t)(XYMODEM_WRITE_COALESCE - wr_len));
+      memcpy(wr_buf + wr_len, buf, n);
+      wr_len += n;
+      if (wr_len == XYMODEM_WRITE_COALESCE) {
+        write_out(wr_buf, wr_len);
+        wr_len = 0;
+      }
     }
-  } while (--count);
-  return crc;
+    buf += n;
+    len -= n;
+  }
+#else
+  write_out(buf, len);
+#endif
+}
+
+/*
+ * All file data goes through here. Keeps the journal's byte count and
+ * CRC-32 in step with the file.
+ */
+void XYmodem::write_out(const uint8_t *buf, uint16_t len)
+{
+#if XYMODEM_STATS
+  uint32_t t0 = micros();
+  sink->write(buf, len);
+  uint32_t us = micros() - t0;
+  uint8_t bucket = 0;
+  for (uint32_t t = us / 250; t > 0 && bucket < XYMODEM_WRITE_BUCKETS - 1; t >>= 1) bucket++;
+  rx_stats.write_hist[bucket]++;
+  rx_stats.write_us += us;
+  if (us > rx_stats.write_us_max) rx_stats.write_us_max = us;
+  rx_stats.bytes_committed += len;
+  XYTRACE(XYT_WRITE, min(us >> 6, (uint32_t)255), len);
+#else
+  sink->write(buf, len);
+  XYTRACE(XYT_WRITE, 0, len);
+#endif
+  wr_calls_out++;
+#if XYMODEM_RESUME
+  if (rxjournal) {
+    jr.crc = xycrc32(jr.crc, buf, len);
+    jr.committed += len;
+    if (jr.committed - jr_logged >= XYMODEM_JOURNAL_INTERVAL) journal_log();
+  }
+#endif
 }
 
+/*
+ * Write everything still queued or coalesced, e.g. on EOT.
+ */
+void XYmodem::finish_file(void)
+{
+  commit_blocks(0xFFFFFFFF);
+#if XYMODEM_UNPACK
+  // Too short to be packed. Store it as it is.
+  if (uz_state == UZ_HEADER) unpack_open();
+#endif
+  if (wr_len > 0) {
+    write_out(wr_buf, wr_len);
+    wr_len = 0;
+  }
+#if XYMODEM_RESUME
+  if (rxjournal && jr.committed != jr_logged) journal_log();
+#endif
+}
+
+/*
+ * Write out and close the file. If it was cut off part way the journal is
+ * kept so the transfer can be resumed. Without XYMODEM_ATOMIC any other
+ * file that is not complete is removed.
+ */
+void XYmodem::close_file(bool complete)
+{
+  if (!rx_open) return;
+  finish_file();
+#if XYMODEM_SYNC
+  if (rx_skip) {
+    rx_skip = false;
+    rx_open = false;
+    return;
+  }
+#endif
+#if XYMODEM_UNPACK
+  // The sink refused a packed file.
+  if (!rx_open) return;
+  if (uz_state == UZ_DATA) {
+    dbprintln("packed file ends early");
+    complete = false;
+  }
+  uz_state = UZ_OFF;
+#endif
+#if XYMODEM_DIGEST
+  bool bad_digest = (complete && rx_digest_set && rx_crc32 != rx_digest);
+  if (bad_digest) {
+    dbprintln("file CRC-32 does not match");
+    XYSTAT(rx_stats.bad_digests++);
+    complete = false;
+  }
+  XYTRACE(XYT_CLOSE, (bad_digest) ? 2 : complete, 0);
+#else
+  XYTRACE(XYT_CLOSE, complete, 0);
+#endif
+  if (complete) {
+    sink->commit();
+  }
+  else {
+    sink->abort();
+  }
+  rx_open = false;
+#if XYMODEM_SYNC
+  if (complete && sync_file) sync_record(rx_crc32);
+  sync_file = false;
+#endif
+  XYSTAT(if (complete) rx_stats.files++);
+#if XYMODEM_RESUME || !XYMODEM_ATOMIC
+  bool resumable = false;
+#endif
+#if XYMODEM_RESUME
+  // Sent again, a file that failed its CRC-32 would only fail again.
+  resumable = (!complete && rxjournal);
+#if XYMODEM_DIGEST
+  if (bad_digest) resumable = false;
+#endif
+  if (resumable) {
+    rxjournal.close();
+  }
+  else {
+    journal_end();
+  }
+#endif
+#if !XYMODEM_ATOMIC
+  // It is under its real name, so do not leave it there part written.
+  if (!complete && !resumable && sink == &file_sink) filesys->remove(rx_filename);
+#endif
+}
+
+#if XYMODEM_RESUME
+/*
+ * Look for a journal entry for name and size. If there is one and the
+ * file still holds the bytes it describes, return how many, else 0. jr is
+ * left holding the entry.
+ */
+uint32_t XYmodem::journal_resume(const char *name, uint32_t size)
+{
+  xyjournal_t entry;
+  uint8_t buf[256];
+  bool found = false;
+
+  File j = filesys->open(jr_path, FILE_READ);
+  if (!j) return 0;
+  while (j.read(&entry, sizeof(entry)) == sizeof(entry)) {
+    if (entry.magic == JOURNAL_MAGIC &&
+        entry.check == xycrc32(0, (uint8_t *)&entry, offsetof(xyjournal_t, check))) {
+      jr = entry;
+      found = true;
+    }
+  }
+  j.close();
+  if (!found || jr.committed == 0 || jr.committed > size || jr.size != size ||
+      strncmp(jr.name, name, sizeof(jr.name)-1) != 0) {
+    return 0;
+  }
+
+  File f = filesys->open(file_sink.temp_name(name), FILE_READ);
+  if (!f) return 0;
+  // Without preallocation the SD library appends every write, so the file
+  // must end exactly where the journal does.
+  if (f.size() < jr.committed ||
+      (!(jr.flags & JOURNAL_PREALLOCATED) && f.size() != jr.committed)) {
+    f.close();
+    return 0;
+  }
+  uint32_t crc = 0;
+  uint32_t left = jr.committed;
+  while (left > 0) {
+    int n = f.read(buf, min(left, (uint32_t)sizeof(buf)));
+    if (n <= 0) break;
+    crc = xycrc32(crc, buf, n);
+    left -= n;
+  }
+  f.close();
+  if (left != 0 || crc != jr.crc) {
+    dbprintln("journal does not match file");
+    return 0;
+  }
+  return jr.committed;
+}
+
+/*
+ * Start a fresh journal for the file just opened. jr.committed and jr.crc
+ * already describe the bytes in it.
+ */
+void XYmodem::journal_begin(uint32_t flags)
+{
+  if (rx_resume == 0) {
+    jr.committed = 0;
+    jr.crc = 0;
+  }
+  jr.magic = JOURNAL_MAGIC;
+  jr.size = rx_file_remaining;
+  jr.flags = flags;
+  memset(jr.name, 0, sizeof(jr.name));
+  strcpy(jr.name, rx_filename);
+  if (rxjournal) rxjournal.close();
+  filesys->remove((char *)jr_path);
+  rxjournal = filesys->open(jr_path, FILE_WRITE);
+  if (rxjournal) journal_log();
+}
+
+/*
+ * Flush the file, then append an entry saying how much of it is there.
+ */
+void XYmodem::journal_log(void)
+{
+  file_sink.file.flush();
+  jr.check = xycrc32(0, (uint8_t *)&jr, offsetof(xyjournal_t, check));
+  rxjournal.write((uint8_t *)&jr, sizeof(jr));
+  rxjournal.flush();
+  jr_logged = jr.committed;
+}
+
+/*
+ * The file is complete, nothing to resume.
+ */
+void XYmodem::journal_end(void)
+{
+  if (!rxjournal) return;
+  rxjournal.close();
+  filesys->remove((char *)jr_path);
+}
+
+/*
+ * len bytes a YMODEM sender sent again of a resumed file. Once all of
+ * them are in, their CRC-32 must be the journal's. If it is not, the
+ * sender has a different file: it is cancelled, and the partial file and
+ * the journal removed so the next try starts from the beginning.
+ */
+bool XYmodem::journal_recheck(const uint8_t *buf, uint16_t len)
+{
+  rx_recheck_crc = xycrc32(rx_recheck_crc, buf, len);
+  rx_recheck -= len;
+  if (rx_recheck > 0 || rx_recheck_crc == jr.crc) return true;
+  dbprintln("file differs from the journal");
+  journal_end();
+  sink->abort();
+  filesys->remove((char *)file_sink.temp_name(rx_filename));
+  rx_open = false;
+  cancel();
+  return false;
+}
+#endif
+
 #if defined(ADAFRUIT_SPIFLASH)
 void XYmodem::format_flash() {
   // Partition the flash with 1 partition that takes the entire space.
@@ -474,3 +1211,75 @@ int XYmodem::begin()
   }
   return 0;
 }
+
+/*
+ * Use buffers owned by a subclass instead of malloc: pool holds
+ * XYMODEM_RX_BUFFERS blocks of up to block bytes, wr holds
+ * XYMODEM_WRITE_COALESCE bytes.
+ */
+void XYmodem::use_buffers(uint8_t *pool, uint16_t block, uint8_t *wr)
+{
+  rx_pool = pool;
+  rx_pool_block = block;
+  wr_buf = wr;
+  fixed_buffers = true;
+}
+
+/*
+ * Add a receiver. Returns false if XYMODEM_MUX_MAX are already added.
+ */
+bool XYmodemMux::add(XYmodem *rx)
+{
+  if (count >= XYMODEM_MUX_MAX) return false;
+  this->rx[count++] = rx;
+  return true;
+}
+
+/*
+ * Give every receiver one loop() turn. The receiver that goes first moves
+ * round each call so none is always last. Returns how many are busy.
+ */
+int XYmodemMux::loop(uint32_t budget_us)
+{
+  int busy = 0;
+  // A share of 0 would mean no limit.
+  uint32_t share = (budget_us > 0 && count > 0) ? max(budget_us / count, (uint32_t)1) : 0;
+  for (uint8_t i = 0; i < count; i++) {
+    if (rx[(first + i) % count]->loop(share) != 0) busy++;
+  }
+  if (count > 0) first = (first + 1) % count;
+  return busy;
+}
+
+#if XYMODEM_TRACE > 0
+static void print_hex(Print *out, uint32_t value, uint8_t digits)
+{
+  while (digits-- > 0) out->print((value >> (4 * digits)) & 0xF, HEX);
+}
+#endif
+
+/*
+ * One line per entry, "us ev a b" in fixed width hex, after a
+ * "XYTRACE <entries>" line. Entries lost to wrap around are not counted.
+ */
+void XYmodem::trace_dump(Print *out)
+{
+#if XYMODEM_TRACE > 0
+  uint32_t n = min(trace_next, (uint32_t)XYMODEM_TRACE);
+  out->print("XYTRACE ");
+  out->println(n);
+  for (uint32_t i = trace_next - n; i != trace_next; i++) {
+    const xytrace_t *t = &trace_ring[i % XYMODEM_TRACE];
+    print_hex(out, t->us, 8);
+    out->print(' ');
+    print_hex(out, t->ev, 2);
+    out->print(' ');
+    print_hex(out, t->a, 2);
+    out->print(' ');
+    print_hex(out, t->b, 4);
+    out->println();
+  }
+#else
+  out->println("XYTRACE 0");
+#endif
+}
@@ -109,6 +109,292 @@ extern Adafruit_W25Q16BV_FatFs fatfs;
 #define XMODEM_PORT Serial
 #endif
 
+// Number of block buffers. While one buffer is filled from the port the
+// others hold verified blocks waiting to be written to the file.
+#if !defined(XYMODEM_RX_BUFFERS)
+#define XYMODEM_RX_BUFFERS 2
+#endif
+
+// Bytes written to the file per loop() call while the port is quiet.
+#if !defined(XYMODEM_COMMIT_CHUNK)
+#define XYMODEM_COMMIT_CHUNK 512
+#endif
+
+// Received data is gathered into chunks of this many bytes before it is
+// written to the file so writes line up with flash erase sectors or SD
+// sectors. 0 writes every block as it arrives.
+#if !defined(XYMODEM_WRITE_COALESCE)
+#if defined(ADAFRUIT_SPIFLASH)
+#define XYMODEM_WRITE_COALESCE 4096
+#else
+#define XYMODEM_WRITE_COALESCE 512
+#endif
+#endif
+
+// Use the YMODEM file size to reserve space for the whole file before the
+// first data block, and cancel at once if it does not fit. Works where
+// seeking past the end of a file extends it (FatFs on SPI/QSPI Flash).
+#if !defined(XYMODEM_PREALLOCATE)
+#define XYMODEM_PREALLOCATE 1
+#endif
+
+// FATFILESYS_CLASS has rename(from, to), as SdFat based SD libraries do.
+// Without it XYMODEM_ATOMIC copies the files it would rename. FatFs on
+// SPI/QSPI Flash always renames.
+#if !defined(XYMODEM_FS_RENAME)
+#define XYMODEM_FS_RENAME 0
+#endif
+
+// Write each file under a temporary name, KEYMACRO.TX$ for KEYMACRO.TXT,
+// and only move it to the real name when it is complete, so a cut off or
+// damaged transfer leaves the old file as it was. The old file is moved to
+// KEYMACRO.TX! first and removed once the new one is in place. With the SD
+// library each move is a copy, which reads and writes the file once more,
+// see xybench. Set it to 0 to write in place; a file that is not complete
+// is then removed, unless XYMODEM_RESUME can continue it.
+#if !defined(XYMODEM_ATOMIC)
+#define XYMODEM_ATOMIC 1
+#endif
+
+// Keep a CRC-32 of each file as it arrives and compare it with the
+// sender's: a crc32:<hex> field in the YMODEM block 0, or for ZMODEM the
+// answer to a ZCRC request. A file that does not match is not committed.
+#if !defined(XYMODEM_DIGEST)
+#define XYMODEM_DIGEST 1
+#endif
+
+// Compile in the sync mode turned on with set_sync(): a file that is
+// already on the file system, unchanged, is skipped instead of received
+// again. See xysync.cpp.
+#if !defined(XYMODEM_SYNC)
+#define XYMODEM_SYNC 1
+#endif
+#if XYMODEM_SYNC && !XYMODEM_DIGEST
+#error "XYMODEM_SYNC needs XYMODEM_DIGEST"
+#endif
+
+// Index of the size, modification time and CRC-32 of the files received in
+// sync mode. 8.3 name so it works with the SD library.
+#if !defined(XYMODEM_SYNC_INDEX)
+#define XYMODEM_SYNC_INDEX "/XYSYNC.IDX"
+#endif
+
+// Index entries, one appended each time a file is recorded, before the
+// index is compacted to one entry per name. Without XYMODEM_FS_RENAME the
+// compacted index is copied back.
+#if !defined(XYMODEM_SYNC_COMPACT)
+#define XYMODEM_SYNC_COMPACT 64
+#endif
+
+// Compile in the batch mode turned on with set_batch(), for YMODEM and
+// ZMODEM batches of many small files.
+#if !defined(XYMODEM_BATCH)
+#define XYMODEM_BATCH 1
+#endif
+
+// Bytes in the bitmap batch mode hashes the names in the target directory
+// into. A clear bit means no file there has a name with that hash.
+#if !defined(XYMODEM_DIR_CACHE)
+#define XYMODEM_DIR_CACHE 128
+#endif
+
+// Receive buffer size announced in the ZMODEM ZRINIT. 0 lets the sender
+// stream a whole file without waiting. Otherwise the sender waits for a
+// ZACK after every XYMODEM_ZRXBUF bytes, which bounds the data in flight.
+#if !defined(XYMODEM_ZRXBUF)
+#define XYMODEM_ZRXBUF 0
+#endif
+
+// Keep a journal of how much of the file being received is safely in the
+// file, with a CRC-32 of it. When the sender offers the same file again
+// after a crash or lost link, the receiver checks the part already written
+// against the journal. A ZMODEM sender is asked to resume after it. A
+// YMODEM sender cannot skip ahead, so it sends that part again and the
+// receiver checks its CRC-32 against the journal instead of writing it.
+#if !defined(XYMODEM_RESUME)
+#define XYMODEM_RESUME 1
+#endif
+
+// File bytes between journal entries. Each entry flushes the file.
+#if !defined(XYMODEM_JOURNAL_INTERVAL)
+#define XYMODEM_JOURNAL_INTERVAL 32768
+#endif
+
+// 8.3 name so it works with the SD library.
+#if !defined(XYMODEM_JOURNAL)
+#define XYMODEM_JOURNAL "/XYRESUME.JNL"
+#endif
+
+// XYflashSink keeps erasing up to this many bytes ahead of the data while
+// blocks arrive, so a page is already blank when it is programmed. 0
+// erases a sector or 64K block only when a page needs it; xybench shows
+// the receive buffers hide that wait as well at 115200 and 1 Mbit/s.
+#if !defined(XYMODEM_ERASE_AHEAD)
+#define XYMODEM_ERASE_AHEAD 0
+#endif
+
+// Expand files sent packed by extras/host/xypack as they are written. A
+// packed file's name ends in '_' in place of the last character, as with
+// MS-DOS compress, e.g. KEYMACRO.TX_ is stored as KEYMACRO.TXT. Only data
+// that starts with the xypack header is expanded; any other file with such
+// a name is stored as it is.
+#if !defined(XYMODEM_UNPACK)
+#define XYMODEM_UNPACK 0
+#endif
+
+// Largest LZSS window, in bits, a packed file may use. The window is kept
+// in the XYmodem object, 1 << XYMODEM_UNPACK_WINDOW bytes.
+#if !defined(XYMODEM_UNPACK_WINDOW)
+#define XYMODEM_UNPACK_WINDOW 10
+#endif
+#if XYMODEM_UNPACK_WINDOW < 4 || XYMODEM_UNPACK_WINDOW > 14
+#error "XYMODEM_UNPACK_WINDOW must be 4 to 14"
+#endif
+
+// Compile in the XMODEM/YMODEM sender, start_sx() and start_sb(). See
+// xysend.cpp.
+#if !defined(XYMODEM_SEND)
+#define XYMODEM_SEND 1
+#endif
+
+// Most receivers one XYmodemMux can run.
+#if !defined(XYMODEM_MUX_MAX)
+#define XYMODEM_MUX_MAX 4
+#endif
+
+// Logical channels one XYlink carries over a port, see xylink.h.
+#if !defined(XYMODEM_LINK_CHANNELS)
+#define XYMODEM_LINK_CHANNELS 4
+#endif
+
+// The channel travels in the low nibble of the frame header.
+#if XYMODEM_LINK_CHANNELS < 1 || XYMODEM_LINK_CHANNELS > 16
+#error "XYMODEM_LINK_CHANNELS must be 1 to 16"
+#endif
+
+// Receive buffer bytes per XYlink channel. This is also how far the other
+// end may send ahead of read(), so it should cover the link's round trip.
+#if !defined(XYMODEM_LINK_RX)
+#define XYMODEM_LINK_RX 512
+#endif
+
+// Transmit buffer bytes per XYlink channel.
+#if !defined(XYMODEM_LINK_TX)
+#define XYMODEM_LINK_TX 256
+#endif
+
+// Most payload bytes in one XYlink frame, up to 255. Smaller frames
+// interleave the channels more finely but cost more in headers.
+#if !defined(XYMODEM_LINK_FRAME)
+#define XYMODEM_LINK_FRAME 128
+#endif
+#if XYMODEM_LINK_FRAME < 1 || XYMODEM_LINK_FRAME > 255
+#error "XYMODEM_LINK_FRAME must be 1 to 255"
+#endif
+
+// Bounds for the retransmit timeout, in ms. The receiver measures the time
+// from each ACK/NAK to the start of the sender's answer and times out after
+// the smoothed round trip plus four times its variation, as TCP does
+// (RFC 6298). Until the first measurement, and for YMODEM-G where a
+// timeout is fatal, it uses 3 s.
+#if !defined(XYMODEM_RTO_MIN)
+#define XYMODEM_RTO_MIN 50
+#endif
+#if !defined(XYMODEM_RTO_MAX)
+#define XYMODEM_RTO_MAX 10000
+#endif
+
+// Keep transfer statistics, see XYmodem::stats(). Costs a few counters and
+// two micros() calls per block and per file write, so it is off unless
+// wanted for diagnosis.
+#if !defined(XYMODEM_STATS)
+#define XYMODEM_STATS 0
+#endif
+
+#if XYMODEM_STATS
+#define XYSTAT(...) __VA_ARGS__
+#else
+#define XYSTAT(...)
+#endif
+
+// Write latency histogram buckets. Bucket 0 counts writes under 250 us,
+// bucket n under 250 << n us, and the last bucket everything slower.
+#define XYMODEM_WRITE_BUCKETS 8
+
+typedef struct {
+  uint32_t bytes_rx;          // payload bytes in good blocks
+  uint32_t bytes_committed;   // bytes written to files
+  uint32_t files;             // files completed
+  uint32_t blocks_ok;         // good blocks/subpackets, headers included
+  uint32_t blocks_nak;        // bad blocks NAKed, or ZRPOS/ZNAK sent
+  uint32_t blocks_dup;        // repeated blocks dropped
+  uint32_t timeouts;
+  uint32_t cans;              // transfers cancelled by either side
+  uint32_t block_us_min;      // receive time of a good block, from its
+  uint32_t block_us_max;      // first byte to its check
+  uint32_t block_us_total;
+  uint32_t loop_us;           // time spent in loop(), writes included
+  uint32_t loop_us_max;       // longest single loop() call
+  uint32_t loop_calls;
+  uint32_t write_us;          // time spent writing file data
+  uint32_t write_us_max;
+  uint32_t write_hist[XYMODEM_WRITE_BUCKETS];
+  uint32_t rtt_samples;
+  uint32_t srtt_us;           // smoothed round trip
+  uint32_t rttvar_us;         // round trip variation
+  uint32_t rto_ms;            // timeout in use
+  uint32_t bad_digests;       // files whose CRC-32 did not match the sender's
+  uint32_t files_skipped;     // files left alone by set_sync() as unchanged
+  uint32_t bytes_tx;          // file bytes sent and acknowledged
+} xymodem_stats_t;
+
+// Entries in the binary trace ring, 8 bytes each, per receiver, e.g. 64.
+// Events cost one micros() call and a store. A power of two keeps the ring
+// index cheap. 0, the default, disables it.
+#if !defined(XYMODEM_TRACE)
+#define XYMODEM_TRACE 0
+#endif
+
+#if XYMODEM_TRACE > 0
+#define XYTRACE(ev, a, b) trace(ev, a, b)
+#else
+#define XYTRACE(ev, a, b)
+#endif
+
+// Trace events. extras/host/xytrace.cpp decodes them.
+enum xytrace_ev_t {
+  XYT_START = 1,    // a: 0 XMODEM, 1 YMODEM, 2 YMODEM-G, 3 ZMODEM, 4 XMODEM
+                    // send, 5 YMODEM send, b: block size
+  XYT_STATE,        // a: new rxmodem_t state, b: old state
+  XYT_BLOCK,        // good block, a: block number, b: bytes queued
+  XYT_BADCHK,       // a: block number, b: 0 checksum/CRC, 1 block number complement
+  XYT_DUP,          // a: block number
+  XYT_SEQ,          // block out of sequence, a: block number, b: expected
+  XYT_TIMEOUT,      // a: reply sent
+  XYT_CAN,          // a: 0 sent, 1 from the sender
+  XYT_EOT,
+  XYT_OPEN,         // a: 1 if resumed, 2 if unpacked, 3 if unchanged and
+                    // skipped, b: file size in KB
+  XYT_CLOSE,        // a: 1 if complete, 2 if the CRC-32 did not match
+  XYT_WRITE,        // a: microseconds / 64, 255 max, b: bytes
+  XYT_ZHDR,         // a: frame type, b: position bits 0-15
+  XYT_ZDATA,        // a: ZCRCx end, b: bytes
+  XYT_ZRPOS,        // a: position bits 16-23, b: bits 0-15
+  XYT_RTO,          // a: timeouts in a row, b: new timeout in ms
+  XYT_NAK,          // sending, a: block number the receiver NAKed
+};
+
+typedef struct {
+  uint32_t us;      // micros()
+  uint8_t ev;
+  uint8_t a;
+  uint16_t b;
+} xytrace_t;
+
+#include <xysink.h>
+#include <xylink.h>
+#include <xycapture.h>
+
 #define SOH 0x01
 #define STX 0x02
 #define EOT 0x04
@@ -120,33 +406,388 @@ class XYmodem {
   public:
     int start_rx(Stream *port, const char *rx_filename, bool rx_buf_1k, bool useCRC);
     int start_rb(Stream *port, void *filesys, bool rx_buf_1k, bool useCRC);
+    int start_rg(Stream *port, void *filesys);
+    int start_rz(Stream *port, void *filesys);
+#if XYMODEM_SEND
+    // Send the file path with XMODEM, or with YMODEM the file or every
+    // file in the directory path. The receiver chooses CRC or checksum.
+    // Blocks are 1K with CRC if the buffers allow, else 128 bytes.
+    int start_sx(Stream *port, void *filesys, const char *path);
+    int start_sb(Stream *port, void *filesys, const char *path);
+#endif
     int begin(void);
-    int loop(void);
+    int loop(void) { return loop(0, 0); }
+    // As loop(), but return after about budget_us microseconds or
+    // max_bytes bytes read from the port or written to make room,
+    // whichever comes first, 0 for no limit. A frame cut off part way
+    // carries on in the next call, and with every buffer full the next
+    // call writes before it reads. A call can still run past budget_us by
+    // one file write, plus a journal entry with XYMODEM_RESUME. YMODEM
+    // writes at most that much per call anyway, so for it the budget does
+    // not lower the longest call. Only the end of a file, its last writes
+    // and close, is not split.
+    int loop(uint32_t budget_us, uint32_t max_bytes = 0);
+    bool idle(void) { return rxmodem_state == IDLE; }
+    // Statistics since the last start. All zero if XYMODEM_STATS is 0.
+    const xymodem_stats_t &stats(void) { return rx_stats; }
+    // Write the trace ring, oldest entry first, as text for xytrace.
+    void trace_dump(Print *out);
+    // File writes avoided by XYMODEM_WRITE_COALESCE since the last start.
+    uint32_t writes_saved(void) { return (wr_calls_in > wr_calls_out) ? wr_calls_in - wr_calls_out : 0; }
+    // Journal file used by XYMODEM_RESUME. Receivers running at the same
+    // time need one each.
+    void set_journal(const char *path) { jr_path = path; }
+    // Send received files to sink instead of the file system, from the
+    // next start on. NULL goes back to files. XYMODEM_RESUME only works
+    // with files.
+    void set_sink(XYsink *sink) { this->sink = (sink) ? sink : &file_sink; }
+    // From the next start on, leave a file alone if the one already on the
+    // file system has the same size and either the same modification time
+    // or the same CRC-32 as the sender's. ZMODEM skips it; YMODEM cannot,
+    // so its data is still received, only not written. index keeps the
+    // time and CRC-32 of each file received. With NULL the CRC-32 is read
+    // from the file, and only a sender that gives one can be skipped. Only
+    // with files, see set_sink(). Needs XYMODEM_SYNC.
+    void set_sync(bool on, const char *index = XYMODEM_SYNC_INDEX) { sync_on = on; sync_path = index; }
+    // From the next start on, spend less file system time per file in a
+    // batch. The target directory is read once and remove() is skipped
+    // for names not in it, files no longer than XYMODEM_JOURNAL_INTERVAL
+    // get no journal, and the next file is asked for before the last one
+    // is closed. Nothing else may change the directory during the
+    // transfer. Only with files. Needs XYMODEM_BATCH.
+    void set_batch(bool on) { batch_on = on; }
   private:
     const uint32_t TIMEOUT_LONG=3000;
     const uint32_t TIMEOUT_SHORT=1000;
-    File rxmodem;
+    // Sending: wait for each ACK this long, and give up after this many
+    // timeouts or NAKs in a row, as lrzsz sb does.
+    const uint32_t TIMEOUT_SEND=10000;
+    const uint8_t SEND_RETRIES=10;
+    XYfileSink file_sink;
+    XYsink *sink = &file_sink;
+    bool rx_open = false;       // sink has a file open
     enum rxmodem_t {
       IDLE, BLOCKSTART, BLOCKNUM, BLOCKCHECK, DATABLOCK,
-      DATACHECK, DATACHECKCRC, DATAPURGE
+      DATACHECK, DATACHECKCRC, DATAPURGE, ZMODEM, SEND
     };
     rxmodem_t rxmodem_state = IDLE;
     char rx_filename[128+1];
     uint8_t next_block;
-    uint8_t *rx_buf = NULL;
+    // Block being parsed by loop()
+    uint8_t rx_block;           // block number from the header
+    uint16_t rx_blocklen;       // 128 or 1024
+    uint16_t rx_left;           // data bytes still to come
+    uint8_t *rx_p;              // where the next data byte goes
+    uint8_t rx_sum = 0;
+    uint16_t rx_crc = 0;
+    uint16_t rx_crc_in;         // CRC sent by the sender
+    uint8_t *rx_pool = NULL;    // XYMODEM_RX_BUFFERS buffers of rx_buf_size
+    uint8_t *rx_buf = NULL;     // buffer being filled from the port
+    uint8_t rx_fill = 0;        // ring index of rx_buf
+    uint8_t rx_commit = 0;      // ring index of the oldest queued block
+    uint8_t rx_pending = 0;     // blocks queued for the file
+    uint16_t rx_pending_len[XYMODEM_RX_BUFFERS];
+    uint16_t rx_commit_offset = 0;
+    uint8_t *wr_buf = NULL;     // XYMODEM_WRITE_COALESCE bytes
+    uint16_t wr_len = 0;
+    uint32_t wr_calls_in = 0;
+    uint32_t wr_calls_out = 0;
     uint16_t rx_buf_size = 128;
+    uint16_t rx_pool_block = 0;
+    bool fixed_buffers = false; // rx_pool and wr_buf not from malloc
+    xymodem_stats_t rx_stats = {};
+    uint32_t rx_block_start;    // micros() at the first byte of the block
     uint32_t rx_file_remaining;
-    uint32_t next_millis = 0;
+    uint32_t rx_resume = 0;     // file offset open_file() resumed from
+#if XYMODEM_DIGEST
+    bool rx_digest_set = false; // the sender gave a CRC-32 for the file
+    uint32_t rx_digest;
+    uint32_t rx_crc32;          // CRC-32 of the file data so far
+    bool zcrc_wait = false;     // ZCRC sent, waiting for the answer
+#endif
+    uint32_t timer_start = 0;   // millis() when the timeout was armed
+    uint32_t timer_ms = 0;
+    uint32_t rtt_sent;          // micros() when the last ACK/NAK went out
+    bool rtt_pending = false;
+    uint32_t srtt_us = 0;       // 0 until the first sample
+    uint32_t rttvar_us = 0;
+    uint32_t rto_ms = 3000;
+    uint8_t rto_backoff = 0;
+    bool ctl_pending = false;   // control bytes written but not flushed
     uint8_t reply;
     bool CRC_on = false;
     bool YMODEM = false;
+    bool streaming = false;     // YMODEM-G
+    bool zmodem = false;
     Stream *port;
     FATFILESYS_CLASS *filesys;
+    const char *jr_path = XYMODEM_JOURNAL;
+    bool sync_on = false;
+    const char *sync_path = XYMODEM_SYNC_INDEX;
+    bool batch_on = false;
+
+#if XYMODEM_RESUME
+    // Journal entries are appended, never rewritten, so a torn write only
+    // loses the last one. The newest entry with a good check wins.
+    typedef struct {
+      uint32_t magic;
+      uint32_t size;            // file size announced by the sender
+      uint32_t committed;       // bytes flushed to the file
+      uint32_t crc;             // CRC-32 of those bytes
+      uint32_t flags;
+      char name[128+1];
+      uint32_t check;           // CRC-32 of everything above
+    } xyjournal_t;
+    static const uint32_t JOURNAL_MAGIC = 0x314A5958;   // "XYJ1"
+    static const uint32_t JOURNAL_PREALLOCATED = 0x01;
+    File rxjournal;
+    xyjournal_t jr;
+    uint32_t jr_logged = 0;     // jr.committed in the last entry
+    uint32_t rx_recheck = 0;    // resumed bytes a YMODEM sender sends again
+    uint32_t rx_recheck_crc;    // CRC-32 of those received so far
+#endif
+
+#if XYMODEM_SYNC
+    // Sync mode, see xysync.cpp. Index entries have a fixed size and a
+    // check, so a damaged one is passed over. The last one for a name counts.
+    typedef struct {
+      uint32_t magic;
+      uint32_t size;
+      uint32_t mtime;           // sender's time, seconds since 1970, 0 if none
+      uint32_t crc;             // CRC-32 of the file
+      char name[128+1];
+      uint32_t check;           // CRC-32 of everything above
+    } xysync_t;
+    static const uint32_t SYNC_MAGIC = 0x31535958;      // "XYS1"
+    enum syncverdict_t { SYNC_RECEIVE, SYNC_SKIP, SYNC_ASK };
+    xysync_t sync_entry;        // index entry for rx_filename
+    uint16_t sync_count = 0;    // entries in the index
+    uint16_t sync_kept = 0;     // entries left by the last compaction
+    bool sync_found = false;    // sync_entry is valid
+    bool sync_file = false;     // record the file in the index on commit
+    bool sync_wait = false;     // ZCRC sent to decide whether to skip
+    bool rx_skip = false;       // unchanged YMODEM file, data dropped
+    uint32_t rx_file_size;      // size from the file information
+    uint32_t rx_mtime;          // modification time from the file information
+#endif
+
+#if XYMODEM_SEND
+    // Sending, see xysend.cpp. rx_pool holds a ring of frames read ahead
+    // from tx_file, the oldest maybe sent and waiting for its ACK.
+    // rx_pending_len has each frame's file bytes.
+    enum txstate_t { TX_START, TX_HEADER_ACK, TX_DATA_START, TX_DATA_ACK, TX_EOT_ACK };
+    txstate_t txstate;
+    File tx_file;               // file being sent
+    File tx_dir;                // directory start_sb() is sending
+    bool tx_eof;                // tx_file read to the end
+    uint8_t tx_head;            // ring index of the oldest frame
+    uint8_t tx_ready;           // frames in the ring
+    uint8_t tx_block;           // block number of the oldest frame
+    uint8_t tx_retries;         // timeouts and NAKs in a row
+    uint8_t tx_can;             // CANs in a row
+    bool tx_sent;               // tx_send() called while answering a reply
+    uint16_t tx_check[XYMODEM_RX_BUFFERS];
+#endif
+
+    // ZMODEM receive, see zmodem.cpp
+    enum zstate_t {
+      ZS_HUNT, ZS_PAD, ZS_FORMAT, ZS_BINHDR, ZS_HEXHDR, ZS_DATA, ZS_CRC, ZS_FIN
+    };
+    zstate_t zstate = ZS_HUNT;
+    uint8_t zhdr[9];            // type, ZP0..ZP3, CRC; or subpacket CRC
+    uint8_t zhdr_len;
+    bool zhdr32;                // last header was ZBIN32, data uses CRC-32
+    bool zdle_pending;
+    uint8_t zcan_count;
+    uint8_t zframe;             // header type owning the data subpackets
+    uint8_t zend;               // ZCRCE/G/Q/W that ended the subpacket
+    uint16_t zlen;              // subpacket bytes in rx_buf
+    uint8_t zerrors;
+    uint32_t zoffset;           // file bytes received and verified
+    uint8_t zin[64];            // read from the port, zin_pos.. not decoded
+    uint8_t zin_len = 0;
+    uint8_t zin_pos = 0;
+
+#if XYMODEM_UNPACK
+    // Packed file being expanded, see xyunpack.cpp
+    enum uzstate_t { UZ_OFF, UZ_HEADER, UZ_DATA, UZ_DONE };
+    uzstate_t uz_state = UZ_OFF;
+    uint8_t uz_hdr[9];          // header, kept until the file is opened
+    uint8_t uz_hdr_len;
+    uint8_t uz_wbits;           // window bits
+    uint8_t uz_lbits;           // match length bits
+    uint32_t uz_bits;           // input bits not decoded yet, low uz_nbits
+    uint8_t uz_nbits;
+    uint32_t uz_left;           // plain bytes still to come
+    uint16_t uz_head;           // next output byte in uz_window
+    uint16_t uz_flushed;        // first uz_window byte not written yet
+    uint8_t uz_window[1 << XYMODEM_UNPACK_WINDOW];
+#endif
+
+#if XYMODEM_TRACE > 0
+    xytrace_t trace_ring[XYMODEM_TRACE];
+    uint32_t trace_next = 0;    // entries ever written
+    void trace(uint8_t ev, uint8_t a, uint16_t b) {
+      xytrace_t *t = &trace_ring[trace_next++ % XYMODEM_TRACE];
+      t->us = micros();
+      t->ev = ev;
+      t->a = a;
+      t->b = b;
+    }
+#endif
+
+  protected:
+    void use_buffers(uint8_t *pool, uint16_t block, uint8_t *wr);
 
   private:
     int start(Stream *port, void *filesys, const char *rx_filename, bool rx_buf_1k, bool useCRC);
+    bool alloc_pool(void);
+    int rx_loop(void);
+    // Limits of the loop() call running, see loop(budget_us, max_bytes).
+    uint32_t lp_start;          // micros() at the start of the call
+    uint32_t lp_budget_us = 0;
+    uint32_t lp_max_bytes = 0;
+    uint32_t lp_bytes = 0;      // read from the port so far
+    bool lp_limited(void) { return lp_budget_us != 0 || lp_max_bytes != 0; }
+    bool lp_more(void) {
+      return (lp_max_bytes == 0 || lp_bytes < lp_max_bytes) &&
+        (lp_budget_us == 0 || micros() - lp_start < lp_budget_us);
+    }
+    // n, or fewer if the byte limit is closer.
+    int lp_room(int n) { return (lp_max_bytes == 0) ? n : min(n, (int)(lp_max_bytes - lp_bytes)); }
+    void arm_timer(uint32_t ms) { timer_start = millis(); timer_ms = ms; }
+    // Wraps safely at the 49 day millis() rollover.
+    bool timer_expired(void) { return millis() - timer_start >= timer_ms; }
+    // Control bytes are written with ctl() and pushed out together by
+    // ctl_flush() rather than a flush() each.
+    void ctl(uint8_t c) { port->write(c); ctl_pending = true; }
+    void ctl_flush(void) { if (ctl_pending) { port->flush(); ctl_pending = false; } }
+    void read_frame(void);
+    void check_blocknum(uint8_t cmp);
+    void check_data(uint16_t check);
+    void rtt_reset(void);
+    void rtt_send(void);
+    void rtt_sample(void);
+    void rto_update(void);
+    void rto_timeout(void);
+    void block_time(void);
     void format_flash();
-    uint16_t updcrc(uint8_t c, uint16_t crc);
+    void accept_block(uint8_t block, uint16_t blocksize);
+    void header_block(void);
+    bool open_file(void);
+    bool create_file(void);
+    uint32_t journal_resume(const char *name, uint32_t size);
+    void journal_begin(uint32_t flags);
+    void journal_log(void);
+    void journal_end(void);
+    bool journal_recheck(const uint8_t *buf, uint16_t len);
+    uint8_t request_char(void);
+    void cancel(void);
+    void zstart(void);
+    int zloop(void);
+    void ztimeout(void);
+    int zdecode(uint8_t c);
+    void zrx(uint8_t c);
+    void zheader(void);
+    void zsubpacket(void);
+    void zerror(void);
+    void zsend_rinit(void);
+    void zsend_rpos(void);
+    void zsend_hex(uint8_t type, uint32_t pos);
+    void zcancel(void);
+#if XYMODEM_SEND
+    int start_send(Stream *port, void *filesys, const char *path);
+    int tx_loop(void);
+    void tx_reply(uint8_t c);
+    bool tx_cancelled(uint8_t c);
+    bool tx_drop_stale(void);
+    void tx_timeout(void);
+    void tx_next(void);
+    bool tx_open(void);
+    void tx_header(void);
+    void tx_read(void);
+    void tx_frame(uint8_t slot, uint16_t len);
+    void tx_send(void);
+    void tx_pop(void);
+    void tx_eot(void);
+    void tx_end(void);
+#endif
+#if XYMODEM_SYNC
+    syncverdict_t sync_check(void);
+    bool sync_skip(void);
+    static bool sync_valid(const xysync_t &entry);
+    bool sync_lookup(void);
+    void sync_record(uint32_t crc);
+    void sync_compact(void);
+#endif
+    void queue_block(uint16_t len);
+    void commit_blocks(uint32_t max_bytes);
+    void write_data(const uint8_t *buf, uint16_t len);
+#if XYMODEM_UNPACK
+    bool unpack_pending(void) { return uz_state == UZ_HEADER; }
+    static bool packed_name(const char *name);
+    bool unpack_begin(void);
+    void unpack(const uint8_t *buf, uint16_t len);
+    bool unpack_open(void);
+    void unpack_put(uint8_t c);
+    void unpack_flush(void);
+#else
+    bool unpack_pending(void) { return false; }
+#endif
+    void write_file(const uint8_t *buf, uint16_t len);
+    void write_out(const uint8_t *buf, uint16_t len);
+    void finish_file(void);
+    void close_file(bool complete);
+};
+
+/*
+ * XYmodem with buffers that are part of the object instead of malloc'd, so
+ * the RAM cost, BLOCK * XYMODEM_RX_BUFFERS + XYMODEM_WRITE_COALESCE bytes,
+ * is known at compile time and a long running device never fragments its
+ * heap. BLOCK is the largest block it takes, 128 or 1024. Starting a mode
+ * that needs bigger blocks, e.g. start_rz() with BLOCK 128, fails.
+ *
+ *   XYmodemStatic<1024, true> rxymodem;
+ *   rxymodem.start_rb(&Serial, &SD);   // YMODEM 1K CRC
+ */
+template <uint16_t BLOCK, bool USE_CRC = true>
+class XYmodemStatic : public XYmodem {
+  public:
+#if XYMODEM_WRITE_COALESCE > 0
+    XYmodemStatic() { use_buffers(pool, BLOCK, wr); }
+#else
+    XYmodemStatic() { use_buffers(pool, BLOCK, NULL); }
+#endif
+    using XYmodem::start_rx;
+    using XYmodem::start_rb;
+    int start_rx(Stream *port, const char *rx_filename) {
+      return XYmodem::start_rx(port, rx_filename, BLOCK == 1024, USE_CRC);
+    }
+    int start_rb(Stream *port, void *filesys) {
+      return XYmodem::start_rb(port, filesys, BLOCK == 1024, USE_CRC);
+    }
+  private:
+    static_assert(BLOCK == 128 || BLOCK == 1024, "BLOCK must be 128 or 1024");
+    uint8_t pool[BLOCK * XYMODEM_RX_BUFFERS];
+#if XYMODEM_WRITE_COALESCE > 0
+    uint8_t wr[XYMODEM_WRITE_COALESCE];
+#endif
+};
+
+/*
+ * Runs several receivers, e.g. one per UART, from one Arduino loop().
+ * Call loop() instead of each receiver's own loop().
+ */
+class XYmodemMux {
+  public:
+    bool add(XYmodem *rx);
+    // budget_us is shared out between the receivers, at least 1 us each,
+    // see XYmodem::loop(budget_us).
+    int loop(uint32_t budget_us = 0);
+  private:
+    XYmodem *rx[XYMODEM_MUX_MAX];
+    uint8_t count = 0;
+    uint8_t first = 0;
 };
 
 #endif /* _XYMODEM_H_ */
@@ -0,0 +1,457 @@
+/*
+MIT License
+
+Copyright (c) 2018 gdsports625@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * XMODEM and YMODEM send, compatible with lrzsz rx and rb. The receive
+ * buffers become a ring of frames read ahead from the file: while one
+ * frame waits for its ACK, loop() reads the next block and works out its
+ * CRC, so an ACK is answered with a frame written straight from the ring.
+ * YMODEM-G receivers ('G') are streamed to without waiting for ACKs.
+ */
+
+#include <Arduino.h>
+#include <xymodem.h>
+#include <xycrc.h>
+
+#if XYMODEM_SEND
+
+#define DEBUG_ON 0
+
+#if DEBUG_ON
+// Arduino Zero, -DUSB_VID=0x2341 -DUSB_PID=0x804d
+#if USB_VID==0x2341 && USB_PID==0x804d
+/* Programming port */
+#define Debug_Serial Serial
+#else
+#define Debug_Serial Serial1
+#endif
+
+#define dbprint(...) Debug_Serial.print(__VA_ARGS__)
+#define dbprintln(...) Debug_Serial.println(__VA_ARGS__)
+#else
+#define dbprint(...)
+#define dbprintln(...)
+#endif
+
+/*
+ * Start XMODEM send of one file. sx = send XMODEM.
+ */
+int XYmodem::start_sx(Stream *port, void *filesys, const char *path)
+{
+  YMODEM = false;
+  return start_send(port, filesys, path);
+}
+
+/*
+ * Start YMODEM send of a file, or of every file in a directory.
+ * sb = send batch.
+ */
+int XYmodem::start_sb(Stream *port, void *filesys, const char *path)
+{
+  YMODEM = true;
+  return start_send(port, filesys, path);
+}
+
+int XYmodem::start_send(Stream *port, void *filesys, const char *path)
+{
+  // A transfer abandoned part way still has its files open.
+  close_file(false);
+  tx_end();
+  streaming = false;
+  zmodem = false;
+  rx_buf_size = (fixed_buffers && rx_pool_block < 1024) ? 128 : 1024;
+  if (!alloc_pool()) return 1;
+  this->port = port;
+  this->filesys = (FATFILESYS_CLASS *)filesys;
+  File f = this->filesys->open(path, FILE_READ);
+  if (!f) {
+    dbprintln("XYmodem open file failed");
+    return 1;
+  }
+  if (f.isDirectory()) {
+    if (!YMODEM) {
+      f.close();
+      return 1;
+    }
+    tx_dir = f;
+  }
+  else {
+    tx_file = f;
+  }
+  memset(&rx_stats, 0, sizeof(rx_stats));
+  rx_stats.block_us_min = 0xFFFFFFFF;
+  tx_head = tx_ready = 0;
+  tx_eof = false;
+  tx_retries = tx_can = 0;
+  XYTRACE(XYT_START, (YMODEM) ? 5 : 4, rx_buf_size);
+  // The receiver speaks first.
+  txstate = TX_START;
+  rxmodem_state = SEND;
+  arm_timer(TIMEOUT_SEND);
+  return 0;
+}
+
+int XYmodem::tx_loop(void)
+{
+  while (port->available() > 0 && lp_more()) {
+    uint8_t c = port->read();
+    lp_bytes++;
+    if (tx_cancelled(c)) return 0;
+    if (c == CAN) continue;
+    tx_sent = false;
+    tx_reply(c);
+    if (rxmodem_state == IDLE) return 0;
+    // What the receiver sent before it could see that frame answers an
+    // earlier one.
+    if (tx_sent && !streaming && !tx_drop_stale()) return 0;
+  }
+  // A late answer still queued goes before a timeout.
+  if (port->available() > 0) return rxmodem_state;
+  if (timer_expired()) {
+    tx_timeout();
+  }
+  else if (streaming && txstate == TX_DATA_ACK) {
+    // YMODEM-G: one frame per call, no waiting.
+    tx_next();
+  }
+  else if (txstate != TX_START) {
+    // Nothing to answer, so read ahead.
+    tx_read();
+  }
+  return rxmodem_state;
+}
+
+/*
+ * Count c towards a cancel. One CAN may be line noise, two in a row
+ * cancel. Returns true if they did.
+ */
+bool XYmodem::tx_cancelled(uint8_t c)
+{
+  if (c != CAN) {
+    tx_can = 0;
+    return false;
+  }
+  if (++tx_can < 2) return false;
+  dbprintln("cancelled by receiver");
+  XYSTAT(rx_stats.cans++);
+  XYTRACE(XYT_CAN, 1, 0);
+  tx_end();
+  return true;
+}
+
+/*
+ * Drop the bytes already queued when a frame was sent in answer to a
+ * reply, such as NAKs or 'C's that piled up for the same frame. CANs among
+ * them still count. Returns false if they cancelled.
+ */
+bool XYmodem::tx_drop_stale(void)
+{
+  for (int n = port->available(); n > 0; n--) {
+    int c = port->read();
+    if (c < 0) break;
+    lp_bytes++;
+    if (tx_cancelled(c)) return false;
+  }
+  return true;
+}
+
+void XYmodem::tx_reply(uint8_t c)
+{
+  switch (txstate) {
+    case TX_START:
+      if (c != 'C' && c != NAK && c != 'G') break;
+      CRC_on = (c != NAK);
+      streaming = (c == 'G');
+      rx_buf_size = (CRC_on && rx_pool_block >= 1024) ? 1024 : 128;
+      tx_retries = 0;
+      if (!YMODEM) {
+        tx_open();
+        tx_next();
+        break;
+      }
+      tx_header();
+      tx_send();
+      if (!streaming) {
+        txstate = TX_HEADER_ACK;
+        break;
+      }
+      // YMODEM-G does not ACK block 0.
+      tx_pop();
+      if (!tx_file) {
+        tx_end();
+        break;
+      }
+      txstate = TX_DATA_START;
+      break;
+    case TX_HEADER_ACK:
+      if (c == ACK) {
+        tx_pop();
+        tx_retries = 0;
+        if (!tx_file) {
+          // End of batch.
+          tx_end();
+          break;
+        }
+        txstate = TX_DATA_START;
+      }
+      else if (c == NAK || c == 'C') {
+        if (++tx_retries > SEND_RETRIES) {
+          cancel();
+          tx_end();
+          break;
+        }
+        XYSTAT(rx_stats.blocks_nak++);
+        XYTRACE(XYT_NAK, 0, 0);
+        tx_send();
+      }
+      break;
+    case TX_DATA_START:
+      if (c == 'C' || c == NAK || c == 'G') tx_next();
+      break;
+    case TX_DATA_ACK:
+      // YMODEM-G only answers the EOT.
+      if (streaming) break;
+      if (c == ACK) {
+        XYSTAT(rx_stats.blocks_ok++);
+        XYSTAT(rx_stats.bytes_tx += rx_pending_len[tx_head]);
+        XYTRACE(XYT_BLOCK, tx_block, rx_pending_len[tx_head]);
+        tx_pop();
+        tx_next();
+      }
+      else if (c == NAK || (c == 'C' && tx_block == 1)) {
+        // A receiver that missed the first block asks again with 'C'.
+        if (++tx_retries > SEND_RETRIES) {
+          cancel();
+          tx_end();
+          break;
+        }
+        XYSTAT(rx_stats.blocks_nak++);
+        XYTRACE(XYT_NAK, tx_block, 0);
+        tx_send();
+      }
+      break;
+    case TX_EOT_ACK:
+      if (c == ACK) {
+        XYSTAT(rx_stats.files++);
+        XYTRACE(XYT_CLOSE, 1, 0);
+        tx_file.close();
+        tx_retries = 0;
+        if (!YMODEM) {
+          tx_end();
+          break;
+        }
+        // The receiver asks for the next block 0.
+        txstate = TX_START;
+        arm_timer(TIMEOUT_SEND);
+      }
+      else if (c == NAK) {
+        // Some receivers NAK the first EOT to make sure of it.
+        tx_eot();
+      }
+      break;
+  }
+}
+
+void XYmodem::tx_timeout(void)
+{
+  XYSTAT(rx_stats.timeouts++);
+  XYTRACE(XYT_TIMEOUT, 0, 0);
+  if (++tx_retries > SEND_RETRIES) {
+    dbprintln("timeout, send CAN");
+    cancel();
+    tx_end();
+    return;
+  }
+  switch (txstate) {
+    case TX_HEADER_ACK:
+    case TX_DATA_ACK:
+      tx_send();
+      break;
+    case TX_EOT_ACK:
+      tx_eot();
+      break;
+    default:
+      arm_timer(TIMEOUT_SEND);
+      break;
+  }
+}
+
+/*
+ * Send the next data frame, or EOT after the last one.
+ */
+void XYmodem::tx_next(void)
+{
+  tx_retries = 0;
+  // Not read ahead yet, read it now.
+  if (tx_ready == 0) tx_read();
+  if (tx_ready == 0) {
+    tx_eot();
+    txstate = TX_EOT_ACK;
+    return;
+  }
+  tx_send();
+  txstate = TX_DATA_ACK;
+  if (streaming) {
+    XYSTAT(rx_stats.blocks_ok++);
+    XYSTAT(rx_stats.bytes_tx += rx_pending_len[tx_head]);
+    tx_pop();
+  }
+}
+
+/*
+ * Open the next file to send. For a directory, that is the next entry that
+ * is not a directory.
+ */
+bool XYmodem::tx_open(void)
+{
+  while (!tx_file && tx_dir) {
+    File f = tx_dir.openNextFile();
+    if (!f) {
+      tx_dir.close();
+      break;
+    }
+    if (f.isDirectory()) {
+      f.close();
+      continue;
+    }
+    tx_file = f;
+  }
+  if (!tx_file) return false;
+  const char *name = tx_file.name();
+  const char *base = strrchr(name, '/');
+  strncpy(rx_filename, (base) ? base + 1 : name, sizeof(rx_filename)-1);
+  rx_filename[sizeof(rx_filename)-1] = '\0';
+  dbprint("sending "); dbprintln(rx_filename);
+  XYTRACE(XYT_OPEN, 0, min(tx_file.size() >> 10, (uint32_t)0xFFFF));
+  tx_eof = false;
+  tx_block = 1;
+  return true;
+}
+
+/*
+ * Put block 0 in the ring: name and size of the next file, or all zero
+ * at the end of the batch.
+ */
+void XYmodem::tx_header(void)
+{
+  uint8_t *buf = rx_pool + tx_head * rx_pool_block;
+  uint16_t len = 128;
+
+  memset(buf, 0, rx_buf_size);
+  if (tx_open()) {
+    size_t n = strlen(rx_filename);
+    char size[12];
+    snprintf(size, sizeof(size), "%lu", (unsigned long)tx_file.size());
+    // A long name needs a 1K block 0, if the receiver takes those.
+    if (n + 1 + strlen(size) >= 128 && rx_buf_size == 1024) len = 1024;
+    strncpy((char *)buf, rx_filename, len - 1);
+    if (n + 1 + strlen(size) < len) strcpy((char *)buf + n + 1, size);
+  }
+  tx_block = 0;
+  tx_frame(tx_head, len);
+}
+
+/*
+ * Read the next block of the file into a free ring buffer. The last one
+ * goes as a 128 byte frame if that holds it.
+ */
+void XYmodem::tx_read(void)
+{
+  if (tx_eof || !tx_file || tx_ready >= XYMODEM_RX_BUFFERS) return;
+  uint8_t slot = (tx_head + tx_ready) % XYMODEM_RX_BUFFERS;
+  uint8_t *buf = rx_pool + slot * rx_pool_block;
+  int n = tx_file.read(buf, rx_buf_size);
+  if (n <= 0) {
+    tx_eof = true;
+    return;
+  }
+  if (n < rx_buf_size) tx_eof = true;
+  uint16_t len = (n <= 128) ? 128 : 1024;
+  // CPMEOF padding.
+  memset(buf + n, 0x1A, len - n);
+  tx_frame(slot, len);
+  rx_pending_len[slot] = n;
+}
+
+/*
+ * Work out the check of the len byte frame in slot and add it to the ring.
+ */
+void XYmodem::tx_frame(uint8_t slot, uint16_t len)
+{
+  uint8_t *buf = rx_pool + slot * rx_pool_block;
+  tx_check[slot] = (CRC_on) ? xycrc16(0, buf, len) : xysum8(0, buf, len);
+  rx_pending_len[slot] = len;
+  tx_ready++;
+}
+
+/*
+ * Write the oldest frame in the ring.
+ */
+void XYmodem::tx_send(void)
+{
+  uint8_t *buf = rx_pool + tx_head * rx_pool_block;
+  uint16_t n = rx_pending_len[tx_head];
+  uint16_t len = (n <= 128) ? 128 : 1024;
+  uint8_t head[3] = {(len == 1024) ? (uint8_t)STX : (uint8_t)SOH, tx_block, (uint8_t)~tx_block};
+  uint8_t check[2] = {(uint8_t)(tx_check[tx_head] >> 8), (uint8_t)tx_check[tx_head]};
+
+  tx_sent = true;
+  port->write(head, sizeof(head));
+  port->write(buf, len);
+  if (CRC_on) {
+    port->write(check, 2);
+  }
+  else {
+    port->write(check[1]);
+  }
+  port->flush();
+  arm_timer(TIMEOUT_SEND);
+}
+
+void XYmodem::tx_pop(void)
+{
+  tx_head = (tx_head + 1) % XYMODEM_RX_BUFFERS;
+  tx_ready--;
+  tx_block++;
+}
+
+void XYmodem::tx_eot(void)
+{
+  XYTRACE(XYT_EOT, 0, 0);
+  port->write(EOT);
+  port->flush();
+  arm_timer(TIMEOUT_SEND);
+}
+
+/*
+ * Close whatever is open and stop.
+ */
+void XYmodem::tx_end(void)
+{
+  if (tx_file) tx_file.close();
+  if (tx_dir) tx_dir.close();
+  if (rxmodem_state == SEND) rxmodem_state = IDLE;
+}
+
+#endif /* XYMODEM_SEND */
@@ -0,0 +1,486 @@
+/*
+MIT License
+
+Copyright (c) 2018 gdsports625@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <Arduino.h>
+#include <xymodem.h>
+#include <xycrc.h>
+
+/*
+ * Create name, empty. With XYMODEM_PREALLOCATE and a known size, reserve
+ * the space first and refuse the file if it does not fit. With
+ * XYMODEM_ATOMIC an existing file of that name stays until commit().
+ */
+bool XYfileSink::open(const char *name, uint32_t size)
+{
+#if XYMODEM_ATOMIC
+  strncpy(path, name, sizeof(path)-1);
+  path[sizeof(path)-1] = '\0';
+  name = temp_name(path);
+#endif
+#if XYMODEM_BATCH
+  bool exists = may_exist(name);
+#else
+  bool exists = true;
+#endif
+  if (exists) filesys->remove((char *)name);
+  file = filesys->open(name, FILE_WRITE);
+  if (!file) return false;
+#if XYMODEM_BATCH
+  if (!exists) {
+    cache_add(name);
+    // Not empty, so the directory changed behind the cache's back.
+    if (file.size() != 0) {
+      file.close();
+      filesys->remove((char *)name);
+      file = filesys->open(name, FILE_WRITE);
+      if (!file) return false;
+    }
+  }
+#endif
+#if XYMODEM_PREALLOCATE
+  if (size != 0xFFFFFFFF && !preallocate(size)) {
+    file.close();
+    filesys->remove((char *)name);
+    return false;
+  }
+#endif
+  return true;
+}
+
+bool XYfileSink::reopen(const char *name, uint32_t offset)
+{
+#if XYMODEM_ATOMIC
+  strncpy(path, name, sizeof(path)-1);
+  path[sizeof(path)-1] = '\0';
+  name = temp_name(path);
+#endif
+  file = filesys->open(name, FILE_WRITE);
+  if (!file) return false;
+  if (file.seek(offset) && file.position() == offset) return true;
+  file.close();
+  return false;
+}
+
+#if XYMODEM_ATOMIC
+/*
+ * name with its last character changed to mark, or alt if it already is
+ * mark, so it stays a valid 8.3 name in the same directory. "." and mark
+ * are added to a name without an extension.
+ */
+static void mark_name(char *to, const char *name, char mark, char alt)
+{
+  size_t n = strlen(name);
+  const char *dot = strrchr(name, '.');
+  const char *slash = strrchr(name, '/');
+
+  strcpy(to, name);
+  if (n == 0 || dot == NULL || (slash != NULL && dot < slash) || dot == name + n - 1) {
+    to[n] = '.';
+    to[n+1] = mark;
+    to[n+2] = '\0';
+  }
+  else {
+    to[n-1] = (name[n-1] == mark) ? alt : mark;
+  }
+}
+
+/*
+ * The file is complete. Move the old one, if any, aside to a name ending
+ * in '!', put the new one in its place and only then remove the old one,
+ * so a whole copy is always on the file system. Without a real rename
+ * both moves are copies.
+ */
+void XYfileSink::commit(void)
+{
+  char old[sizeof(temp)];
+
+  file.close();
+#if XYMODEM_BATCH && (defined(ADAFRUIT_SPIFLASH) || XYMODEM_FS_RENAME)
+  // A new name needs no move. A real rename refuses to overwrite, so
+  // if the cache is wrong the move is only late.
+  if (!may_exist(path) && rename(temp, path)) {
+    cache_add(path);
+    return;
+  }
+#endif
+  mark_name(old, path, '!', '#');
+  filesys->remove(old);
+  bool moved = rename(path, old);
+  if (rename(temp, path)) {
+    if (moved) filesys->remove(old);
+  }
+  else if (moved) {
+    rename(old, path);
+  }
+}
+
+/*
+ * name with its last character changed to '$', or '~' if it already is
+ * one. ".$" is added to a name without an extension.
+ */
+const char *XYfileSink::temp_name(const char *name)
+{
+  mark_name(temp, name, '$', '~');
+  return temp;
+}
+#endif
+
+/*
+ * FatFs renames in place. The Arduino SD library cannot rename, so there
+ * the data is copied and from removed. A power cut during the copy can
+ * still leave part of the file under to, but from survives complete.
+ */
+bool XYfileSink::rename(const char *from, const char *to)
+{
+#if defined(ADAFRUIT_SPIFLASH)
+  return f_rename(from, to) == FR_OK;
+#elif XYMODEM_FS_RENAME
+  return filesys->rename(from, to);
+#else
+  uint8_t buf[256];
+  int n;
+  File in = filesys->open(from, FILE_READ);
+  if (!in) return false;
+  File out = filesys->open(to, FILE_WRITE);
+  if (!out) {
+    in.close();
+    return false;
+  }
+  bool ok = true;
+  while (ok && (n = in.read(buf, sizeof(buf))) > 0) {
+    ok = (out.write(buf, n) == (size_t)n);
+  }
+  in.close();
+  out.close();
+  if (ok) filesys->remove((char *)from);
+  return ok;
+#endif
+}
+
+/*
+ * Reserve len bytes for the new file before any data arrives. FatFs
+ * extends the cluster chain when seeking past the end of a file open for
+ * writing, and stops at the last free cluster when the volume is full. The
+ * SD library refuses the seek and the file is left as it was. Returns
+ * false only if the volume does not have room for len bytes.
+ */
+bool XYfileSink::preallocate(uint32_t len)
+{
+  if (len == 0 || !file.seek(len)) return true;
+  bool room = (file.position() == len);
+  file.seek(0);
+  return room;
+}
+
+#if XYMODEM_BATCH
+/*
+ * FNV-1a of len bytes of name, case folded as FAT compares names.
+ */
+uint32_t XYfileSink::name_hash(const char *name, size_t len)
+{
+  uint32_t h = 2166136261UL;
+
+  for (size_t i = 0; i < len; i++) {
+    h ^= (uint8_t)tolower((uint8_t)name[i]);
+    h *= 16777619UL;
+  }
+  return h;
+}
+
+/*
+ * Bit in names for the last part of the path name.
+ */
+uint32_t XYfileSink::name_bit(const char *name)
+{
+  const char *base = strrchr(name, '/');
+
+  base = (base) ? base + 1 : name;
+  return name_hash(base, strlen(base)) % (XYMODEM_DIR_CACHE * 8);
+}
+
+/*
+ * Hash of the directory part of name, up to the last '/'.
+ */
+uint32_t XYfileSink::dir_hash(const char *name)
+{
+  while (*name == '/') name++;
+  const char *slash = strrchr(name, '/');
+  return name_hash(name, (slash) ? slash - name : 0);
+}
+
+bool XYfileSink::may_exist(const char *name)
+{
+  if (!batch) return true;
+  uint32_t dir = dir_hash(name);
+  if (!cached || dir != cache_dir) cache_load(name, dir);
+  uint32_t bit = name_bit(name);
+  return (names[bit >> 3] & (1 << (bit & 7))) != 0;
+}
+
+/*
+ * Read the directory name is in, one entry at a time, and set the bit of
+ * every name in it. A directory that cannot be opened holds nothing.
+ */
+void XYfileSink::cache_load(const char *name, uint32_t dir)
+{
+  char path[128+1];
+
+  memset(names, 0, sizeof(names));
+  strncpy(path, name, sizeof(path)-1);
+  path[sizeof(path)-1] = '\0';
+  char *slash = strrchr(path, '/');
+  if (slash == NULL) {
+    strcpy(path, "/");
+  }
+  else {
+    slash[(slash == path) ? 1 : 0] = '\0';
+  }
+  File d = filesys->open(path, FILE_READ);
+  if (d && d.isDirectory()) {
+    File f = d.openNextFile();
+    while (f) {
+      uint32_t bit = name_bit(f.name());
+      names[bit >> 3] |= 1 << (bit & 7);
+      f.close();
+      f = d.openNextFile();
+    }
+  }
+  if (d) d.close();
+  cache_dir = dir;
+  cached = true;
+}
+
+/*
+ * name was just created.
+ */
+void XYfileSink::cache_add(const char *name)
+{
+  if (!batch || !cached || dir_hash(name) != cache_dir) return;
+  uint32_t bit = name_bit(name);
+  names[bit >> 3] |= 1 << (bit & 7);
+}
+#endif
+
+bool XYramSink::open(const char *name, uint32_t size)
+{
+  (void)name;
+  len = lost = 0;
+  complete = false;
+  return size == 0xFFFFFFFF || size <= capacity;
+}
+
+void XYramSink::write(const uint8_t *data, uint16_t n)
+{
+  uint32_t room = capacity - len;
+  if (n > room) {
+    lost += n - room;
+    n = room;
+  }
+  memcpy(buf + len, data, n);
+  len += n;
+}
+
+/*
+ * A new image. Refuse it if the sender says it will not fit. Only the
+ * sectors it needs are erased.
+ */
+bool XYflashSink::open(const char *name, uint32_t size)
+{
+  (void)name;
+  if (start % 4096 != 0) return false;
+  if (size != 0xFFFFFFFF && size > capacity) return false;
+  uint32_t span = capacity;
+  if (size != 0xFFFFFFFF) span = min(capacity, (size + 4095) & ~(uint32_t)4095);
+  end = start + span;
+  wr_addr = erased_to = start;
+  image_len = image_crc = 0;
+  page_len = 0;
+  overflow = verified = erasing = false;
+  erase_ahead(start, 0);
+  return true;
+}
+
+void XYflashSink::write(const uint8_t *buf, uint16_t len)
+{
+  image_crc = xycrc32(image_crc, buf, len);
+  image_len += len;
+  while (len > 0) {
+    if (page_len == 0 && len >= PAGE) {
+      // Whole page straight from the receive buffer.
+      program_page(buf, PAGE);
+      buf += PAGE;
+      len -= PAGE;
+      continue;
+    }
+    uint16_t n = min(len, (uint16_t)(PAGE - page_len));
+    memcpy(page + page_len, buf, n);
+    page_len += n;
+    buf += n;
+    len -= n;
+    if (page_len == PAGE) {
+      program_page(page, PAGE);
+      page_len = 0;
+    }
+  }
+}
+
+/*
+ * Program the last partial page, then read the image back and compare its
+ * CRC-32 with the one computed on the way in.
+ */
+void XYflashSink::commit(void)
+{
+  uint8_t buf[PAGE];
+
+  if (page_len > 0) {
+    program_page(page, page_len);
+    page_len = 0;
+  }
+  uint32_t crc = 0;
+  uint32_t left = min(image_len, capacity);
+  for (uint32_t addr = start; left > 0; ) {
+    uint32_t n = min(left, (uint32_t)PAGE);
+    dev->read(addr, buf, n);
+    crc = xycrc32(crc, buf, n);
+    addr += n;
+    left -= n;
+  }
+  verified = !overflow && crc == image_crc;
+}
+
+/*
+ * While the chip is erasing, leave the data queued in the receiver rather
+ * than wait. A page program is short enough to wait for. Erases ahead of
+ * the data are only started from idle(), when nothing is queued, so the
+ * receive buffers give them the most time to finish.
+ */
+bool XYflashSink::ready(void)
+{
+  if (erasing && dev->busy()) return false;
+  erasing = false;
+  return true;
+}
+
+void XYflashSink::program_page(const uint8_t *buf, uint16_t len)
+{
+  if (wr_addr >= end) {
+    overflow = true;
+    return;
+  }
+  erase_ahead(wr_addr, 0);
+  // Programming waits for any erase, so none is running after this.
+  dev->program(wr_addr, buf, len);
+  erasing = false;
+  wr_addr += PAGE;
+}
+
+/*
+ * Make sure the sector holding need has been erased, waiting if it has to
+ * be. Then, if the chip is idle, start erasing the next sector or 64K
+ * block as long as that stays within more bytes of need.
+ */
+void XYflashSink::erase_ahead(uint32_t need, uint32_t more)
+{
+  while (erased_to < end &&
+      (erased_to <= need || (!dev->busy() && erased_to < need + more))) {
+    uint32_t len = 4096;
+    if (erased_to % 65536 == 0 && end - erased_to >= 65536) len = 65536;
+    dev->erase(erased_to, len);
+    erased_to += len;
+    erasing = true;
+  }
+}
+
+#if defined(ADAFRUIT_SPIFLASH)
+#if defined(ADAFRUIT_METRO_M4_EXPRESS)
+// QSPI. Adafruit_QSPI_GD25Q waits for the chip before each transfer but
+// not after an erase command.
+void XYboardFlash::erase(uint32_t addr, uint32_t len)
+{
+  while (busy()) ;
+  QSPI0.runCommand(0x06);                             // write enable
+  QSPI0.eraseCommand((len == 65536) ? 0xD8 : 0x20, addr);
+}
+
+bool XYboardFlash::busy(void)
+{
+  uint8_t status;
+  QSPI0.readCommand(0x05, &status, 1);                // status register 1
+  return status & 0x01;
+}
+
+void XYboardFlash::program(uint32_t addr, const uint8_t *buf, uint16_t len)
+{
+  while (busy()) ;
+  flash.writeMemory(addr, (uint8_t *)buf, len);
+}
+
+void XYboardFlash::read(uint32_t addr, uint8_t *buf, uint32_t len)
+{
+  while (busy()) ;
+  flash.readMemory(addr, buf, len);
+}
+#else
+// SPI. Commands are sent by hand because Adafruit_SPIFlash::eraseSector()
+// waits for the erase to finish.
+static uint8_t flash_command(const uint8_t *cmd, uint8_t len)
+{
+  uint8_t in = 0;
+  FLASH_SPI_PORT.beginTransaction(SPISettings(8000000, MSBFIRST, SPI_MODE0));
+  digitalWrite(FLASH_SS, LOW);
+  for (uint8_t i = 0; i < len; i++) in = FLASH_SPI_PORT.transfer(cmd[i]);
+  digitalWrite(FLASH_SS, HIGH);
+  FLASH_SPI_PORT.endTransaction();
+  return in;
+}
+
+void XYboardFlash::erase(uint32_t addr, uint32_t len)
+{
+  static const uint8_t wren[1] = {0x06};
+  uint8_t cmd[4] = {(uint8_t)((len == 65536) ? 0xD8 : 0x20),
+    (uint8_t)(addr >> 16), (uint8_t)(addr >> 8), (uint8_t)addr};
+  while (busy()) ;
+  flash_command(wren, sizeof(wren));
+  flash_command(cmd, sizeof(cmd));
+}
+
+bool XYboardFlash::busy(void)
+{
+  static const uint8_t rdsr[2] = {0x05, 0x00};
+  return flash_command(rdsr, sizeof(rdsr)) & 0x01;
+}
+
+void XYboardFlash::program(uint32_t addr, const uint8_t *buf, uint16_t len)
+{
+  while (busy()) ;
+  flash.writeBuffer(addr, (uint8_t *)buf, len);
+}
+
+void XYboardFlash::read(uint32_t addr, uint8_t *buf, uint32_t len)
+{
+  while (busy()) ;
+  flash.readBuffer(addr, buf, len);
+}
+#endif
+#endif
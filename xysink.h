@@ -0,0 +1,226 @@
+/*
+MIT License
+
+Copyright (c) 2018 gdsports625@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _XYSINK_H_
+#define _XYSINK_H_
+
+// Included from xymodem.h once File and FATFILESYS_CLASS are known.
+
+// Where received files go. The receiver calls open() when a file starts,
+// write() with verified payload in order, then commit() if the whole file
+// arrived or abort() if the transfer stopped part way. write() gets a
+// pointer into the receive buffers, valid only for the call.
+class XYsink {
+  public:
+    virtual ~XYsink() {}
+    // size is 0xFFFFFFFF if the sender did not say (XMODEM). Return false
+    // to refuse the file, which cancels the transfer.
+    virtual bool open(const char *name, uint32_t size) = 0;
+    virtual void write(const uint8_t *buf, uint16_t len) = 0;
+    virtual void commit(void) = 0;
+    virtual void abort(void) = 0;
+    // Asked while the port is quiet, before handing over queued data.
+    // false means write() would have to wait, so the data stays queued
+    // and the receiver keeps reading.
+    virtual bool ready(void) { return true; }
+    // Called while the port is quiet and nothing is queued, for
+    // background work.
+    virtual void idle(void) {}
+};
+
+// Writes each file to a FAT file system. This is what XYmodem uses unless
+// it is given another sink. With XYMODEM_ATOMIC the file is written under
+// temp_name() and moved into place by commit(). A partial file is left
+// where it is on abort so XYMODEM_RESUME can continue it.
+class XYfileSink : public XYsink {
+  public:
+    XYfileSink(FATFILESYS_CLASS *filesys = NULL) : filesys(filesys) {}
+    bool open(const char *name, uint32_t size);
+    void write(const uint8_t *buf, uint16_t len) { file.write(buf, len); }
+#if XYMODEM_ATOMIC
+    void commit(void);
+    // Where name is written until it is complete.
+    const char *temp_name(const char *name);
+#else
+    void commit(void) { file.close(); }
+    const char *temp_name(const char *name) { return name; }
+#endif
+    void abort(void) { file.close(); }
+    // Open an existing partial file and continue writing at offset.
+    bool reopen(const char *name, uint32_t offset);
+    // Rename from, which must be closed, to to, which must not exist.
+    bool rename(const char *from, const char *to);
+#if XYMODEM_BATCH
+    // Batch mode, see XYmodem::set_batch(). The names in a directory are
+    // hashed into a bitmap the first time a file there is looked up, and
+    // the bitmap is kept until batch_end().
+    void batch_begin(void) { batch = true; cached = false; }
+    void batch_end(void) { batch = false; cached = false; }
+    // False if name is certainly not on the file system.
+    bool may_exist(const char *name);
+#endif
+
+    FATFILESYS_CLASS *filesys;
+    File file;
+
+  private:
+    bool preallocate(uint32_t len);
+#if XYMODEM_BATCH
+    void cache_load(const char *name, uint32_t dir);
+    void cache_add(const char *name);
+    static uint32_t name_hash(const char *name, size_t len);
+    static uint32_t name_bit(const char *name);
+    static uint32_t dir_hash(const char *name);
+    bool batch = false;
+    bool cached = false;        // names holds the directory cache_dir
+    uint32_t cache_dir;
+    uint8_t names[XYMODEM_DIR_CACHE];
+#endif
+#if XYMODEM_ATOMIC
+    char path[128+1];           // final name of the open file
+    char temp[128+3];
+#endif
+};
+
+// Receives a file into a RAM buffer, e.g. sound samples to be played
+// without a copy through flash. A file announced bigger than the buffer
+// is refused. Bytes past the end of the buffer, such as XMODEM padding,
+// are dropped and counted.
+class XYramSink : public XYsink {
+  public:
+    XYramSink(uint8_t *buf, uint32_t size) : buf(buf), capacity(size) {}
+    bool open(const char *name, uint32_t size);
+    void write(const uint8_t *data, uint16_t n);
+    void commit(void) { complete = true; }
+    void abort(void) { len = 0; }
+    // Bytes of the last complete file, 0 while one is arriving.
+    uint32_t length(void) { return (complete) ? len : 0; }
+    // Bytes that did not fit.
+    uint32_t dropped(void) { return lost; }
+
+  private:
+    uint8_t *buf;
+    uint32_t capacity;
+    uint32_t len = 0;
+    uint32_t lost = 0;
+    bool complete = false;
+};
+
+// Hands each file to functions, e.g. to feed a decoder or a device with
+// no file system. arg is passed through. on_open may be NULL to accept
+// every file.
+class XYcallbackSink : public XYsink {
+  public:
+    typedef bool (*open_fn)(const char *name, uint32_t size, void *arg);
+    typedef void (*write_fn)(const uint8_t *buf, uint16_t len, void *arg);
+    typedef void (*close_fn)(bool complete, void *arg);
+    XYcallbackSink(open_fn on_open, write_fn on_write, close_fn on_close, void *arg = NULL) :
+      on_open(on_open), on_write(on_write), on_close(on_close), arg(arg) {}
+    bool open(const char *name, uint32_t size) {
+      return (on_open == NULL) || on_open(name, size, arg);
+    }
+    void write(const uint8_t *buf, uint16_t len) { on_write(buf, len, arg); }
+    void commit(void) { if (on_close) on_close(true, arg); }
+    void abort(void) { if (on_close) on_close(false, arg); }
+
+  private:
+    open_fn on_open;
+    write_fn on_write;
+    close_fn on_close;
+    void *arg;
+};
+
+// Raw NOR flash as XYflashSink needs it. Pages are 256 bytes.
+class XYflashDevice {
+  public:
+    virtual ~XYflashDevice() {}
+    // Start erasing len bytes at addr. len is 4096 or 65536 and addr is
+    // a multiple of it. May return before the erase is done.
+    virtual void erase(uint32_t addr, uint32_t len) = 0;
+    // An erase or program is still running.
+    virtual bool busy(void) = 0;
+    // Program len bytes within one page. Waits for any erase or program
+    // still running first. May return before the program is done.
+    virtual void program(uint32_t addr, const uint8_t *buf, uint16_t len) = 0;
+    virtual void read(uint32_t addr, uint8_t *buf, uint32_t len) = 0;
+};
+
+#if defined(ADAFRUIT_SPIFLASH)
+// The SPI or QSPI flash chip set up in xyglobals.cpp. Erase and status
+// commands go to the chip directly so an erase runs while blocks arrive.
+// Untested on hardware: xybench runs XYflashSink against a model of the
+// chip, extras/host/hostflash.cpp, not this class.
+class XYboardFlash : public XYflashDevice {
+  public:
+    void erase(uint32_t addr, uint32_t len);
+    bool busy(void);
+    void program(uint32_t addr, const uint8_t *buf, uint16_t len);
+    void read(uint32_t addr, uint8_t *buf, uint32_t len);
+};
+#endif
+
+// Writes one image, e.g. firmware, to the address range start..start+length
+// of a flash chip, without FAT. start must be a multiple of 4096 and the
+// range must not overlap a FAT volume. Sectors are erased ahead of the
+// data while blocks arrive and whole pages are programmed. On commit the
+// image is read back and checked against the CRC-32 of what was received.
+class XYflashSink : public XYsink {
+  public:
+    XYflashSink(XYflashDevice *dev, uint32_t start, uint32_t length,
+        uint32_t ahead = XYMODEM_ERASE_AHEAD) :
+      dev(dev), start(start), capacity(length), ahead(ahead) {}
+    bool open(const char *name, uint32_t size);
+    void write(const uint8_t *buf, uint16_t len);
+    void commit(void);
+    void abort(void) { verified = false; }
+    bool ready(void);
+    void idle(void) { if (!dev->busy()) erase_ahead(wr_addr, ahead); }
+    // Bytes of the last image that was received and read back intact,
+    // else 0.
+    uint32_t length(void) { return (verified) ? image_len : 0; }
+    // CRC-32 of the image as received.
+    uint32_t crc32(void) { return image_crc; }
+
+  private:
+    static const uint16_t PAGE = 256;
+    void program_page(const uint8_t *buf, uint16_t len);
+    void erase_ahead(uint32_t need, uint32_t more);
+
+    XYflashDevice *dev;
+    uint32_t start;
+    uint32_t capacity;
+    uint32_t ahead;
+    uint32_t end = 0;           // end of the range this image may use
+    uint32_t wr_addr = 0;       // next page to program
+    uint32_t erased_to = 0;     // erases issued up to here
+    uint32_t image_len = 0;
+    uint32_t image_crc = 0;
+    bool overflow = false;
+    bool verified = false;
+    bool erasing = false;       // an erase was started, maybe still running
+    uint8_t page[PAGE];
+    uint16_t page_len = 0;
+};
+
+#endif /* _XYSINK_H_ */
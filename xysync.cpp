@@ -0,0 +1,263 @@
+/*
+MIT License
+
+Copyright (c) 2018 gdsports625@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Sync mode, see XYmodem::set_sync(). Sending a whole directory again after
+ * changing one file only costs the time of that file: every other file is
+ * found unchanged from its size and the modification time or CRC-32 in
+ * the file information, and skipped with ZSKIP.
+ *
+ * The index holds fixed size entries of name, size, the sender's
+ * modification time and the CRC-32, one appended each time a file is
+ * recorded. The last entry for a name is the one that counts. Once the
+ * index has XYMODEM_SYNC_COMPACT entries and twice as many as it kept the
+ * last time, it is compacted to one entry per name, written under a
+ * temporary name and renamed, or copied back without a real rename. Losing
+ * the index, or part of it to a power cut during the copy, only costs
+ * reading each file's CRC-32 once more.
+ */
+
+#include <Arduino.h>
+#include <xymodem.h>
+#include <xycrc.h>
+#include <stddef.h>
+
+#if XYMODEM_SYNC
+
+#define DEBUG_ON 0
+
+#if DEBUG_ON
+// Arduino Zero, -DUSB_VID=0x2341 -DUSB_PID=0x804d
+#if USB_VID==0x2341 && USB_PID==0x804d
+/* Programming port */
+#define Debug_Serial Serial
+#else
+#define Debug_Serial Serial1
+#endif
+
+#define dbprint(...) Debug_Serial.print(__VA_ARGS__)
+#define dbprintln(...) Debug_Serial.println(__VA_ARGS__)
+#else
+#define dbprint(...)
+#define dbprintln(...)
+#endif
+
+/*
+ * Decide what to do with the file in rx_filename, rx_file_size and
+ * rx_mtime. The file on the file system must have the same size. Then an
+ * index entry with the same time, or the sender's CRC-32 matching the
+ * index or the file's own, means it is unchanged. SYNC_ASK means only the
+ * sender's CRC-32 can tell, and a ZMODEM sender should be asked for it.
+ */
+XYmodem::syncverdict_t XYmodem::sync_check(void)
+{
+  uint8_t buf[256];
+  uint32_t crc;
+
+  sync_file = false;
+  if (!sync_on || sink != &file_sink || rx_file_size == 0xFFFFFFFF) return SYNC_RECEIVE;
+#if XYMODEM_UNPACK
+  // Stored under another name.
+  if (packed_name(rx_filename)) return SYNC_RECEIVE;
+#endif
+  sync_file = true;
+  sync_found = sync_lookup();
+#if XYMODEM_BATCH
+  if (!file_sink.may_exist(rx_filename)) return SYNC_RECEIVE;
+#endif
+  File f = filesys->open(rx_filename, FILE_READ);
+  if (!f) return SYNC_RECEIVE;
+  if (f.size() != rx_file_size) {
+    f.close();
+    return SYNC_RECEIVE;
+  }
+  bool listed = (sync_found && sync_entry.size == rx_file_size);
+  // A CRC-32 from the sender settles it. Otherwise the time will do.
+  if (listed && !rx_digest_set && rx_mtime != 0 && sync_entry.mtime == rx_mtime) {
+    f.close();
+    return SYNC_SKIP;
+  }
+  if (!rx_digest_set) {
+    f.close();
+    return (zmodem) ? SYNC_ASK : SYNC_RECEIVE;
+  }
+  if (listed) {
+    crc = sync_entry.crc;
+  }
+  else {
+    // Not received in sync mode before, so read it.
+    int n;
+    crc = 0;
+    while ((n = f.read(buf, sizeof(buf))) > 0) crc = xycrc32(crc, buf, n);
+  }
+  f.close();
+  if (crc != rx_digest) return SYNC_RECEIVE;
+  // Same data. Note the sender's time so next time no CRC-32 is needed.
+  if (!listed || sync_entry.mtime != rx_mtime) sync_record(crc);
+  return SYNC_SKIP;
+}
+
+/*
+ * The file offered is already here. Returns false for ZMODEM, whose caller
+ * sends ZSKIP. YMODEM has no way to skip a file, so its data is received
+ * and dropped: that saves the writes, not the link time.
+ */
+bool XYmodem::sync_skip(void)
+{
+  dbprint("unchanged "); dbprintln(rx_filename);
+  XYSTAT(rx_stats.files_skipped++);
+  XYTRACE(XYT_OPEN, 3, min(rx_file_size >> 10, (uint32_t)0xFFFF));
+  sync_file = false;
+  if (zmodem) return false;
+  rx_skip = true;
+  rx_open = true;
+  return true;
+}
+
+/*
+ * entry has the magic and its check matches.
+ */
+bool XYmodem::sync_valid(const xysync_t &entry)
+{
+  return entry.magic == SYNC_MAGIC &&
+      entry.check == xycrc32(0, (const uint8_t *)&entry, offsetof(xysync_t, check));
+}
+
+/*
+ * Find the last index entry for rx_filename and leave it in sync_entry.
+ * Counts the entries in sync_count on the way.
+ */
+bool XYmodem::sync_lookup(void)
+{
+  xysync_t entry;
+  bool found = false;
+
+  sync_count = 0;
+  if (sync_path == NULL) return false;
+  File idx = filesys->open(sync_path, FILE_READ);
+  if (!idx) return false;
+  while (idx.read(&entry, sizeof(entry)) == sizeof(entry)) {
+    sync_count++;
+    if (sync_valid(entry) && strncmp(entry.name, rx_filename, sizeof(entry.name)-1) == 0) {
+      sync_entry = entry;
+      found = true;
+    }
+  }
+  idx.close();
+  return found;
+}
+
+/*
+ * Put rx_filename in the index with its size, the sender's time and crc.
+ */
+void XYmodem::sync_record(uint32_t crc)
+{
+  if (sync_path == NULL) return;
+  memset(&sync_entry, 0, sizeof(sync_entry));
+  sync_entry.magic = SYNC_MAGIC;
+  sync_entry.size = rx_file_size;
+  sync_entry.mtime = rx_mtime;
+  sync_entry.crc = crc;
+  strcpy(sync_entry.name, rx_filename);
+  sync_entry.check = xycrc32(0, (uint8_t *)&sync_entry, offsetof(xysync_t, check));
+  sync_found = true;
+  File idx = filesys->open(sync_path, FILE_WRITE);
+  if (!idx) return;
+  idx.write((uint8_t *)&sync_entry, sizeof(sync_entry));
+  idx.close();
+  sync_count++;
+  if (sync_count >= XYMODEM_SYNC_COMPACT && sync_count >= 2 * sync_kept) sync_compact();
+}
+
+/*
+ * Cross out the first n keys that are name's, and return its key.
+ */
+static uint32_t sync_cross(uint32_t *keys, uint16_t n, const char *name)
+{
+  uint32_t key = xycrc32(0, (const uint8_t *)name, strlen(name)) | 1;
+  for (uint16_t i = 0; i < n; i++) {
+    if (keys[i] == key) keys[i] = 0;
+  }
+  return key;
+}
+
+/*
+ * Write the index again with only the last entry for each name, to
+ * XYSYNC.ID$, and rename it over the index, see XYfileSink::rename(). The
+ * entries are taken
+ * SYNC_WINDOW at a time: the CRC-32 of each name is kept, crossed out if a
+ * later entry has the same, and the entries left are copied. Two
+ * names with the same CRC-32 lose the older entry, which only costs
+ * reading that file's CRC-32 again.
+ */
+void XYmodem::sync_compact(void)
+{
+  static const uint16_t SYNC_WINDOW = 32;
+  uint32_t keys[SYNC_WINDOW];
+  xysync_t entry;
+  char temp[sizeof(entry.name)];
+  uint16_t kept = 0;
+
+  strncpy(temp, sync_path, sizeof(temp)-1);
+  temp[sizeof(temp)-1] = '\0';
+  temp[strlen(temp)-1] = '$';
+  filesys->remove(temp);
+  File in = filesys->open(sync_path, FILE_READ);
+  if (!in) return;
+  File out = filesys->open(temp, FILE_WRITE);
+  if (!out) {
+    in.close();
+    return;
+  }
+  for (uint32_t base = 0; ; base += SYNC_WINDOW) {
+    uint16_t n = 0;
+    if (!in.seek(base * sizeof(entry))) break;
+    // 0 marks an entry not to copy.
+    while (n < SYNC_WINDOW && in.read(&entry, sizeof(entry)) == sizeof(entry)) {
+      keys[n] = 0;
+      if (sync_valid(entry)) keys[n] = sync_cross(keys, n, entry.name);
+      n++;
+    }
+    if (n == 0) break;
+    while (in.read(&entry, sizeof(entry)) == sizeof(entry)) {
+      if (sync_valid(entry)) sync_cross(keys, n, entry.name);
+    }
+    in.seek(base * sizeof(entry));
+    for (uint16_t i = 0; i < n; i++) {
+      if (in.read(&entry, sizeof(entry)) != sizeof(entry)) break;
+      if (keys[i] == 0) continue;
+      out.write((uint8_t *)&entry, sizeof(entry));
+      kept++;
+    }
+    if (n < SYNC_WINDOW) break;
+  }
+  out.close();
+  in.close();
+  filesys->remove((char *)sync_path);
+  if (file_sink.rename(temp, sync_path)) {
+    sync_count = sync_kept = kept;
+  }
+}
+
+#endif /* XYMODEM_SYNC */
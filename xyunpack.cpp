@@ -0,0 +1,210 @@
+/*
+MIT License
+
+Copyright (c) 2018 gdsports625@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Expands files packed by extras/host/xypack while they are received, so
+ * compressible data crosses a slow link in fewer bytes. The packed file is
+ *
+ *   "XYZ", window bits << 4 | length bits, last character of the original
+ *   name, original size (32 bits little endian), LZSS bit stream
+ *
+ * The bit stream is read most significant bit first. A 1 bit is followed
+ * by a literal byte. A 0 bit is followed by distance - 1 in window bits
+ * and count - 1 in length bits: copy count bytes starting distance bytes
+ * back. The window doubles as the output buffer, so expanding a file
+ * needs no RAM beyond it.
+ */
+
+#include <Arduino.h>
+#include <xymodem.h>
+
+#if XYMODEM_UNPACK
+
+#define DEBUG_ON 0
+
+#if DEBUG_ON
+// Arduino Zero, -DUSB_VID=0x2341 -DUSB_PID=0x804d
+#if USB_VID==0x2341 && USB_PID==0x804d
+/* Programming port */
+#define Debug_Serial Serial
+#else
+#define Debug_Serial Serial1
+#endif
+
+#define dbprint(...) Debug_Serial.print(__VA_ARGS__)
+#define dbprintln(...) Debug_Serial.println(__VA_ARGS__)
+#else
+#define dbprint(...)
+#define dbprintln(...)
+#endif
+
+#define UZ_WINDOW (1 << XYMODEM_UNPACK_WINDOW)
+
+/*
+ * The name marks a packed file, e.g. CONFIG.JS_ or README._: it ends in
+ * '_' within an extension of up to three characters.
+ */
+bool XYmodem::packed_name(const char *name)
+{
+  size_t n = strlen(name);
+
+  if (n < 2 || name[n-1] != '_') return false;
+  return strchr(name + ((n > 4) ? n - 4 : 0), '.') != NULL;
+}
+
+/*
+ * Called with the name and size of a new file in rx_filename and
+ * rx_file_remaining. If the name marks a packed file, opening the sink
+ * waits for the header with the real name and size, and true is returned.
+ */
+bool XYmodem::unpack_begin(void)
+{
+  uz_state = UZ_OFF;
+  if (!packed_name(rx_filename)) return false;
+  uz_state = UZ_HEADER;
+  uz_hdr_len = 0;
+  // Kept for unpack_open() in case this is not a packed file after all.
+  uz_left = rx_file_remaining;
+  return true;
+}
+
+/*
+ * Open the sink once the header is in. Without the XYZ magic the file is
+ * stored as it is, under the name it was sent with. If the sink refuses
+ * the file the transfer is cancelled, as it would have been at block 0.
+ */
+bool XYmodem::unpack_open(void)
+{
+  size_t n = strlen(rx_filename);
+  uint32_t size = uz_left;
+  bool packed = (uz_hdr_len == sizeof(uz_hdr) && memcmp(uz_hdr, "XYZ", 3) == 0);
+  bool refused = false;
+
+  if (packed) {
+    uz_wbits = uz_hdr[3] >> 4;
+    uz_lbits = uz_hdr[3] & 0x0F;
+    // Packed for a bigger window than this receiver has, or damaged.
+    refused = (uz_wbits < 4 || uz_wbits > XYMODEM_UNPACK_WINDOW ||
+        uz_lbits < 1 || uz_lbits > 8 || uz_lbits >= uz_wbits);
+    if (uz_hdr[4] == '\0') {
+      rx_filename[n-2] = '\0';
+    }
+    else {
+      rx_filename[n-1] = uz_hdr[4];
+    }
+    size = uz_hdr[5] | (uz_hdr[6] << 8) | ((uint32_t)uz_hdr[7] << 16) |
+      ((uint32_t)uz_hdr[8] << 24);
+  }
+  dbprint("unpack "); dbprint(rx_filename); dbprint(' '); dbprintln(size);
+  if (refused || !sink->open(rx_filename, size)) {
+    dbprintln("rx file open failed or does not fit");
+    rx_open = false;
+    uz_state = UZ_DONE;
+    if (zmodem) {
+      zcancel();
+    }
+    else {
+      cancel();
+    }
+    return false;
+  }
+  XYTRACE(XYT_OPEN, (packed) ? 2 : 0, min(size >> 10, (uint32_t)0xFFFF));
+  if (!packed) {
+    uz_state = UZ_OFF;
+    write_file(uz_hdr, uz_hdr_len);
+    return true;
+  }
+  uz_state = (size > 0) ? UZ_DATA : UZ_DONE;
+  uz_left = size;
+  uz_bits = 0;
+  uz_nbits = 0;
+  uz_head = uz_flushed = 0;
+  return true;
+}
+
+/*
+ * Expand len packed bytes. The plain bytes go on to write_file() whenever
+ * the window wraps and at the end of every call.
+ */
+void XYmodem::unpack(const uint8_t *buf, uint16_t len)
+{
+  while (len > 0 && uz_state == UZ_HEADER) {
+    uz_hdr[uz_hdr_len++] = *buf++;
+    len--;
+    if (uz_hdr_len == sizeof(uz_hdr) && !unpack_open()) return;
+  }
+  if (uz_state == UZ_OFF) {
+    write_file(buf, len);
+    return;
+  }
+  const uint8_t need = 1 + uz_wbits + uz_lbits;
+  for (; len > 0 && uz_state == UZ_DATA; len--) {
+    // At most need - 1 bits are left over, so a byte always fits.
+    uz_bits = (uz_bits << 8) | *buf++;
+    uz_nbits += 8;
+    while (uz_nbits > 0 && uz_left > 0) {
+      if ((uz_bits >> (uz_nbits - 1)) & 1) {
+        if (uz_nbits < 9) break;
+        uz_nbits -= 9;
+        unpack_put(uz_bits >> uz_nbits);
+      }
+      else {
+        if (uz_nbits < need) break;
+        uz_nbits -= need;
+        uint16_t dist = ((uz_bits >> (uz_nbits + uz_lbits)) & ((1 << uz_wbits) - 1)) + 1;
+        uint16_t count = ((uz_bits >> uz_nbits) & ((1 << uz_lbits) - 1)) + 1;
+        uint16_t from = (uz_head - dist) & (UZ_WINDOW - 1);
+        while (count-- > 0 && uz_left > 0) {
+          unpack_put(uz_window[from]);
+          from = (from + 1) & (UZ_WINDOW - 1);
+        }
+      }
+    }
+    // Anything after the last plain byte, such as XMODEM padding, is
+    // dropped.
+    if (uz_left == 0) uz_state = UZ_DONE;
+  }
+  unpack_flush();
+}
+
+void XYmodem::unpack_put(uint8_t c)
+{
+  uz_window[uz_head] = c;
+  uz_head = (uz_head + 1) & (UZ_WINDOW - 1);
+  uz_left--;
+  if (uz_head == 0) {
+    write_file(uz_window + uz_flushed, UZ_WINDOW - uz_flushed);
+    uz_flushed = 0;
+  }
+}
+
+void XYmodem::unpack_flush(void)
+{
+  if (uz_head > uz_flushed) {
+    write_file(uz_window + uz_flushed, uz_head - uz_flushed);
+    uz_flushed = uz_head;
+  }
+}
+
+#endif /* XYMODEM_UNPACK */
@@ -0,0 +1,589 @@
+/*
+MIT License
+
+Copyright (c) 2018 gdsports625@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * ZMODEM receive. Unlike X/YMODEM the sender streams data subpackets
+ * without waiting, each carrying its 32-bit file offset implicitly, and
+ * the receiver only speaks up to acknowledge sync points (ZCRCQ/ZCRCW) or
+ * to ask for a retransmit from the last good offset (ZRPOS). Compatible
+ * with lrzsz sz.
+ */
+
+#include <Arduino.h>
+#include <xymodem.h>
+#include <xycrc.h>
+#include <zmodem.h>
+
+#define DEBUG_ON 0
+
+#if DEBUG_ON
+// Arduino Zero, -DUSB_VID=0x2341 -DUSB_PID=0x804d
+#if USB_VID==0x2341 && USB_PID==0x804d
+/* Programming port */
+#define Debug_Serial Serial
+#else
+#define Debug_Serial Serial1
+#endif
+
+#define dbprint(...) Debug_Serial.print(__VA_ARGS__)
+#define dbprintln(...) Debug_Serial.println(__VA_ARGS__)
+#else
+#define dbprint(...)
+#define dbprintln(...)
+#endif
+
+// zdecode() results other than a data byte
+#define ZD_NONE   -1      // ZDLE or flow control, nothing to store
+#define ZD_ERROR  -2      // invalid escape
+#define ZD_END    0x100   // or'ed with ZCRCE/G/Q/W
+
+// Consecutive errors or timeouts on one file before giving up
+#define ZMAX_ERRORS 10
+
+/*
+ * Start ZMODEM receive. Files are created on filesys as they arrive.
+ */
+int XYmodem::start_rz(Stream *port, void *filesys)
+{
+  YMODEM = true;
+  streaming = false;
+  zmodem = true;
+  return start(port, filesys, NULL, true, true);
+}
+
+void XYmodem::zstart(void)
+{
+  rxmodem_state = ZMODEM;
+  zstate = ZS_HUNT;
+  zdle_pending = false;
+  zcan_count = 0;
+  zerrors = 0;
+  zoffset = 0;
+  zin_len = zin_pos = 0;
+  arm_timer(rto_ms);
+  zsend_rinit();
+}
+
+int XYmodem::zloop(void)
+{
+  int bytesAvail;
+
+  if (timer_expired() && zin_pos == zin_len && port->available() == 0) {
+    ztimeout();
+    return rxmodem_state;
+  }
+  while (rxmodem_state == ZMODEM && rx_pending < XYMODEM_RX_BUFFERS) {
+    if (zin_pos == zin_len) {
+      // Bytes read but not decoded are kept in zin for the next call.
+      bytesAvail = lp_room(port->available());
+      if (bytesAvail <= 0 || !lp_more()) break;
+      zin_len = port->readBytes((char *)zin, min(bytesAvail, (int)sizeof(zin)));
+      zin_pos = 0;
+      lp_bytes += zin_len;
+      arm_timer(rto_ms);
+    }
+    while (zin_pos < zin_len && rxmodem_state == ZMODEM && rx_pending < XYMODEM_RX_BUFFERS) {
+      zrx(zin[zin_pos++]);
+    }
+  }
+  return rxmodem_state;
+}
+
+/*
+ * Nothing heard for a while. Ask again for whatever is missing.
+ */
+void XYmodem::ztimeout(void)
+{
+  dbprintln("ZMODEM timeout");
+  XYSTAT(rx_stats.timeouts++);
+  XYTRACE(XYT_TIMEOUT, 0, 0);
+  rto_timeout();
+  arm_timer(rto_ms);
+  if (zstate == ZS_FIN) {
+    rxmodem_state = IDLE;
+    return;
+  }
+  zstate = ZS_HUNT;
+  zdle_pending = false;
+#if XYMODEM_SYNC
+  if (sync_wait) {
+    // No answer to the ZCRC asked before deciding. Take the file.
+    sync_wait = false;
+    zcrc_wait = false;
+    if (!create_file()) {
+      zsend_hex(ZSKIP, 0);
+      return;
+    }
+    zoffset = rx_resume;
+  }
+#endif
+  if (rx_open) {
+    if (++zerrors > ZMAX_ERRORS) {
+      zcancel();
+      return;
+    }
+#if XYMODEM_DIGEST
+    // No answer to ZCRC. Do without rather than ask forever.
+    zcrc_wait = false;
+#endif
+    zsend_rpos();
+  }
+  else {
+    zsend_rinit();
+  }
+}
+
+/*
+ * Undo ZDLE escaping. Returns a data byte, ZD_END|c for a subpacket end,
+ * ZD_NONE or ZD_ERROR.
+ */
+int XYmodem::zdecode(uint8_t c)
+{
+  if (zdle_pending) {
+    zdle_pending = false;
+    switch (c) {
+      case ZCRCE:
+      case ZCRCG:
+      case ZCRCQ:
+      case ZCRCW:
+        return ZD_END | c;
+      case ZRUB0:
+        return 0x7F;
+      case ZRUB1:
+        return 0xFF;
+    }
+    if ((c & 0x60) == 0x40) return c ^ 0x40;
+    return ZD_ERROR;
+  }
+  if (c == ZDLE) {
+    zdle_pending = true;
+    return ZD_NONE;
+  }
+  // The sender always escapes these, bare ones are flow control.
+  if ((c & 0x7F) == XON || (c & 0x7F) == XOFF) return ZD_NONE;
+  return c;
+}
+
+void XYmodem::zrx(uint8_t c)
+{
+  int d;
+
+  // Five CANs in a row abort the session.
+  if (c == CAN) {
+    if (++zcan_count >= 5) {
+      dbprintln("ZMODEM aborted by sender");
+      XYSTAT(rx_stats.cans++);
+      XYTRACE(XYT_CAN, 1, 0);
+      close_file(false);
+      rxmodem_state = IDLE;
+      return;
+    }
+  }
+  else {
+    zcan_count = 0;
+  }
+
+  switch (zstate) {
+    case ZS_DATA:
+      d = zdecode(c);
+      if (d == ZD_NONE) break;
+      if (d == ZD_ERROR) {
+        zerror();
+      }
+      else if (d & ZD_END) {
+        zend = d & 0xFF;
+        zhdr_len = 0;
+        zstate = ZS_CRC;
+      }
+      else if (zlen >= rx_buf_size) {
+        dbprintln("ZMODEM subpacket too long");
+        zerror();
+      }
+      else {
+        rx_buf[zlen++] = d;
+      }
+      break;
+    case ZS_CRC:
+      d = zdecode(c);
+      if (d == ZD_NONE) break;
+      if (d < 0 || d >= ZD_END) {
+        zerror();
+        break;
+      }
+      zhdr[zhdr_len++] = d;
+      if (zhdr_len == ((zhdr32) ? 4 : 2)) {
+        zsubpacket();
+      }
+      break;
+    case ZS_HUNT:
+      if (c == ZPAD) zstate = ZS_PAD;
+      break;
+    case ZS_PAD:
+      if (c == ZDLE) {
+        zstate = ZS_FORMAT;
+      }
+      else if (c != ZPAD) {
+        zstate = ZS_HUNT;
+      }
+      break;
+    case ZS_FORMAT:
+      zhdr_len = 0;
+      zdle_pending = false;
+      if (c == ZBIN || c == ZBIN32) {
+        zhdr32 = (c == ZBIN32);
+        zstate = ZS_BINHDR;
+      }
+      else if (c == ZHEX) {
+        zhdr32 = false;
+        zstate = ZS_HEXHDR;
+      }
+      else {
+        zstate = ZS_HUNT;
+      }
+      break;
+    case ZS_BINHDR:
+      d = zdecode(c);
+      if (d == ZD_NONE) break;
+      if (d < 0 || d >= ZD_END) {
+        zstate = ZS_HUNT;
+        break;
+      }
+      zhdr[zhdr_len++] = d;
+      if (zhdr_len == ((zhdr32) ? 9 : 7)) {
+        bool ok;
+        if (zhdr32) {
+          uint32_t crc = xycrc32(0, zhdr, 5);
+          ok = (crc == ((uint32_t)zhdr[5] | (uint32_t)zhdr[6] << 8 |
+                (uint32_t)zhdr[7] << 16 | (uint32_t)zhdr[8] << 24));
+        }
+        else {
+          ok = (xycrc16(0, zhdr, 7) == 0);
+        }
+        zstate = ZS_HUNT;
+        if (ok) zheader();
+      }
+      break;
+    case ZS_HEXHDR:
+      {
+        uint8_t nibble;
+        if (c >= '0' && c <= '9') nibble = c - '0';
+        else if (c >= 'a' && c <= 'f') nibble = c - 'a' + 10;
+        else {
+          zstate = ZS_HUNT;
+          break;
+        }
+        if (zhdr_len & 1) {
+          zhdr[zhdr_len / 2] |= nibble;
+        }
+        else {
+          zhdr[zhdr_len / 2] = nibble << 4;
+        }
+        if (++zhdr_len == 14) {
+          zhdr32 = false;
+          zstate = ZS_HUNT;
+          if (xycrc16(0, zhdr, 7) == 0) zheader();
+        }
+      }
+      break;
+    case ZS_FIN:
+      // Sender signs off with "OO" after our ZFIN.
+      if (c == 'O' && ++zhdr_len >= 2) {
+        rxmodem_state = IDLE;
+      }
+      break;
+  }
+}
+
+/*
+ * A header with a good CRC arrived. zhdr[0] is the type, zhdr[1..4] the
+ * position (little endian) or flags.
+ */
+void XYmodem::zheader(void)
+{
+  uint32_t pos = (uint32_t)zhdr[1] | (uint32_t)zhdr[2] << 8 |
+    (uint32_t)zhdr[3] << 16 | (uint32_t)zhdr[4] << 24;
+
+  dbprint("ZMODEM header "); dbprint(zhdr[0]); dbprint(' '); dbprintln(pos);
+  XYTRACE(XYT_ZHDR, zhdr[0], pos);
+  rtt_sample();
+  zframe = zhdr[0];
+  switch (zframe) {
+    case ZRQINIT:
+      zsend_rinit();
+      break;
+    case ZSINIT:
+    case ZFILE:
+      XYSTAT(rx_block_start = micros());
+      zlen = 0;
+      zstate = ZS_DATA;
+      break;
+    case ZDATA:
+      if (!rx_open) {
+        zsend_rinit();
+      }
+      else if (pos != zoffset) {
+        // Data for the wrong place, e.g. still in flight from before our
+        // last ZRPOS. Skip it and ask again.
+        zerror();
+      }
+      else {
+        XYSTAT(rx_block_start = micros());
+        zlen = 0;
+        zstate = ZS_DATA;
+#if XYMODEM_DIGEST
+        // The sender went ahead without answering ZCRC. Do without.
+        zcrc_wait = false;
+#endif
+      }
+      break;
+#if XYMODEM_DIGEST
+    case ZCRC:
+      // CRC-32 of the whole file, asked for after ZFILE.
+#if XYMODEM_SYNC
+      if (zcrc_wait && (rx_open || sync_wait)) {
+#else
+      if (zcrc_wait && rx_open) {
+#endif
+        rx_digest = pos;
+        rx_digest_set = true;
+        zcrc_wait = false;
+        zerrors = 0;
+#if XYMODEM_SYNC
+        if (sync_wait) {
+          // Asked before deciding whether the file is wanted at all.
+          sync_wait = false;
+          if (!((sync_check() == SYNC_SKIP) ? sync_skip() : create_file())) {
+            zsend_hex(ZSKIP, 0);
+            break;
+          }
+          zoffset = rx_resume;
+        }
+#endif
+        zsend_hex(ZRPOS, zoffset);
+      }
+      break;
+#endif
+    case ZEOF:
+      // An early EOF may have been sent before our ZRPOS got through.
+      // Ignore it, the timeout asks for the data again.
+      if (rx_open && pos == zoffset) {
+#if XYMODEM_BATCH
+        // In a batch the next ZFILE is on its way while this file is
+        // closed.
+        if (batch_on) {
+          zerrors = 0;
+          zsend_rinit();
+          rtt_send();
+          close_file(true);
+          break;
+        }
+#endif
+        close_file(true);
+        zerrors = 0;
+        zsend_rinit();
+        rtt_send();
+      }
+      break;
+    case ZFIN:
+      zsend_hex(ZFIN, 0);
+      zhdr_len = 0;
+      zstate = ZS_FIN;
+      arm_timer(min(rto_ms, TIMEOUT_SHORT));
+      break;
+    case ZFREECNT:
+      zsend_hex(ZACK, 0);
+      break;
+    case ZCAN:
+    case ZABORT:
+      XYSTAT(rx_stats.cans++);
+      XYTRACE(XYT_CAN, 1, 0);
+      close_file(false);
+      zsend_hex(ZFIN, 0);
+      rxmodem_state = IDLE;
+      break;
+  }
+}
+
+/*
+ * A complete data subpacket is in rx_buf[0..zlen) and its CRC in zhdr.
+ */
+void XYmodem::zsubpacket(void)
+{
+  bool ok;
+
+  if (zhdr32) {
+    uint32_t crc = xycrc32(0, rx_buf, zlen);
+    crc = xycrc32(crc, &zend, 1);
+    ok = (crc == ((uint32_t)zhdr[0] | (uint32_t)zhdr[1] << 8 |
+          (uint32_t)zhdr[2] << 16 | (uint32_t)zhdr[3] << 24));
+  }
+  else {
+    uint16_t crc = xycrc16(0, rx_buf, zlen);
+    crc = xycrc16(crc, &zend, 1);
+    ok = (crc == ((uint16_t)zhdr[0] << 8 | zhdr[1]));
+  }
+  XYTRACE(XYT_ZDATA, zend, zlen);
+  if (!ok) {
+    dbprintln("ZMODEM CRC bad");
+    XYTRACE(XYT_BADCHK, 0, 0);
+    zerror();
+    return;
+  }
+
+  zstate = ZS_HUNT;
+  switch (zframe) {
+    case ZSINIT:
+      zsend_hex(ZACK, 0);
+      break;
+    case ZFILE:
+      if (rx_open) {
+        // Our ZRPOS was lost, the sender is repeating itself.
+        zsend_rpos();
+        break;
+      }
+      rx_buf[min(zlen, (uint16_t)(rx_buf_size - 1))] = '\0';
+      XYSTAT(block_time());
+      if (open_file()) {
+        zoffset = rx_resume;
+        zerrors = 0;
+#if XYMODEM_DIGEST
+        zcrc_wait = !rx_digest_set;
+#endif
+        zsend_rpos();
+      }
+      else {
+        zsend_hex(ZSKIP, 0);
+      }
+      break;
+    case ZDATA:
+      XYSTAT(block_time(); rx_stats.bytes_rx += zlen; rx_block_start = micros());
+      queue_block(zlen);
+      zoffset += zlen;
+      zerrors = 0;
+      zlen = 0;
+      switch (zend) {
+        case ZCRCG:
+          zstate = ZS_DATA;
+          break;
+        case ZCRCQ:
+          zsend_hex(ZACK, zoffset);
+          zstate = ZS_DATA;
+          break;
+        case ZCRCW:
+          zsend_hex(ZACK, zoffset);
+          break;
+      }
+      break;
+  }
+}
+
+/*
+ * Bad subpacket or data for the wrong offset. Ask the sender to go back to
+ * the last good offset and drop everything until the next header.
+ */
+void XYmodem::zerror(void)
+{
+  XYSTAT(rx_stats.blocks_nak++);
+  zstate = ZS_HUNT;
+  zdle_pending = false;
+  if (!rx_open) {
+    zsend_hex(ZNAK, 0);
+    return;
+  }
+  if (++zerrors > ZMAX_ERRORS) {
+    zcancel();
+    return;
+  }
+  zsend_rpos();
+}
+
+/*
+ * Ask for data from zoffset on, or first for the file's CRC-32.
+ */
+void XYmodem::zsend_rpos(void)
+{
+#if XYMODEM_DIGEST
+  if (zcrc_wait) {
+    zsend_hex(ZCRC, 0);
+    rtt_send();
+    return;
+  }
+#endif
+  zsend_hex(ZRPOS, zoffset);
+}
+
+void XYmodem::zsend_rinit(void)
+{
+  zsend_hex(ZRINIT, (uint32_t)XYMODEM_ZRXBUF |
+      (uint32_t)(CANFDX | CANOVIO | CANFC32) << 24);
+}
+
+/*
+ * Send a hex header. pos goes out little endian as ZP0..ZP3, so for
+ * flag headers ZF0 is the top byte.
+ */
+void XYmodem::zsend_hex(uint8_t type, uint32_t pos)
+{
+  static const char hex[] = "0123456789abcdef";
+  uint8_t hdr[7] = {type, (uint8_t)pos, (uint8_t)(pos >> 8),
+    (uint8_t)(pos >> 16), (uint8_t)(pos >> 24)};
+  uint8_t out[4 + 14 + 3];
+  uint8_t n = 0;
+
+  if (type == ZRPOS) {
+    XYTRACE(XYT_ZRPOS, pos >> 16, pos);
+    rtt_send();
+  }
+  uint16_t crc = xycrc16(0, hdr, 5);
+  hdr[5] = crc >> 8;
+  hdr[6] = crc & 0xFF;
+  out[n++] = ZPAD;
+  out[n++] = ZPAD;
+  out[n++] = ZDLE;
+  out[n++] = ZHEX;
+  for (uint8_t i = 0; i < 7; i++) {
+    out[n++] = hex[hdr[i] >> 4];
+    out[n++] = hex[hdr[i] & 0x0F];
+  }
+  out[n++] = '\r';
+  out[n++] = '\n' | 0x80;
+  if (type != ZACK && type != ZFIN) out[n++] = XON;
+  port->write(out, n);
+  port->flush();
+}
+
+void XYmodem::zcancel(void)
+{
+  static const uint8_t canistr[] = {
+    CAN, CAN, CAN, CAN, CAN, CAN, CAN, CAN, CAN, CAN,
+    '\b', '\b', '\b', '\b', '\b', '\b', '\b', '\b', '\b', '\b'
+  };
+  dbprintln("ZMODEM cancel");
+  XYSTAT(rx_stats.cans++);
+  XYTRACE(XYT_CAN, 0, 0);
+  port->write(canistr, sizeof(canistr));
+  port->flush();
+  close_file(false);
+  rxmodem_state = IDLE;
+}
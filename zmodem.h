@@ -0,0 +1,84 @@
+/*
+MIT License
+
+Copyright (c) 2018 gdsports625@gmail.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef _ZMODEM_H_
+#define _ZMODEM_H_
+
+// ZMODEM protocol constants, names as in Chuck Forsberg's zmodem.h.
+
+#define ZPAD '*'          // Pad character, begins frames
+#define ZDLE 0x18         // Escape character, same as CAN
+#define ZDLEE (ZDLE^0100) // Escaped ZDLE as transmitted
+#define ZBIN 'A'          // Binary frame indicator (CRC-16)
+#define ZHEX 'B'          // HEX frame indicator
+#define ZBIN32 'C'        // Binary frame with 32 bit FCS
+
+// Frame types
+#define ZRQINIT 0         // Request receive init
+#define ZRINIT 1          // Receive init
+#define ZSINIT 2          // Send init sequence (optional)
+#define ZACK 3            // ACK to above
+#define ZFILE 4           // File name from sender
+#define ZSKIP 5           // To sender: skip this file
+#define ZNAK 6            // Last packet was garbled
+#define ZABORT 7          // Abort batch transfers
+#define ZFIN 8            // Finish session
+#define ZRPOS 9           // Resume data trans at this position
+#define ZDATA 10          // Data packet(s) follow
+#define ZEOF 11           // End of file
+#define ZFERR 12          // Fatal Read or Write error Detected
+#define ZCRC 13           // Request for file CRC and response
+#define ZCHALLENGE 14     // Receiver's Challenge
+#define ZCOMPL 15         // Request is complete
+#define ZCAN 16           // Other end canned session with CAN*5
+#define ZFREECNT 17       // Request for free bytes on filesystem
+#define ZCOMMAND 18       // Command from sending program
+#define ZSTDERR 19        // Output to standard error, data follows
+
+// ZDLE sequences
+#define ZCRCE 'h'         // CRC next, frame ends, header packet follows
+#define ZCRCG 'i'         // CRC next, frame continues nonstop
+#define ZCRCQ 'j'         // CRC next, frame continues, ZACK expected
+#define ZCRCW 'k'         // CRC next, ZACK expected, end of frame
+#define ZRUB0 'l'         // Translate to rubout 0177
+#define ZRUB1 'm'         // Translate to rubout 0377
+
+// Bit Masks for ZRINIT flags byte ZF0
+#define CANFDX 0x01       // Rx can send and receive true FDX
+#define CANOVIO 0x02      // Rx can receive data during disk I/O
+#define CANBRK 0x04       // Rx can send a break signal
+#define CANCRY 0x08       // Receiver can decrypt
+#define CANLZW 0x10       // Receiver can uncompress
+#define CANFC32 0x20      // Receiver can use 32 bit Frame Check
+#define ESCCTL 0x40       // Receiver expects ctl chars to be escaped
+#define ESC8 0x80         // Receiver expects 8th bit to be escaped
+
+#ifndef XON
+#define XON 0x11
+#endif
+#ifndef XOFF
+#define XOFF 0x13
+#endif
+
+#endif /* _ZMODEM_H_ */